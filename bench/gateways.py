@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2013-2018 Ardexa Pty Ltd
+#
+# This code is licensed under the MIT License (MIT).
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+# Several buses benchmark. A trace of a site with several IP gateways (and, optionally, a serial port) is made,
+# where every channel read takes as long as it would on the bus, and it is played back with the buses read in
+# turn, and then with -z (see "Several buses and IP gateways" in the readme). The player answers each bus from
+# its own thread, so it stands in for the gateways, and the time of a sweep shows how much is gained by polling
+# the buses at once. Run as root, from the build directory:
+#
+#     sudo ../bench/gateways.py --binary ./ardexa-sma --buses 3,3,2
+#
+# Each number is the inverters on one gateway. With --serial, the last one is on COM1 instead. The endpoint
+# log of each -z run is kept in the output directory (--keep), to check the reads of each bus.
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+
+from scaling import trace_writer, handle_arrays, CHANNELS, DEVICE_HANDLES_INITIAL, CHANNEL_HANDLES_INITIAL
+from scaling import CALL_INITIALIZE, CALL_GET_DRIVERS, CALL_DRIVER_NAME, CALL_DRIVER_ONLINE, CALL_DRIVER_OFFLINE
+from scaling import CALL_SHUTDOWN, CALL_DETECT_DEVICES, CALL_DEVICE_HANDLES, CALL_DEVICE_NAME
+from scaling import CALL_CHANNEL_HANDLES, CALL_CHANNEL_NAME, CALL_CHANNEL_UNIT, CALL_CHANNEL_VALUE
+
+CALL_DEVICE_ENDPOINT = 17
+
+IP_DRIVER = 1
+SERIAL_DRIVER = 2
+# The first gateway, eg; 192.168.1.50. The peer is the address in host byte order
+FIRST_GATEWAY = (192 << 24) | (168 << 16) | (1 << 8) | 50
+
+
+def make_trace(path, buses, serial, channels, sweeps, read_us):
+    drivers = [IP_DRIVER, SERIAL_DRIVER] if serial else [IP_DRIVER]
+    names = {IP_DRIVER: 'IP1', SERIAL_DRIVER: 'COM1'}
+
+    # The route (driver and peer) of each device
+    routes = []
+    for bus, count in enumerate(buses):
+        on_serial = (serial) and (bus == len(buses) - 1)
+        route = (SERIAL_DRIVER, 0) if on_serial else (IP_DRIVER, FIRST_GATEWAY + bus)
+        routes += [route] * count
+    devices = len(routes)
+    handles = [1000 + i for i in range(devices)]
+
+    trace = trace_writer(path)
+    trace.record(CALL_INITIALIZE, 0, 0, 0, number=len(drivers))
+    trace.record(CALL_GET_DRIVERS, 10, 0, len(drivers), handles=drivers)
+    for driver in drivers:
+        trace.record(CALL_DRIVER_NAME, driver, 0, 1, text=names[driver])
+        trace.record(CALL_DRIVER_ONLINE, driver, 0, 1)
+    trace.record(CALL_DETECT_DEVICES, devices, 1, 0)
+    for size in handle_arrays(devices, DEVICE_HANDLES_INITIAL):
+        trace.record(CALL_DEVICE_HANDLES, size, 0, len(handles[:size]), handles=handles[:size])
+    for device in handles:
+        trace.record(CALL_DEVICE_NAME, device, 0, 0, text='WR46A-01 SN:%d' % (2000000000 + device))
+    # Asked for when the devices are grouped by bus. Left over when the buses are read in turn
+    for device, route in zip(handles, routes):
+        trace.record(CALL_DEVICE_ENDPOINT, device, 0, 1, handles=list(route))
+
+    for sweep in range(sweeps):
+        for index, device in enumerate(handles):
+            channel_handles = [device * 100 + i for i in range(channels)]
+            if sweep == 0:
+                for size in handle_arrays(channels, CHANNEL_HANDLES_INITIAL):
+                    trace.record(CALL_CHANNEL_HANDLES, device, 0, len(channel_handles[:size]), handles=channel_handles[:size])
+                for i, channel in enumerate(channel_handles):
+                    name, units = CHANNELS[i % len(CHANNELS)]
+                    trace.record(CALL_CHANNEL_NAME, channel, 0, 0, text=name)
+                    trace.record(CALL_CHANNEL_UNIT, channel, 0, 0, text=units)
+            for i, channel in enumerate(channel_handles):
+                name = CHANNELS[i % len(CHANNELS)][0]
+                text = 'Mpp' if name == 'Mode' else ''
+                trace.record(CALL_CHANNEL_VALUE, channel, device, 0, number=1000 + index + i + sweep, text=text,
+                             duration_us=read_us)
+
+    for driver in drivers:
+        trace.record(CALL_DRIVER_NAME, driver, 0, 1, text=names[driver])
+        trace.record(CALL_DRIVER_OFFLINE, driver, 0, 0)
+    trace.record(CALL_SHUTDOWN, 0, 0, 0)
+    trace.close()
+    return devices
+
+
+def run(binary, trace, devices, delay, at_once, keep):
+    work = tempfile.mkdtemp(prefix='ardexa-sma-gateways-')
+    try:
+        logs = os.path.join(work, 'logs')
+        command = [binary, '-n', str(devices), '-p', trace, '-l', logs, '-s', str(delay), '-d']
+        if at_once > 0:
+            command += ['-z', str(at_once)]
+        result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+        if result.returncode != 0:
+            raise RuntimeError('%s exited with %d: %s' % (binary, result.returncode, result.stdout.strip()[-500:]))
+        times = [float(m.group(1)) for m in re.finditer(r'Query took: ([\d.]+) Seconds', result.stdout)]
+        seconds = sum(times) / len(times) if times else float('nan')
+        if (keep) and (os.path.isdir(os.path.join(logs, 'endpoint'))):
+            shutil.copytree(os.path.join(logs, 'endpoint'), os.path.join(keep, 'endpoint-z%d' % at_once), dirs_exist_ok=True)
+        return seconds
+    finally:
+        shutil.rmtree(work)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure the time of a sweep with the buses read in turn and at once')
+    parser.add_argument('--binary', default='./ardexa-sma')
+    parser.add_argument('--buses', default='3,3,2', help='comma separated numbers of inverters on each bus')
+    parser.add_argument('--serial', action='store_true', help='the last bus is a serial port rather than a gateway')
+    parser.add_argument('--channels', type=int, default=8, help='spot channels for each device')
+    parser.add_argument('--read-ms', type=int, default=60, help='milliseconds that each channel read takes')
+    parser.add_argument('--sweeps', type=int, default=3)
+    parser.add_argument('--delay', type=int, default=6, help='seconds between sweeps')
+    parser.add_argument('--keep', default='', help='directory to keep the endpoint logs of the -z runs in')
+    args = parser.parse_args()
+
+    buses = [int(n) for n in args.buses.split(',')]
+    work = tempfile.mkdtemp(prefix='ardexa-sma-gateways-')
+    try:
+        trace = os.path.join(work, 'gateways.trace')
+        devices = make_trace(trace, buses, args.serial, args.channels, args.sweeps, args.read_ms * 1000)
+
+        print('%10s %16s' % ('at once', 'seconds/sweep'))
+        for at_once in [0] + list(range(2, len(buses) + 1)):
+            seconds = run(args.binary, trace, devices, args.delay, at_once, args.keep)
+            print('%10s %16.2f' % ('in turn' if at_once == 0 else str(at_once), seconds))
+    finally:
+        shutil.rmtree(work)
+
+
+if __name__ == '__main__':
+    main()
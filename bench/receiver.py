@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2013-2018 Ardexa Pty Ltd
+#
+# This code is licensed under the MIT License (MIT).
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+# A stand-in for the HTTP endpoint that the spool (-u) delivers to (see "Forwarding to an HTTP endpoint" in the
+# readme). It decodes each gzip batch, and prints a line for it: its X-Spool-Offset, the number of records, how
+# old its oldest record is, and whether the batch was refused or seen before. So an outage, and the backlog
+# being sent afterwards (at the -w rate), can be watched. For example:
+#
+#     ../bench/receiver.py --port 8080 --outage 60:120
+#     sudo ./ardexa-sma -c yasdi.conf -n 1 -s 10 -u http://127.0.0.1:8080/sma
+#
+# refuses every batch (with 503) from 60 seconds after it starts, for 120 seconds. Sending it SIGUSR1 turns
+# refusing on or off at any time; --down closes the port instead, so that the endpoint can't be reached at all.
+# With --output, the records that were accepted are appended to a file, without the batches seen before.
+
+import argparse
+import gzip
+import json
+import os
+import signal
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+
+class receiver_state:
+    def __init__(self, outages, refusing, output):
+        self.started = time.time()
+        self.outages = outages
+        self.refusing = refusing
+        self.output = output
+        self.seen = set()
+        self.batches = 0
+        self.records = 0
+        self.duplicates = 0
+        self.refused = 0
+
+    def in_outage(self):
+        elapsed = time.time() - self.started
+        return any(start <= elapsed < start + length for start, length in self.outages)
+
+    def refuse(self):
+        return self.refusing or self.in_outage()
+
+
+class spool_handler(BaseHTTPRequestHandler):
+    state = None
+
+    def do_POST(self):
+        state = self.state
+        body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        offset = self.headers.get('X-Spool-Offset', '?')
+
+        if state.refuse():
+            state.refused += 1
+            self.reply(503)
+            report(offset, None, 'refused')
+            return
+
+        try:
+            if self.headers.get('Content-Encoding') == 'gzip':
+                body = gzip.decompress(body)
+            lines = [json.loads(line) for line in body.decode().splitlines() if line]
+        except (OSError, ValueError) as error:
+            self.reply(400)
+            report(offset, None, 'bad batch: %s' % error)
+            return
+
+        self.reply(200)
+        duplicate = offset in state.seen
+        state.seen.add(offset)
+        state.batches += 1
+        if duplicate:
+            state.duplicates += 1
+        else:
+            state.records += len(lines)
+            if state.output:
+                with open(state.output, 'a') as writer:
+                    for record in lines:
+                        writer.write(json.dumps(record) + '\n')
+        report(offset, lines, 'seen before' if duplicate else 'accepted')
+
+    def reply(self, status):
+        self.send_response(status)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def log_message(self, format, *args):
+        pass
+
+
+def report(offset, lines, what):
+    stamp = time.strftime('%H:%M:%S')
+    if lines is None:
+        print('%s %-14s %s' % (stamp, offset, what), flush=True)
+        return
+    times = [record.get('time') for record in lines if isinstance(record.get('time'), (int, float))]
+    age = (time.time() - min(times)) if times else 0
+    print('%s %-14s %5d records, oldest %6.0f s old, %s' % (stamp, offset, len(lines), age, what), flush=True)
+
+
+def parse_outages(text):
+    outages = []
+    for outage in filter(None, text.split(',')):
+        start, length = outage.split(':')
+        outages.append((float(start), float(length)))
+    return outages
+
+
+def main():
+    parser = argparse.ArgumentParser(description='A local endpoint for the spool, to test its delivery')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--outage', default='', help='comma separated start:length (seconds from now) to refuse batches')
+    parser.add_argument('--refuse', action='store_true', help='refuse batches until SIGUSR1')
+    parser.add_argument('--down', action='store_true', help='during an outage, close the port rather than refuse')
+    parser.add_argument('--output', default='', help='file to append the accepted records to')
+    args = parser.parse_args()
+
+    state = receiver_state(parse_outages(args.outage), args.refuse, args.output)
+    spool_handler.state = state
+
+    def toggle(signum, frame):
+        state.refusing = not state.refusing
+        print('%s now %s' % (time.strftime('%H:%M:%S'), 'refusing' if state.refusing else 'accepting'), flush=True)
+    signal.signal(signal.SIGUSR1, toggle)
+
+    print('Listening on %s:%d (pid %d)' % (args.host, args.port, os.getpid()), flush=True)
+    server = None
+    try:
+        while True:
+            if (args.down) and (state.refuse()):
+                # Nothing listening: the spool can't connect at all
+                if server:
+                    server.server_close()
+                    server = None
+                    print('%s down' % time.strftime('%H:%M:%S'), flush=True)
+                time.sleep(0.5)
+                continue
+            if not server:
+                if state.batches or state.refused:
+                    print('%s up' % time.strftime('%H:%M:%S'), flush=True)
+                server = HTTPServer((args.host, args.port), spool_handler)
+                server.timeout = 0.5
+            server.handle_request()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if server:
+            server.server_close()
+        print('%d batches, %d records, %d seen before, %d refused' % (state.batches, state.records, state.duplicates, state.refused))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2013-2018 Ardexa Pty Ltd
+#
+# This code is licensed under the MIT License (MIT).
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+# Scaling benchmark. For each number of devices, a trace of that many simulated inverters is made (see
+# "Capturing and playing back traces" in the readme) and played back, and the CPU time and resident memory
+# of each sweep are taken from the debug output. The calls in the trace take no time, so only the work done
+# by ardexa-sma itself is measured. Run as root, from the build directory:
+#
+#     sudo ../bench/scaling.py --binary ./ardexa-sma --devices 1,50,100,250,500
+#
+
+import argparse
+import os
+import re
+import shutil
+import struct
+import subprocess
+import tempfile
+
+TRACE_MAGIC = b'SMATRACE'
+TRACE_VERSION = 1
+
+CALL_INITIALIZE = 1
+CALL_GET_DRIVERS = 2
+CALL_DRIVER_NAME = 3
+CALL_DRIVER_ONLINE = 4
+CALL_DRIVER_OFFLINE = 5
+CALL_SHUTDOWN = 6
+CALL_DETECT_DEVICES = 7
+CALL_DEVICE_HANDLES = 8
+CALL_DEVICE_NAME = 9
+CALL_CHANNEL_HANDLES = 10
+CALL_CHANNEL_NAME = 12
+CALL_CHANNEL_UNIT = 13
+CALL_CHANNEL_VALUE = 14
+
+TRACE_HAS_NUMBER = 0x01
+TRACE_HAS_TEXT = 0x02
+TRACE_HAS_HANDLES = 0x04
+
+# The handles that main.cpp asks for at first
+DEVICE_HANDLES_INITIAL = 50
+CHANNEL_HANDLES_INITIAL = 500
+
+# Spot channels of a typical inverter, with their units
+CHANNELS = [('Pac', 'W'), ('E-Total', 'kWh'), ('h-Total', 'h'), ('h-On', 'h'), ('Mode', ''), ('Error', ''),
+            ('Fac', 'Hz'), ('Vac', 'V'), ('Iac', 'mA'), ('Vpv', 'V'), ('Ipv', 'mA'), ('A.Ms.Vol', 'V'),
+            ('A.Ms.Amp', 'A'), ('A.Ms.Watt', 'W'), ('B.Ms.Vol', 'V'), ('B.Ms.Amp', 'A'), ('B.Ms.Watt', 'W'),
+            ('GridMs.W.phsA', 'W'), ('GridMs.W.phsB', 'W'), ('GridMs.W.phsC', 'W'), ('Temperature', 'degC'),
+            ('Event-Cnt', ''), ('Power On', ''), ('Grid Type', '')]
+
+
+class trace_writer:
+    def __init__(self, path):
+        self.out = open(path, 'wb')
+        self.out.write(TRACE_MAGIC + struct.pack('=I', TRACE_VERSION))
+
+    def record(self, call, arg0, arg1, result, number=None, text=None, handles=None, duration_us=0):
+        flags = 0
+        if number is not None: flags |= TRACE_HAS_NUMBER
+        if text is not None: flags |= TRACE_HAS_TEXT
+        if handles is not None: flags |= TRACE_HAS_HANDLES
+        self.out.write(struct.pack('=BBIIiII', call, flags, arg0, arg1, result, 0, duration_us))
+        if number is not None:
+            self.out.write(struct.pack('=d', number))
+        if text is not None:
+            data = text.encode()
+            self.out.write(struct.pack('=H', len(data)) + data)
+        if handles is not None:
+            self.out.write(struct.pack('=I', len(handles)) + b''.join(struct.pack('=I', h) for h in handles))
+
+    def close(self):
+        self.out.close()
+
+
+def handle_arrays(count, initial):
+    # The sizes of the arrays that main.cpp asks with: doubled until they aren't filled
+    size = initial
+    sizes = [size]
+    while count >= size:
+        size *= 2
+        sizes.append(size)
+    return sizes
+
+
+def make_trace(path, devices, channels, sweeps):
+    trace = trace_writer(path)
+    trace.record(CALL_INITIALIZE, 0, 0, 0, number=1)
+    trace.record(CALL_GET_DRIVERS, 10, 0, 1, handles=[1])
+    trace.record(CALL_DRIVER_NAME, 1, 0, 1, text='COM1')
+    trace.record(CALL_DRIVER_ONLINE, 1, 0, 1)
+    trace.record(CALL_DETECT_DEVICES, devices, 1, 0)
+
+    handles = [1000 + i for i in range(devices)]
+    for size in handle_arrays(devices, DEVICE_HANDLES_INITIAL):
+        filled = handles[:size]
+        trace.record(CALL_DEVICE_HANDLES, size, 0, len(filled), handles=filled)
+    for device in handles:
+        trace.record(CALL_DEVICE_NAME, device, 0, 0, text='WR46A-01 SN:%d' % (2000000000 + device))
+
+    for sweep in range(sweeps):
+        for index, device in enumerate(handles):
+            channel_handles = [device * 100 + i for i in range(channels)]
+            # The channels are only asked for in the first sweep
+            if sweep == 0:
+                for size in handle_arrays(channels, CHANNEL_HANDLES_INITIAL):
+                    trace.record(CALL_CHANNEL_HANDLES, device, 0, len(channel_handles[:size]), handles=channel_handles[:size])
+                for i, channel in enumerate(channel_handles):
+                    name, units = CHANNELS[i % len(CHANNELS)]
+                    trace.record(CALL_CHANNEL_NAME, channel, 0, 0, text=name)
+                    trace.record(CALL_CHANNEL_UNIT, channel, 0, 0, text=units)
+            for i, channel in enumerate(channel_handles):
+                name = CHANNELS[i % len(CHANNELS)][0]
+                text = 'Mpp' if name == 'Mode' else ''
+                trace.record(CALL_CHANNEL_VALUE, channel, device, 0, number=1000 + index + i + sweep, text=text)
+
+    # The playback ends after the last reading, and shuts down
+    trace.record(CALL_DRIVER_NAME, 1, 0, 1, text='COM1')
+    trace.record(CALL_DRIVER_OFFLINE, 1, 0, 0)
+    trace.record(CALL_SHUTDOWN, 0, 0, 0)
+    trace.close()
+
+
+def run(binary, devices, channels, sweeps, delay, options):
+    work = tempfile.mkdtemp(prefix='ardexa-sma-bench-')
+    try:
+        trace = os.path.join(work, 'bench.trace')
+        make_trace(trace, devices, channels, sweeps)
+        command = [binary, '-n', str(devices), '-p', trace, '-l', os.path.join(work, 'logs'), '-s', str(delay), '-d'] + options
+        output = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True).stdout
+        pattern = re.compile(r'Query took: ([\d.]+) Seconds, (\d+) devices, CPU ([\d.]+) ms, RSS (\d+) kB')
+        return [(float(m.group(3)), int(m.group(4))) for m in pattern.finditer(output)]
+    finally:
+        shutil.rmtree(work)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure the CPU time and memory of a sweep for numbers of simulated devices')
+    parser.add_argument('--binary', default='./ardexa-sma')
+    parser.add_argument('--devices', default='1,10,50,100,200,300,400,500', help='comma separated numbers of devices')
+    parser.add_argument('--channels', type=int, default=len(CHANNELS), help='spot channels for each device')
+    parser.add_argument('--sweeps', type=int, default=3, help='sweeps for each number of devices. The first is left out')
+    parser.add_argument('--delay', type=int, default=6, help='seconds between sweeps')
+    parser.add_argument('--options', default='', help='other options for ardexa-sma, eg; "-m -a"')
+    args = parser.parse_args()
+
+    print('%8s %14s %18s %10s %16s' % ('devices', 'CPU/sweep(ms)', 'CPU/device(us)', 'RSS(kB)', 'RSS/device(kB)'))
+    baseline = None
+    for devices in [int(n) for n in args.devices.split(',')]:
+        sweeps = run(args.binary, devices, args.channels, args.sweeps, args.delay, args.options.split())
+        if len(sweeps) < 2:
+            print('%8d  no sweeps were measured' % devices)
+            continue
+        # The first sweep also asks for the channels, so it isn't typical
+        steady = sweeps[1:]
+        cpu = sum(s[0] for s in steady) / len(steady)
+        rss = steady[-1][1]
+        if baseline is None:
+            baseline = rss
+        per_device = float(rss - baseline) / (devices - 1) if devices > 1 else 0
+        print('%8d %14.2f %18.1f %10d %16.2f' % (devices, cpu, cpu * 1000 / devices, rss, per_device))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "anomaly.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+/* The channels that are checked: the string values, where a string fault shows, and the AC power */
+static const int checked_channels[ANOMALY_CHANNELS] = {
+    CHANNEL_PDC1, CHANNEL_PDC2, CHANNEL_VDC1, CHANNEL_VDC2, CHANNEL_IDC1, CHANNEL_IDC2, CHANNEL_PAC
+};
+
+/* Median of the values in 'values'. The order of 'values' is changed */
+static double median(vector <double> &values)
+{
+    size_t middle = values.size() / 2;
+    nth_element(values.begin(), values.begin() + middle, values.end());
+    double upper = values[middle];
+    if (values.size() % 2 == 1) return upper;
+
+    double lower = *max_element(values.begin(), values.begin() + middle);
+    return (lower + upper) / 2.0;
+}
+
+/* Format a number for the event log */
+static string format_score(double number)
+{
+    if (number != number) return "";
+    return convert_double(number);
+}
+
+/* Constructor for the anomaly_detector class */
+anomaly_detector::anomaly_detector()
+{
+}
+
+/* Check every device in a sweep. A line is added to 'events' for each anomaly that starts or ends */
+void anomaly_detector::process(fleet_table &fleet, const string &datetime, vector <string> &events)
+{
+    size_t rows = fleet.size();
+
+    for (int i = 0; i < ANOMALY_CHANNELS; i++) {
+        int channel = checked_channels[i];
+        const double *column = fleet.column(channel);
+
+        /* The fleet median, and the spread (median absolute deviation, scaled to a standard deviation) */
+        this->scratch.clear();
+        for (size_t row = 0; row < rows; row++) {
+            if (column[row] == column[row]) this->scratch.push_back(column[row]);
+        }
+        if (this->scratch.size() < ANOMALY_MIN_PEERS) continue;
+
+        double fleet_median = median(this->scratch);
+        /* Nothing to compare at night */
+        if (fleet_median <= 0) continue;
+
+        for (size_t j = 0; j < this->scratch.size(); j++) {
+            this->scratch[j] = fabs(this->scratch[j] - fleet_median);
+        }
+        double spread = 1.4826 * median(this->scratch);
+        spread = max(spread, ANOMALY_MIN_SPREAD * fleet_median);
+
+        for (size_t row = 0; row < rows; row++) {
+            double value = column[row];
+            if (value != value) continue;
+
+            anomaly_baseline &baseline = this->devices[fleet.device(row)].channels[i];
+            double fleet_score = (value - fleet_median) / spread;
+            double ratio = value / fleet_median;
+            double own_score = NAN;
+            bool anomalous = false;
+
+            if (baseline.samples >= ANOMALY_WARMUP) {
+                /* The baseline spread is floored in the same way as the fleet spread */
+                double own_spread = max(sqrt(baseline.variance), ANOMALY_MIN_SPREAD * baseline.mean);
+                own_score = (own_spread > 0) ? (ratio - baseline.mean) / own_spread : NAN;
+                anomalous = (fabs(fleet_score) > ANOMALY_THRESHOLD) and (fabs(own_score) > ANOMALY_THRESHOLD);
+            }
+
+            if (anomalous != baseline.active) {
+                baseline.active = anomalous;
+                events.push_back(datetime + "," + fleet.device(row) + "," + canonical_keys[channel] + "," +
+                                 (anomalous ? "start" : "end") + "," + convert_double(value) + "," + convert_double(fleet_median) + "," +
+                                 format_score(fleet_score) + "," + format_score(own_score));
+            }
+
+            /* The baseline is frozen during an anomaly, so a lasting fault doesn't become normal */
+            if (anomalous) continue;
+            if (baseline.samples == 0) {
+                baseline.mean = ratio;
+                baseline.variance = 0;
+            }
+            else {
+                double difference = ratio - baseline.mean;
+                baseline.mean += ANOMALY_EWMA_ALPHA * difference;
+                baseline.variance = (1 - ANOMALY_EWMA_ALPHA) * (baseline.variance + ANOMALY_EWMA_ALPHA * difference * difference);
+            }
+            baseline.samples++;
+        }
+    }
+}
+
+/* The header of the anomaly event log */
+string anomaly_detector::header()
+{
+    return "#Datetime,device,channel,event,value,fleet median,fleet score,own score";
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef ANOMALY_HPP_INCLUDED
+#define ANOMALY_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include "channels.hpp"
+#include "fleet.hpp"
+
+/* Name of the directory (in the logging directory) for the anomaly events */
+#define ANOMALY_DIRECTORY "anomaly"
+/* Fewest devices with a value for the fleet median to mean anything */
+#define ANOMALY_MIN_PEERS 3
+/* Score (in robust standard deviations) beyond which a value is anomalous */
+#define ANOMALY_THRESHOLD 4.0
+/* The fleet spread is never taken as less than this fraction of the median, so identical readings don't give huge scores */
+#define ANOMALY_MIN_SPREAD 0.02
+/* Weight of each new sample in the EWMA baseline */
+#define ANOMALY_EWMA_ALPHA 0.05
+/* Samples needed before the baseline of a device is trusted */
+#define ANOMALY_WARMUP 20
+/* The channels that are checked */
+#define ANOMALY_CHANNELS 7
+
+using namespace std;
+
+/* Baseline of one channel of one device. It tracks the ratio of the device's value to the fleet median */
+struct anomaly_baseline {
+    long samples;
+    double mean;
+    double variance;
+    bool active; /* an anomaly has started and not yet ended */
+};
+
+/* Baselines of all the checked channels of one device */
+struct anomaly_device {
+    anomaly_baseline channels[ANOMALY_CHANNELS];
+};
+
+/* This class compares each device, every sweep, against the median of the fleet and against its own
+   history. For each checked channel, the fleet median and the median absolute deviation are found
+   (in O(devices) using nth_element). A device is anomalous when its value is far from the fleet
+   median AND its ratio to the median is far from its own EWMA baseline. The second test stops a device
+   that always differs a little from the others (eg; a different roof) from being flagged forever.
+   The baseline is frozen during an anomaly. Events are made when an anomaly starts and ends */
+class anomaly_detector
+{
+    public:
+        anomaly_detector();
+        void process(fleet_table &fleet, const string &datetime, vector <string> &events);
+        static string header();
+
+    private:
+        map <string, anomaly_device> devices;
+        vector <double> scratch;
+};
+
+#endif /* ANOMALY_HPP_INCLUDED */
@@ -15,6 +15,10 @@
 
 #include "arguments.hpp"
 #include "utils.hpp"
+#include "logger.hpp"
+#include "realtime.hpp"
+#include <sstream>
+#include <stdlib.h>
 
 using namespace std;
 
@@ -25,12 +29,36 @@ arguments::arguments()
     this->debug = DEFAULT_DEBUG_VALUE;
     this->log_directory = DEFAULT_LOG_DIRECTORY;
     this->discovery = false;
+    this->backoff = false;
+    this->fleet_metrics = false;
+    this->rollups = false;
+    this->anomalies = false;
+    this->replay_directory = "";
+    this->replay_speed = 0;
+    this->capture_file = "";
+    this->play_file = "";
+    this->ndjson_target = "";
+    this->upload_url = "";
+    this->upload_rate = 0;
+    this->realtime_priority = -1;
+    this->bus_cpus = "";
+    this->profile = false;
+    this->site_log = false;
+    this->typed_schema = false;
+    this->endpoints = 0;
+    this->catalog_file = "";
+    this->audit_interval = 0;
+    this->memory_budget = 0;
+    this->stall_seconds = 0;
     this->conf_filepath = DEFAULT_CONF_DIRECTORY;
     this->number = 0;
+    this->query_socket = "";
+    this->settings_file = "";
+    this->journal_interval = -1;
     initialise_conversions();
 
     /* Usage string */
-    this->usage_string = "Usage: ardexa-sma -c conf file path -n number of devices [-l log directory] [-d] [-v] [-i] [-s number of seconds between readings]\n";
+    this->usage_string = "Usage: ardexa-sma -c conf file path -n number of devices [-l log directory] [-d] [-v] [-i] [-b] [-m] [-a] [-e] [-s number of seconds between readings] [-q query socket path] [-f settings file] [-j journal commit milliseconds] [-r replay directory] [-x replay speed] [-t capture trace file | -p play trace file] [-o NDJSON output] [-u upload URL] [-w upload backlog bytes per second] [-k bus thread priority] [-g bus thread CPUs] [-y] [-z buses polled at once] [-C channel catalog file] [-P hours between parameter audits] [-M memory budget MB] [-W stall seconds] [-L] [-T]\n";
 }
 
 /* This method is to initialize the member variables based on the command line arguments */
@@ -40,6 +68,14 @@ int arguments::initialize(int argc, char * argv[])
     bool ret_error = false;
     string delay_raw = to_string(DELAY);
     string number_raw = "0";
+    string journal_raw = "";
+    string speed_raw = "";
+    string rate_raw = "";
+    string priority_raw = "";
+    string endpoints_raw = "";
+    string audit_raw = "";
+    string budget_raw = "";
+    string stall_raw = "";
 
     /*
      * -l (optional) <directory> name for the location of the directory in which the logs will be written
@@ -48,9 +84,33 @@ int arguments::initialize(int argc, char * argv[])
      * -i (optional) discovery. Print (and if debug is on, send to the console) a listing of all available objects and variables
      * -v (optional) prints the version and exits
      * -s (optional) delay between readings. Default is 60 seconds. Ignored during discovery
-     * -n (mandatory) number of devices to find. Must be at least 1, and less than 40
+     * -n (mandatory) number of devices to find. Must be at least 1
+     * -q (optional) <file path> of a Unix domain socket on which to answer value queries
+     * -b (optional) back off polling of devices that are asleep (eg; at night) or offline
+     * -f (optional) <file path> of a settings file. Its values override the command line, and it is reloaded on SIGHUP or when it changes
+     * -j (optional) journal every row before it is logged, and sync the journal every this many milliseconds. 0 means once per set of readings
+     * -m (optional) log derived metrics (efficiency, phase imbalance, totals) for every device and the whole fleet
+     * -a (optional) log 5 minute, hourly and daily rollups of every device
+     * -e (optional) log events when a device's string values diverge from the rest of the fleet
+     * -r (optional) <directory> replay the device logs in this logging directory instead of reading the bus. -c and -n are not needed
+     * -x (optional) replay this many times faster than real time. Default (0) is as fast as possible
+     * -t (optional) <file path> write every call to the SMA library to this trace file
+     * -o (optional) <target> also write each reading as an NDJSON line to this target: "-" for stdout, or the path of a FIFO, Unix domain socket or file
+     * -p (optional) <file path> answer every call to the SMA library from this trace file, instead of the inverters. -c is not needed
+     * -u (optional) <URL> spool each reading on disk and forward it to this HTTP endpoint (http://host[:port]/path)
+     * -w (optional) forward a backlog at no more than this many bytes per second. Default is 65536
+     * -k (optional) make every call to the SMA library on a bus thread, under SCHED_FIFO at this priority (1 to 99) with memory locked. 0 is normal scheduling, to measure a baseline
+     * -g (optional) <CPU list> pin the bus thread to these CPUs (eg; 1 or 2-3)
+     * -y (optional) log a profile of the bus (frames, bytes, retries, wire time and utilisation) for every device and sweep
+     * -z (optional) poll the buses (serial ports and IP gateways) separately, up to this many at once, and log each bus's reads and failures
+     * -P (optional) audit the parameter channels of every device this often (in hours), between sweeps, and log a snapshot when they change
+     * -M (optional) keep the memory within this many MB: give freed memory back after every sweep, and log the memory in use hourly
+     * -W (optional) exit if a library call stalls for this many seconds, and recover the bus drivers if no device answers for a few sweeps
+     * -L (optional) log every sweep of the whole site to one file a day, with a single append, instead of a file for each device
+     * -T (optional) log each device with a fixed, versioned schema, and a typed null for each value that couldn't be read
+     * -C (optional) <file path> of a JSON channel catalog. Discovery (-i) writes it, carrying on from the devices already in it. Polling reads the channels from it
      */
-    while ((opt = getopt(argc, argv, "l:c:s:n:div")) != -1) {
+    while ((opt = getopt(argc, argv, "l:c:s:n:q:f:j:r:x:t:p:o:u:w:k:g:z:C:P:M:W:divbmaeyLT")) != -1) {
         switch (opt) {
             case 'c':
                 /* verify the existence of the configuration file done below */
@@ -68,12 +128,93 @@ int arguments::initialize(int argc, char * argv[])
                 /* verify the number of devices later below */
                 number_raw = optarg;
                 break;
+            case 'q':
+                this->query_socket = optarg;
+                break;
+            case 'j':
+                /* verify the journal interval later below */
+                journal_raw = optarg;
+                break;
+            case 'r':
+                this->replay_directory = optarg;
+                break;
+            case 'x':
+                /* verify the replay speed later below */
+                speed_raw = optarg;
+                break;
+            case 't':
+                this->capture_file = optarg;
+                break;
+            case 'p':
+                this->play_file = optarg;
+                break;
+            case 'o':
+                this->ndjson_target = optarg;
+                break;
+            case 'u':
+                this->upload_url = optarg;
+                break;
+            case 'w':
+                /* verify the upload rate later below */
+                rate_raw = optarg;
+                break;
+            case 'k':
+                /* verify the priority later below */
+                priority_raw = optarg;
+                break;
+            case 'g':
+                this->bus_cpus = optarg;
+                break;
+            case 'y':
+                this->profile = true;
+                break;
+            case 'z':
+                /* verify the number of buses later below */
+                endpoints_raw = optarg;
+                break;
+            case 'P':
+                /* verify the audit interval later below */
+                audit_raw = optarg;
+                break;
+            case 'M':
+                /* verify the memory budget later below */
+                budget_raw = optarg;
+                break;
+            case 'T':
+                this->typed_schema = true;
+                break;
+            case 'L':
+                this->site_log = true;
+                break;
+            case 'W':
+                /* verify the stall time later below */
+                stall_raw = optarg;
+                break;
+            case 'C':
+                this->catalog_file = optarg;
+                break;
+            case 'f':
+                /* the settings file is read below, after the command line */
+                this->settings_file = optarg;
+                break;
             case 'd':
                 this->debug = true;
                 break;
             case 'i':
                 this->discovery = true;
                 break;
+            case 'b':
+                this->backoff = true;
+                break;
+            case 'm':
+                this->fleet_metrics = true;
+                break;
+            case 'a':
+                this->rollups = true;
+                break;
+            case 'e':
+                this->anomalies = true;
+                break;
             case 'v':
                 cout << "Ardexa RS485 SMA Version: " << VERSION << endl;
                 exit(0);
@@ -93,8 +234,9 @@ int arguments::initialize(int argc, char * argv[])
         ret_error = true;
     }
 
-    if ((this->number <1) or (this->number >= 40)) {
-        cout << "Number of devices must be a number, and be greater than 0 and less than 40 " << endl;
+    /* A replay reads no devices */
+    if ((this->number < 1) and (this->replay_directory.empty())) {
+        cout << "Number of devices must be a number, and be greater than 0 " << endl;
         ret_error = true;
     }
 
@@ -112,7 +254,133 @@ int arguments::initialize(int argc, char * argv[])
     }
 
 
+    /* Convert "journal_raw" to INT */
+    if (not journal_raw.empty()) {
+        long journal_long = -1;
+        if ((not convert_long(journal_raw, &journal_long)) or (journal_long < 0)) {
+            cout << "Journal commit interval must be a number of milliseconds, 0 or more " << endl;
+            ret_error = true;
+        }
+        this->journal_interval = journal_long;
+    }
+
+    /* Convert "speed_raw" to DOUBLE */
+    if (not speed_raw.empty()) {
+        char *end = NULL;
+        this->replay_speed = strtod(speed_raw.c_str(), &end);
+        if ((*end != '\0') or (this->replay_speed < 0)) {
+            cout << "Replay speed must be a number, 0 or more " << endl;
+            ret_error = true;
+        }
+    }
+
+    /* Convert "rate_raw" to LONG */
+    if (not rate_raw.empty()) {
+        if ((not convert_long(rate_raw, &this->upload_rate)) or (this->upload_rate < 1)) {
+            cout << "Upload rate must be a number of bytes per second, 1 or more " << endl;
+            ret_error = true;
+        }
+    }
+
+    /* Convert "priority_raw" to INT */
+    if (not priority_raw.empty()) {
+        long priority_long = -1;
+        if ((not convert_long(priority_raw, &priority_long)) or (priority_long < 0) or (priority_long > 99)) {
+            cout << "Bus thread priority must be from 0 to 99 " << endl;
+            ret_error = true;
+        }
+        this->realtime_priority = priority_long;
+    }
+
+    /* Pinning the bus thread implies a bus thread */
+    if (not this->bus_cpus.empty()) {
+        cpu_set_t set;
+        if (not parse_cpu_list(this->bus_cpus, &set)) {
+            cout << "Bus thread CPUs must be a list such as 1 or 0,2-3 " << endl;
+            ret_error = true;
+        }
+        if (this->realtime_priority < 0) this->realtime_priority = 0;
+    }
+
+    /* Convert "endpoints_raw" to INT */
+    if (not endpoints_raw.empty()) {
+        long endpoints_long = 0;
+        if ((not convert_long(endpoints_raw, &endpoints_long)) or (endpoints_long < 1) or (endpoints_long > 64)) {
+            cout << "Buses polled at once must be from 1 to 64 " << endl;
+            ret_error = true;
+        }
+        this->endpoints = endpoints_long;
+    }
+
+    /* Convert "audit_raw" to seconds */
+    if (not audit_raw.empty()) {
+        long hours = 0;
+        if ((not convert_long(audit_raw, &hours)) or (hours < 1) or (hours > 720)) {
+            cout << "Hours between parameter audits must be from 1 to 720 " << endl;
+            ret_error = true;
+        }
+        this->audit_interval = hours * 3600;
+    }
+
+    /* Convert "budget_raw" to kB */
+    if (not budget_raw.empty()) {
+        long megabytes = 0;
+        if ((not convert_long(budget_raw, &megabytes)) or (megabytes < 1) or (megabytes > 4096)) {
+            cout << "Memory budget must be from 1 to 4096 MB " << endl;
+            ret_error = true;
+        }
+        this->memory_budget = megabytes * 1024;
+    }
+
+    /* Convert "stall_raw" to INT */
+    if (not stall_raw.empty()) {
+        long stall_long = 0;
+        if ((not convert_long(stall_raw, &stall_long)) or (stall_long < 30) or (stall_long > 86400)) {
+            cout << "Stall seconds must be from 30 to 86400 " << endl;
+            ret_error = true;
+        }
+        this->stall_seconds = stall_long;
+    }
+
+    /* The bus thread makes one call at a time, so it can't poll several buses at once */
+    if ((this->endpoints > 1) and (this->realtime_priority >= 0)) {
+        cout << "A bus thread (-k or -g) can't be used to poll more than one bus at once (-z) " << endl;
+        ret_error = true;
+    }
+
+    /* Polling needs a catalog that discovery has written */
+    if ((not this->catalog_file.empty()) and (not this->discovery) and (this->replay_directory.empty()) and (not check_file(this->catalog_file))) {
+        cout << "Catalog file does not exist. Write it with discovery (-i) first: " << this->catalog_file << endl;
+        ret_error = true;
+    }
+
+    if ((not this->upload_url.empty()) and (this->upload_url.compare(0, 7, "http://") != 0)) {
+        cout << "Upload URL must start with http:// " << endl;
+        ret_error = true;
+    }
+
+    /* The replayed logs must not be written to */
+    if ((not this->replay_directory.empty()) and (not check_directory(this->replay_directory))) {
+        cout << "Replay directory does not exist: " << this->replay_directory << endl;
+        ret_error = true;
+    }
+    if ((not this->replay_directory.empty()) and (same_directory(this->replay_directory, this->log_directory))) {
+        cout << "The replay directory and the logging directory must be different " << endl;
+        ret_error = true;
+    }
+
+    if ((not this->capture_file.empty()) and (not this->play_file.empty())) {
+        cout << "A trace can be captured or played, not both " << endl;
+        ret_error = true;
+    }
+
+    /* The settings file overrides the command line */
+    if ((not this->settings_file.empty()) and (not this->load_settings())) {
+        ret_error = true;
+    }
+
     g_debug = this->debug;
+    g_logger.set_level(this->debug ? LOG_LEVEL_DEBUG : LOG_LEVEL_INFO);
 
     if (not create_directory(this->log_directory)) {
         cout << "Could not create the logging directory: " << this->log_directory << endl;
@@ -120,7 +388,7 @@ int arguments::initialize(int argc, char * argv[])
     }
 
     /* check existance of SMA config file */
-    if (check_file(this->conf_filepath) == false) {
+    if ((check_file(this->conf_filepath) == false) and (this->replay_directory.empty()) and (this->play_file.empty())) {
         cout << "Config file does not exist" << endl;
         ret_error = true;
     }
@@ -159,6 +427,132 @@ bool arguments::get_discovery()
     return this->discovery;
 }
 
+/* Get the backoff bool value */
+bool arguments::get_backoff()
+{
+    return this->backoff;
+}
+
+/* Get the fleet metrics bool value */
+bool arguments::get_fleet_metrics()
+{
+    return this->fleet_metrics;
+}
+
+/* Get the rollups bool value */
+bool arguments::get_rollups()
+{
+    return this->rollups;
+}
+
+/* Get the anomalies bool value */
+bool arguments::get_anomalies()
+{
+    return this->anomalies;
+}
+
+/* Get the directory to replay. Empty if the bus is read */
+string arguments::get_replay_directory()
+{
+    return this->replay_directory;
+}
+
+/* Get the replay speed, as a multiple of real time. 0 is as fast as possible */
+double arguments::get_replay_speed()
+{
+    return this->replay_speed;
+}
+
+/* Get the trace file to capture to. Empty if not capturing */
+string arguments::get_capture_file()
+{
+    return this->capture_file;
+}
+
+/* Get the trace file to play. Empty if the inverters are used */
+string arguments::get_play_file()
+{
+    return this->play_file;
+}
+
+/* Get where the NDJSON records go. Empty if there is no NDJSON output */
+string arguments::get_ndjson_target()
+{
+    return this->ndjson_target;
+}
+
+/* Get the HTTP endpoint that readings are forwarded to. Empty if there is no forwarding */
+string arguments::get_upload_url()
+{
+    return this->upload_url;
+}
+
+/* Get the most bytes per second at which a backlog is forwarded. 0 for the default */
+long arguments::get_upload_rate()
+{
+    return this->upload_rate;
+}
+
+/* Get the priority of the bus thread: 1 to 99 for SCHED_FIFO, 0 for normal scheduling, or -1 if there is no bus thread */
+int arguments::get_realtime_priority()
+{
+    return this->realtime_priority;
+}
+
+/* Get the CPUs that the bus thread is pinned to. Empty if it isn't pinned */
+string arguments::get_bus_cpus()
+{
+    return this->bus_cpus;
+}
+
+/* Get the number of buses polled at once, or 0 if the devices are polled in turn without regard to their bus */
+int arguments::get_endpoints()
+{
+    return this->endpoints;
+}
+
+/* Get the channel catalog file, or empty if there is none */
+string arguments::get_catalog_file()
+{
+    return this->catalog_file;
+}
+
+/* Get the seconds between parameter audits, or 0 if there are none */
+int arguments::get_audit_interval()
+{
+    return this->audit_interval;
+}
+
+/* Get the memory budget in kB, or 0 if there is none */
+long arguments::get_memory_budget()
+{
+    return this->memory_budget;
+}
+
+/* Get the seconds without progress that are a stall, or 0 if there is no watchdog */
+int arguments::get_stall_seconds()
+{
+    return this->stall_seconds;
+}
+
+/* Get whether the whole site is logged to one file, rather than a file for each device */
+bool arguments::get_site_log()
+{
+    return this->site_log;
+}
+
+/* Get whether each device is logged with a fixed schema */
+bool arguments::get_typed_schema()
+{
+    return this->typed_schema;
+}
+
+/* Get whether the bus is profiled */
+bool arguments::get_profile()
+{
+    return this->profile;
+}
+
 /* Get the config file */
 string arguments::get_config_file()
 {
@@ -177,6 +571,134 @@ int arguments::get_number()
     return this->number;
 }
 
+/* Get the query socket path */
+string arguments::get_query_socket()
+{
+    return this->query_socket;
+}
+
+/* Get the settings file path */
+string arguments::get_settings_file()
+{
+    return this->settings_file;
+}
+
+/* Get the journal commit interval in milliseconds. -1 if there is no journal */
+int arguments::get_journal_interval()
+{
+    return this->journal_interval;
+}
+
+/* Check if a channel (by its raw SMA name) should be read */
+bool arguments::channel_selected(string channel)
+{
+    return (this->channels.empty()) or (this->channels.find(channel) != this->channels.end());
+}
+
+/* Read the settings file. This is a simple INI file, for example:
+
+       delay = 300
+       log_directory = /opt/ardexa/sma/logs
+       debug = 0
+       backoff = 1
+       fleet_metrics = 1
+       rollups = 1
+       anomalies = 1
+       number = 13
+       channels = Pac,E-Total,Mode,Fehler
+
+       [conversions]
+       Warten = waiting
+
+   Settings that are not in the file keep their current value. Conversions are added to the
+   defaults in 'initialise_conversions'. If there is any error in the file, nothing is changed
+   and false is returned */
+bool arguments::load_settings()
+{
+    arguments loaded = *this;
+    string section = "";
+    string raw_line;
+    int line_number = 0;
+
+    ifstream reader(this->settings_file.c_str());
+    if (!reader) {
+        cout << "Cannot open the settings file: " << this->settings_file << endl;
+        return false;
+    }
+
+    loaded.convert.clear();
+    loaded.initialise_conversions();
+
+    while (getline(reader, raw_line)) {
+        line_number++;
+        string line = trim_whitespace(raw_line);
+        if ((line.empty()) or (line[0] == '#') or (line[0] == ';')) continue;
+
+        if ((line[0] == '[') and (line[line.size()-1] == ']')) {
+            section = trim_whitespace(line.substr(1, line.size()-2));
+            if ((section != "settings") and (section != "conversions")) {
+                cout << "Unknown section in settings file line " << line_number << ": " << section << endl;
+                return false;
+            }
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == string::npos) {
+            cout << "Expected 'key = value' in settings file line " << line_number << endl;
+            return false;
+        }
+        string key = trim_whitespace(line.substr(0, equals));
+        string value = trim_whitespace(line.substr(equals + 1));
+        long number_value = 0;
+
+        if (section == "conversions") {
+            loaded.convert[key] = value;
+        }
+        else if (key == "log_directory") {
+            loaded.log_directory = value;
+        }
+        else if (key == "channels") {
+            loaded.channels.clear();
+            stringstream list(value);
+            string channel;
+            while (getline(list, channel, ',')) {
+                channel = trim_whitespace(channel);
+                if (not channel.empty()) loaded.channels.insert(channel);
+            }
+        }
+        else if ((key == "delay") or (key == "number") or (key == "debug") or (key == "backoff") or (key == "fleet_metrics") or (key == "rollups") or (key == "anomalies")) {
+            if (not convert_long(value, &number_value)) {
+                cout << "Settings file line " << line_number << ": " << key << " must be a number" << endl;
+                return false;
+            }
+            if (key == "delay") loaded.delay = number_value;
+            else if (key == "number") loaded.number = number_value;
+            else if (key == "debug") loaded.debug = (number_value != 0);
+            else if (key == "backoff") loaded.backoff = (number_value != 0);
+            else if (key == "fleet_metrics") loaded.fleet_metrics = (number_value != 0);
+            else if (key == "rollups") loaded.rollups = (number_value != 0);
+            else loaded.anomalies = (number_value != 0);
+        }
+        else {
+            cout << "Unknown setting in settings file line " << line_number << ": " << key << endl;
+            return false;
+        }
+    }
+
+    if (loaded.number < 1) {
+        cout << "Number of devices must be a number, and be greater than 0 " << endl;
+        return false;
+    }
+    if (loaded.delay < 5) {
+        cout << "Delay must be a number, and be greater than 5 seconds " << endl;
+        return false;
+    }
+
+    *this = loaded;
+    return true;
+}
+
 /* This map converts only *SOME* of the SMA texts. Also, it will convert
    EXACTLY as it sees, and is case sensitive. This is deliberate */
 void arguments::initialise_conversions()
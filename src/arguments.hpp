@@ -20,6 +20,7 @@
 #include "arguments.hpp"
 #include <iostream>
 #include <map>
+#include <set>
 #include <unistd.h>
 
 using namespace std;
@@ -42,10 +43,36 @@ class arguments
         void usage();
         bool get_debug();
         bool get_discovery();
+        bool get_backoff();
+        bool get_fleet_metrics();
+        bool get_rollups();
+        bool get_anomalies();
+        string get_replay_directory();
+        double get_replay_speed();
+        string get_capture_file();
+        string get_play_file();
+        string get_ndjson_target();
+        string get_upload_url();
+        long get_upload_rate();
+        int get_realtime_priority();
+        string get_bus_cpus();
+        bool get_profile();
+        bool get_site_log();
+        bool get_typed_schema();
+        int get_endpoints();
+        string get_catalog_file();
+        int get_audit_interval();
+        long get_memory_budget();
+        int get_stall_seconds();
         string get_config_file();
         string get_log_directory();
         int get_delay();
         int get_number();
+        string get_query_socket();
+        string get_settings_file();
+        int get_journal_interval();
+        bool channel_selected(string channel);
+        bool load_settings();
         void initialise_conversions();
         map <string, string> convert;
 
@@ -55,9 +82,34 @@ class arguments
         string conf_filepath;
         string log_directory;
         bool discovery; /* this is to simple list the available devices and exit */
+        bool backoff; /* back off polling of devices that are asleep or offline */
+        bool fleet_metrics; /* log the derived metrics of the whole fleet */
+        bool rollups; /* log 5 minute, hourly and daily rollups */
+        bool anomalies; /* log events when a device diverges from the fleet */
+        string replay_directory; /* empty unless replaying logs */
+        double replay_speed; /* multiple of real time, or 0 for as fast as possible */
+        string capture_file; /* empty unless the library calls are traced */
+        string play_file; /* empty unless the library calls are answered from a trace */
+        string ndjson_target; /* "-" for stdout, a path, or empty if there is no NDJSON output */
+        string upload_url; /* empty unless readings are forwarded to an HTTP endpoint */
+        long upload_rate; /* bytes per second for a backlog, or 0 for the default */
+        int realtime_priority; /* SCHED_FIFO priority of the bus thread, 0 for normal scheduling, or -1 if there is no bus thread */
+        string bus_cpus; /* CPUs the bus thread is pinned to, or empty */
+        bool profile; /* log a profile of the bus utilisation */
+        bool site_log; /* log the whole site to one file, rather than a file for each device */
+        bool typed_schema; /* log each device with a fixed schema and typed nulls */
+        int endpoints; /* buses polled at once, or 0 if the buses aren't told apart */
+        string catalog_file; /* empty unless a channel catalog is written (discovery) or read (polling) */
+        int audit_interval; /* seconds between audits of the parameter channels, or 0 if there are none */
+        long memory_budget; /* kB, or 0 if the memory isn't kept down */
+        int stall_seconds; /* seconds without progress that are a stall, or 0 if there is no watchdog */
         string usage_string;
         int delay;
         int number;
+        string query_socket; /* empty if the query socket is not used */
+        string settings_file; /* empty if there is no settings file */
+        int journal_interval; /* milliseconds between journal commits, 0 for once per sweep, or -1 if there is no journal */
+        set <string> channels; /* raw names of the channels to read. If empty, read them all */
 
 };
 
@@ -0,0 +1,765 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <functional>
+#include "bus.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* The library's own lookups from a device to its network address, and from that to the driver (and the peer on
+   that driver) that the device answered through. They are exported, but aren't in the public headers */
+extern "C" {
+void *TObjManager_GetRef(DWORD handle);
+WORD TNetDevice_GetNetAddr(void *device);
+BOOL TRoute_FindRoute(WORD address, DWORD *driver, DWORD *peer);
+}
+
+yasdi_bus g_bus;
+
+/* Make a record for a call that has just been made */
+static trace_record new_record(uint8_t call, uint32_t arg0, uint32_t arg1, int32_t result)
+{
+    trace_record entry;
+    entry.call = call;
+    entry.flags = 0;
+    entry.args[0] = arg0;
+    entry.args[1] = arg1;
+    entry.result = result;
+    entry.offset_ms = 0;
+    entry.duration_us = 0;
+    entry.number = 0;
+    return entry;
+}
+
+/* Copy a text into a caller's buffer, always terminated */
+static void copy_text(const string &text, char *buffer, size_t size)
+{
+    if (size == 0) return;
+    size_t length = (text.size() < size - 1) ? text.size() : size - 1;
+    memcpy(buffer, text.data(), length);
+    buffer[length] = '\0';
+}
+
+/* The text that the library put in a buffer. It might not be terminated if the call failed */
+static string buffer_text(const char *buffer, size_t size)
+{
+    return string(buffer, strnlen(buffer, size));
+}
+
+/* Constructor for the yasdi_bus class */
+yasdi_bus::yasdi_bus()
+{
+    this->mode = BUS_LIVE;
+    this->io_thread = NULL;
+    this->trace = NULL;
+    this->next = 0;
+    this->last_reading = 0;
+}
+
+yasdi_bus::~yasdi_bus()
+{
+    close();
+}
+
+/* Call the library, and write every call to a trace file */
+bool yasdi_bus::capture(const string &path)
+{
+    this->trace = fopen(path.c_str(), "wb");
+    if (!this->trace) {
+        LOG_ERROR("Could not open the trace file: " << path);
+        return false;
+    }
+
+    uint32_t version = TRACE_VERSION;
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), this->trace);
+    fwrite(&version, sizeof(version), 1, this->trace);
+    this->started = chrono::steady_clock::now();
+    this->mode = BUS_CAPTURE;
+    return true;
+}
+
+/* Answer every call from a trace file, instead of calling the library */
+bool yasdi_bus::play(const string &path)
+{
+    FILE *reader = fopen(path.c_str(), "rb");
+    if (!reader) {
+        LOG_ERROR("Could not open the trace file: " << path);
+        return false;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)] = "";
+    uint32_t version = 0;
+    if ((fread(magic, 1, strlen(TRACE_MAGIC), reader) != strlen(TRACE_MAGIC)) or (strcmp(magic, TRACE_MAGIC) != 0) or
+        (fread(&version, sizeof(version), 1, reader) != 1) or (version != TRACE_VERSION)) {
+        LOG_ERROR("Not a trace file (or the wrong version): " << path);
+        fclose(reader);
+        return false;
+    }
+
+    this->trace = reader;
+    this->records.clear();
+    trace_record entry;
+    while (read_record(entry)) {
+        this->records.push_back(entry);
+    }
+    fclose(this->trace);
+    this->trace = NULL;
+
+    LOG_DEBUG("Loaded " << this->records.size() << " calls from the trace file: " << path);
+    this->used.assign(this->records.size(), false);
+    this->last_reading = this->records.size();
+    for (size_t i = 0; i < this->records.size(); i++) {
+        if (this->records[i].call == CALL_CHANNEL_VALUE) this->last_reading = i;
+    }
+    this->next = 0;
+    this->mode = BUS_PLAY;
+    return true;
+}
+
+/* Finish the trace file */
+void yasdi_bus::close()
+{
+    if (this->trace) {
+        fclose(this->trace);
+        this->trace = NULL;
+    }
+}
+
+/* BUS_LIVE, BUS_CAPTURE or BUS_PLAY */
+int yasdi_bus::get_mode()
+{
+    return this->mode;
+}
+
+/* Check if the last reading in the trace has been answered, when playing. What comes after it is the
+   shutdown, and calls that were passed over (eg; ones that are no longer made) don't hold the playback up */
+bool yasdi_bus::played_out()
+{
+    lock_guard<mutex> lock(this->trace_mutex);
+    return (this->last_reading >= this->records.size()) or (this->used[this->last_reading]);
+}
+
+/* Make the calls on a bus thread from now on, or on the caller's thread if NULL */
+void yasdi_bus::use_thread(bus_thread *io_thread)
+{
+    this->io_thread = io_thread;
+}
+
+/* If there is a bus thread and this isn't it, make 'call' on the bus thread and return true. 'call' makes
+   the same call again, which then goes ahead on the bus thread */
+template <class F> bool yasdi_bus::hand_over(F call)
+{
+    if ((!this->io_thread) or (this->io_thread->is_current())) return false;
+    return this->io_thread->run(function<void()>(call));
+}
+
+/* The time that a call to the library starts. It is kept by the caller, since calls can be made from several threads */
+chrono::steady_clock::time_point yasdi_bus::begin_call()
+{
+    return chrono::steady_clock::now();
+}
+
+/* Write a call to the trace file. It is flushed straight away, since a trace is most wanted when something goes wrong */
+void yasdi_bus::record(trace_record &entry, chrono::steady_clock::time_point call_started)
+{
+    if (!this->trace) return;
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    entry.offset_ms = chrono::duration_cast<chrono::milliseconds>(call_started - this->started).count();
+    entry.duration_us = chrono::duration_cast<chrono::microseconds>(now - call_started).count();
+
+    lock_guard<mutex> lock(this->trace_mutex);
+
+    fwrite(&entry.call, sizeof(entry.call), 1, this->trace);
+    fwrite(&entry.flags, sizeof(entry.flags), 1, this->trace);
+    fwrite(entry.args, sizeof(entry.args[0]), 2, this->trace);
+    fwrite(&entry.result, sizeof(entry.result), 1, this->trace);
+    fwrite(&entry.offset_ms, sizeof(entry.offset_ms), 1, this->trace);
+    fwrite(&entry.duration_us, sizeof(entry.duration_us), 1, this->trace);
+    if (entry.flags & TRACE_HAS_NUMBER) {
+        fwrite(&entry.number, sizeof(entry.number), 1, this->trace);
+    }
+    if (entry.flags & TRACE_HAS_TEXT) {
+        uint16_t length = (entry.text.size() > 0xffff) ? 0xffff : entry.text.size();
+        fwrite(&length, sizeof(length), 1, this->trace);
+        fwrite(entry.text.data(), 1, length, this->trace);
+    }
+    if (entry.flags & TRACE_HAS_HANDLES) {
+        uint32_t count = entry.handles.size();
+        fwrite(&count, sizeof(count), 1, this->trace);
+        if (count > 0) fwrite(&entry.handles[0], sizeof(uint32_t), count, this->trace);
+    }
+    fflush(this->trace);
+}
+
+/* Read one record from the trace file. Returns false at the end (or at a record cut short by a crash) */
+bool yasdi_bus::read_record(trace_record &entry)
+{
+    FILE *reader = this->trace;
+    entry = new_record(0, 0, 0, 0);
+
+    if ((fread(&entry.call, sizeof(entry.call), 1, reader) != 1) or (fread(&entry.flags, sizeof(entry.flags), 1, reader) != 1) or
+        (fread(entry.args, sizeof(entry.args[0]), 2, reader) != 2) or (fread(&entry.result, sizeof(entry.result), 1, reader) != 1) or
+        (fread(&entry.offset_ms, sizeof(entry.offset_ms), 1, reader) != 1) or (fread(&entry.duration_us, sizeof(entry.duration_us), 1, reader) != 1)) {
+        return false;
+    }
+    if ((entry.flags & TRACE_HAS_NUMBER) and (fread(&entry.number, sizeof(entry.number), 1, reader) != 1)) {
+        return false;
+    }
+    if (entry.flags & TRACE_HAS_TEXT) {
+        uint16_t length = 0;
+        if (fread(&length, sizeof(length), 1, reader) != 1) return false;
+        entry.text.resize(length);
+        if ((length > 0) and (fread(&entry.text[0], 1, length, reader) != length)) return false;
+    }
+    if (entry.flags & TRACE_HAS_HANDLES) {
+        uint32_t count = 0;
+        if (fread(&count, sizeof(count), 1, reader) != 1) return false;
+        entry.handles.resize(count);
+        if ((count > 0) and (fread(&entry.handles[0], sizeof(uint32_t), count, reader) != count)) return false;
+    }
+    return true;
+}
+
+/* Find the record that answers a call when playing, and wait as long as the call took when it was captured.
+   Calls from several threads (see endpoints.hpp) are interleaved in the trace, so a record that is passed over
+   is left for another thread, rather than skipped for good. Returns NULL if the trace has no such call left */
+const trace_record *yasdi_bus::next_record(uint8_t call, uint32_t arg0, uint32_t arg1, const char *text)
+{
+    const trace_record *found = NULL;
+    {
+        lock_guard<mutex> lock(this->trace_mutex);
+        for (size_t i = this->next; i < this->records.size(); i++) {
+            const trace_record &entry = this->records[i];
+            if ((this->used[i]) or (entry.call != call) or (entry.args[0] != arg0) or (entry.args[1] != arg1)) continue;
+            if ((text) and (entry.text != text)) continue;
+
+            if (i > this->next) {
+                LOG_DEBUG("The playback passed over " << (i - this->next) << " calls in the trace");
+            }
+            this->used[i] = true;
+            while ((this->next < this->records.size()) and (this->used[this->next])) this->next++;
+            found = &entry;
+            break;
+        }
+    }
+
+    if (!found) {
+        LOG_ERROR("The trace has no more calls of type " << (int) call << " with arguments " << arg0 << ", " << arg1);
+        return NULL;
+    }
+    this_thread::sleep_for(chrono::microseconds(found->duration_us));
+    return found;
+}
+
+/* yasdiMasterInitialize */
+int yasdi_bus::initialize(const char *conf_file, DWORD *drivers)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = initialize(conf_file, drivers); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_INITIALIZE, 0, 0, NULL);
+        if (!entry) return -1;
+        *drivers = entry->number;
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = yasdiMasterInitialize(conf_file, drivers);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_INITIALIZE, 0, 0, result);
+        entry.flags = TRACE_HAS_NUMBER;
+        entry.number = *drivers;
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* yasdiMasterGetDriver */
+DWORD yasdi_bus::get_drivers(DWORD *drivers, int max_drivers)
+{
+    DWORD answer = 0;
+    if (hand_over([&] { answer = get_drivers(drivers, max_drivers); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_GET_DRIVERS, max_drivers, 0, NULL);
+        if (!entry) return 0;
+        for (size_t i = 0; (i < entry->handles.size()) and ((int) i < max_drivers); i++) drivers[i] = entry->handles[i];
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    DWORD count = yasdiMasterGetDriver(drivers, max_drivers);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_GET_DRIVERS, max_drivers, 0, count);
+        entry.flags = TRACE_HAS_HANDLES;
+        entry.handles.assign(drivers, drivers + count);
+        record(entry, call_started);
+    }
+    return count;
+}
+
+/* yasdiGetDriverName */
+BOOL yasdi_bus::driver_name(DWORD driver, char *buffer, DWORD size)
+{
+    BOOL answer = 0;
+    if (hand_over([&] { answer = driver_name(driver, buffer, size); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DRIVER_NAME, driver, 0, NULL);
+        if (!entry) return FALSE;
+        copy_text(entry->text, buffer, size);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    BOOL result = yasdiGetDriverName(driver, buffer, size);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DRIVER_NAME, driver, 0, result);
+        entry.flags = TRACE_HAS_TEXT;
+        entry.text = buffer_text(buffer, size);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* yasdiSetDriverOnline */
+BOOL yasdi_bus::driver_online(DWORD driver)
+{
+    BOOL answer = 0;
+    if (hand_over([&] { answer = driver_online(driver); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DRIVER_ONLINE, driver, 0, NULL);
+        return (entry) ? entry->result : FALSE;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    BOOL result = yasdiSetDriverOnline(driver);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DRIVER_ONLINE, driver, 0, result);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* yasdiSetDriverOffline */
+void yasdi_bus::driver_offline(DWORD driver)
+{
+    if (hand_over([&] { driver_offline(driver); })) return;
+
+    if (this->mode == BUS_PLAY) {
+        next_record(CALL_DRIVER_OFFLINE, driver, 0, NULL);
+        return;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    yasdiSetDriverOffline(driver);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DRIVER_OFFLINE, driver, 0, 0);
+        record(entry, call_started);
+    }
+}
+
+/* yasdiMasterShutdown */
+void yasdi_bus::shutdown()
+{
+    if (hand_over([&] { shutdown(); })) return;
+
+    if (this->mode == BUS_PLAY) {
+        next_record(CALL_SHUTDOWN, 0, 0, NULL);
+        return;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    yasdiMasterShutdown();
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_SHUTDOWN, 0, 0, 0);
+        record(entry, call_started);
+    }
+}
+
+/* DoStartDeviceDetection */
+int yasdi_bus::detect_devices(int device_count, BOOL wait)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = detect_devices(device_count, wait); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DETECT_DEVICES, device_count, wait, NULL);
+        return (entry) ? entry->result : YE_NOT_ALL_DEVS_FOUND;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = DoStartDeviceDetection(device_count, wait);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DETECT_DEVICES, device_count, wait, result);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetDeviceHandles */
+DWORD yasdi_bus::device_handles(DWORD *handles, DWORD max_handles)
+{
+    DWORD answer = 0;
+    if (hand_over([&] { answer = device_handles(handles, max_handles); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DEVICE_HANDLES, max_handles, 0, NULL);
+        if (!entry) return 0;
+        for (size_t i = 0; (i < entry->handles.size()) and (i < max_handles); i++) handles[i] = entry->handles[i];
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    DWORD count = GetDeviceHandles(handles, max_handles);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DEVICE_HANDLES, max_handles, 0, count);
+        entry.flags = TRACE_HAS_HANDLES;
+        entry.handles.assign(handles, handles + count);
+        record(entry, call_started);
+    }
+    return count;
+}
+
+/* GetDeviceName */
+int yasdi_bus::device_name(DWORD device, char *buffer, int size)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = device_name(device, buffer, size); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DEVICE_NAME, device, 0, NULL);
+        if (!entry) return YE_UNKNOWN_HANDLE;
+        copy_text(entry->text, buffer, size);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = GetDeviceName(device, buffer, size);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DEVICE_NAME, device, 0, result);
+        entry.flags = TRACE_HAS_TEXT;
+        entry.text = buffer_text(buffer, size);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetChannelHandlesEx */
+DWORD yasdi_bus::channel_handles(DWORD device, DWORD *handles, DWORD max_handles, TChanType type)
+{
+    DWORD answer = 0;
+    if (hand_over([&] { answer = channel_handles(device, handles, max_handles, type); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_CHANNEL_HANDLES, device, type, NULL);
+        if (!entry) return 0;
+        for (size_t i = 0; (i < entry->handles.size()) and (i < max_handles); i++) handles[i] = entry->handles[i];
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    DWORD count = GetChannelHandlesEx(device, handles, max_handles, type);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_CHANNEL_HANDLES, device, type, count);
+        entry.flags = TRACE_HAS_HANDLES;
+        entry.handles.assign(handles, handles + count);
+        record(entry, call_started);
+    }
+    return count;
+}
+
+/* FindChannelName */
+DWORD yasdi_bus::find_channel(DWORD device, char *name)
+{
+    DWORD answer = 0;
+    if (hand_over([&] { answer = find_channel(device, name); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_FIND_CHANNEL, device, 0, name);
+        return (entry) ? entry->result : INVALID_HANDLE;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    DWORD handle = FindChannelName(device, name);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_FIND_CHANNEL, device, 0, handle);
+        entry.flags = TRACE_HAS_TEXT;
+        entry.text = name;
+        record(entry, call_started);
+    }
+    return handle;
+}
+
+/* GetChannelName */
+int yasdi_bus::channel_name(DWORD channel, char *buffer, DWORD size)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = channel_name(channel, buffer, size); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_CHANNEL_NAME, channel, 0, NULL);
+        if (!entry) return YE_UNKNOWN_HANDLE;
+        copy_text(entry->text, buffer, size);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = GetChannelName(channel, buffer, size);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_CHANNEL_NAME, channel, 0, result);
+        entry.flags = TRACE_HAS_TEXT;
+        entry.text = buffer_text(buffer, size);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetChannelUnit */
+int yasdi_bus::channel_unit(DWORD channel, char *buffer, DWORD size)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = channel_unit(channel, buffer, size); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_CHANNEL_UNIT, channel, 0, NULL);
+        if (!entry) return YE_UNKNOWN_HANDLE;
+        copy_text(entry->text, buffer, size);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = GetChannelUnit(channel, buffer, size);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_CHANNEL_UNIT, channel, 0, result);
+        entry.flags = TRACE_HAS_TEXT;
+        entry.text = buffer_text(buffer, size);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetChannelValue */
+int yasdi_bus::channel_value(DWORD channel, DWORD device, double *value, char *text, DWORD size, DWORD max_age)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = channel_value(channel, device, value, text, size, max_age); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_CHANNEL_VALUE, channel, device, NULL);
+        if (!entry) return YE_TIMEOUT;
+        *value = entry->number;
+        copy_text(entry->text, text, size);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = GetChannelValue(channel, device, value, text, size, max_age);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_CHANNEL_VALUE, channel, device, result);
+        entry.flags = TRACE_HAS_NUMBER | TRACE_HAS_TEXT;
+        entry.number = *value;
+        entry.text = buffer_text(text, size);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetChannelStatTextCnt */
+int yasdi_bus::stat_text_count(DWORD channel)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = stat_text_count(channel); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_STAT_TEXT_COUNT, channel, 0, NULL);
+        return (entry) ? entry->result : 0;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int count = GetChannelStatTextCnt(channel);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_STAT_TEXT_COUNT, channel, 0, count);
+        record(entry, call_started);
+    }
+    return count;
+}
+
+/* GetChannelStatText */
+int yasdi_bus::stat_text(DWORD channel, int index, char *buffer, int size)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = stat_text(channel, index, buffer, size); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_STAT_TEXT, channel, index, NULL);
+        if (!entry) return YE_UNKNOWN_HANDLE;
+        copy_text(entry->text, buffer, size);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = GetChannelStatText(channel, index, buffer, size);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_STAT_TEXT, channel, index, result);
+        entry.flags = TRACE_HAS_TEXT;
+        entry.text = buffer_text(buffer, size);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* The driver, and the peer on that driver, that reaches a device. For the IP driver the peer is the gateway's
+   IP address (in host byte order); for the serial driver it is 0. Returns FALSE if the device has no route,
+   which is the case until it has answered */
+BOOL yasdi_bus::device_endpoint(DWORD device, DWORD *driver, DWORD *peer)
+{
+    BOOL answer = 0;
+    if (hand_over([&] { answer = device_endpoint(device, driver, peer); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DEVICE_ENDPOINT, device, 0, NULL);
+        if ((!entry) or (entry->handles.size() != 2)) return FALSE;
+        *driver = entry->handles[0];
+        *peer = entry->handles[1];
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    BOOL result = FALSE;
+    *driver = 0;
+    *peer = 0;
+    void *net_device = TObjManager_GetRef(device);
+    if (net_device) {
+        result = TRoute_FindRoute(TNetDevice_GetNetAddr(net_device), driver, peer);
+    }
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DEVICE_ENDPOINT, device, 0, result);
+        entry.flags = TRACE_HAS_HANDLES;
+        entry.handles.push_back(*driver);
+        entry.handles.push_back(*peer);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetChannelValRange */
+int yasdi_bus::channel_range(DWORD channel, double *min, double *max)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = channel_range(channel, min, max); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_CHANNEL_RANGE, channel, 0, NULL);
+        if (!entry) return YE_UNKNOWN_HANDLE;
+        *min = entry->number;
+        *max = strtod(entry->text.c_str(), NULL);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = GetChannelValRange(channel, min, max);
+    if (this->mode == BUS_CAPTURE) {
+        char max_text[32];
+        snprintf(max_text, sizeof(max_text), "%.17g", *max);
+        trace_record entry = new_record(CALL_CHANNEL_RANGE, channel, 0, result);
+        entry.flags = TRACE_HAS_NUMBER | TRACE_HAS_TEXT;
+        entry.number = *min;
+        entry.text = max_text;
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetChannelAccessRights */
+int yasdi_bus::channel_access(DWORD channel, BYTE *rights)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = channel_access(channel, rights); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_CHANNEL_ACCESS, channel, 0, NULL);
+        if ((!entry) or (entry->handles.size() != 1)) return YE_UNKNOWN_HANDLE;
+        *rights = entry->handles[0];
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    *rights = 0;
+    int result = GetChannelAccessRights(channel, rights);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_CHANNEL_ACCESS, channel, 0, result);
+        entry.flags = TRACE_HAS_HANDLES;
+        entry.handles.push_back(*rights);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetDeviceSN */
+int yasdi_bus::device_serial(DWORD device, DWORD *serial)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = device_serial(device, serial); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DEVICE_SERIAL, device, 0, NULL);
+        if ((!entry) or (entry->handles.size() != 1)) return YE_UNKNOWN_HANDLE;
+        *serial = entry->handles[0];
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    *serial = 0;
+    int result = GetDeviceSN(device, serial);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DEVICE_SERIAL, device, 0, result);
+        entry.flags = TRACE_HAS_HANDLES;
+        entry.handles.push_back(*serial);
+        record(entry, call_started);
+    }
+    return result;
+}
+
+/* GetDeviceType */
+int yasdi_bus::device_type(DWORD device, char *buffer, int size)
+{
+    int answer = 0;
+    if (hand_over([&] { answer = device_type(device, buffer, size); })) return answer;
+
+    if (this->mode == BUS_PLAY) {
+        const trace_record *entry = next_record(CALL_DEVICE_TYPE, device, 0, NULL);
+        if (!entry) return YE_UNKNOWN_HANDLE;
+        copy_text(entry->text, buffer, size);
+        return entry->result;
+    }
+
+    chrono::steady_clock::time_point call_started = begin_call();
+    int result = GetDeviceType(device, buffer, size);
+    if (this->mode == BUS_CAPTURE) {
+        trace_record entry = new_record(CALL_DEVICE_TYPE, device, 0, result);
+        entry.flags = TRACE_HAS_TEXT;
+        entry.text = buffer_text(buffer, size);
+        record(entry, call_started);
+    }
+    return result;
+}
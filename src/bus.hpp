@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef BUS_HPP_INCLUDED
+#define BUS_HPP_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "libyasdi.h"
+#include "libyasdimaster.h"
+#include "tools.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef min
+#undef max
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include "realtime.hpp"
+
+/* Bus modes */
+#define BUS_LIVE 0
+#define BUS_CAPTURE 1
+#define BUS_PLAY 2
+
+/* The trace file starts with this, then a version number */
+#define TRACE_MAGIC "SMATRACE"
+#define TRACE_VERSION 1
+
+/* The calls that are traced */
+#define CALL_INITIALIZE 1
+#define CALL_GET_DRIVERS 2
+#define CALL_DRIVER_NAME 3
+#define CALL_DRIVER_ONLINE 4
+#define CALL_DRIVER_OFFLINE 5
+#define CALL_SHUTDOWN 6
+#define CALL_DETECT_DEVICES 7
+#define CALL_DEVICE_HANDLES 8
+#define CALL_DEVICE_NAME 9
+#define CALL_CHANNEL_HANDLES 10
+#define CALL_FIND_CHANNEL 11
+#define CALL_CHANNEL_NAME 12
+#define CALL_CHANNEL_UNIT 13
+#define CALL_CHANNEL_VALUE 14
+#define CALL_STAT_TEXT_COUNT 15
+#define CALL_STAT_TEXT 16
+#define CALL_DEVICE_ENDPOINT 17
+#define CALL_CHANNEL_RANGE 18
+#define CALL_CHANNEL_ACCESS 19
+#define CALL_DEVICE_SERIAL 20
+#define CALL_DEVICE_TYPE 21
+
+/* Which optional fields a trace record has */
+#define TRACE_HAS_NUMBER 0x01
+#define TRACE_HAS_TEXT 0x02
+#define TRACE_HAS_HANDLES 0x04
+
+using namespace std;
+
+/* One call to the YASDI library. 'args' are the input arguments that identify the call (eg; the channel
+   and device handles), 'result' is the return value, and 'number', 'text' and 'handles' are the values
+   returned through pointers. For FindChannelName, 'text' is the channel name that was looked up. For
+   GetChannelValRange, 'number' is the minimum and 'text' the maximum */
+struct trace_record {
+    uint8_t call;
+    uint8_t flags;
+    uint32_t args[2];
+    int32_t result;
+    uint32_t offset_ms; /* since the trace started */
+    uint32_t duration_us;
+    double number;
+    string text;
+    vector <uint32_t> handles;
+};
+
+/* All calls to the YASDI master library go through this class. Normally (BUS_LIVE) the library is simply called.
+   In BUS_CAPTURE mode every call is also written to a binary trace file: the call, its arguments, its results and
+   how long it took. In BUS_PLAY mode the library is not used at all: each call is answered from the trace, after
+   the same delay as when it was captured, so a session can be reproduced (and profiled) without any inverters.
+   If the calls in the playback don't match the trace (eg; because of timing), later records are searched for
+   the same call; if there is none, the call fails.
+
+   If a bus thread is in use (see realtime.hpp), each call is handed over to it, so that only that thread (and the
+   threads YASDI starts from it) ever touch the serial port. Otherwise calls can come from several threads at once
+   (see endpoints.hpp), so the trace is written and searched under a lock.
+
+   The trace is in host byte order. Each record is: call (1 byte), flags (1), args (2 x 4), result (4),
+   offset in milliseconds (4), duration in microseconds (4), then if flagged: number (8), text (2 byte length
+   and the bytes) and handles (4 byte count and 4 bytes each) */
+class yasdi_bus
+{
+    public:
+        yasdi_bus();
+        ~yasdi_bus();
+        bool capture(const string &path);
+        bool play(const string &path);
+        void close();
+        int get_mode();
+        bool played_out();
+        void use_thread(bus_thread *io_thread);
+
+        int initialize(const char *conf_file, DWORD *drivers);
+        DWORD get_drivers(DWORD *drivers, int max_drivers);
+        BOOL driver_name(DWORD driver, char *buffer, DWORD size);
+        BOOL driver_online(DWORD driver);
+        void driver_offline(DWORD driver);
+        void shutdown();
+        int detect_devices(int device_count, BOOL wait);
+        DWORD device_handles(DWORD *handles, DWORD max_handles);
+        int device_name(DWORD device, char *buffer, int size);
+        DWORD channel_handles(DWORD device, DWORD *handles, DWORD max_handles, TChanType type);
+        DWORD find_channel(DWORD device, char *name);
+        int channel_name(DWORD channel, char *buffer, DWORD size);
+        int channel_unit(DWORD channel, char *buffer, DWORD size);
+        int channel_value(DWORD channel, DWORD device, double *value, char *text, DWORD size, DWORD max_age);
+        int stat_text_count(DWORD channel);
+        int stat_text(DWORD channel, int index, char *buffer, int size);
+        BOOL device_endpoint(DWORD device, DWORD *driver, DWORD *peer);
+        int channel_range(DWORD channel, double *min, double *max);
+        int channel_access(DWORD channel, BYTE *rights);
+        int device_serial(DWORD device, DWORD *serial);
+        int device_type(DWORD device, char *buffer, int size);
+
+    private:
+        template <class F> bool hand_over(F call);
+        chrono::steady_clock::time_point begin_call();
+        void record(trace_record &entry, chrono::steady_clock::time_point call_started);
+        const trace_record *next_record(uint8_t call, uint32_t arg0, uint32_t arg1, const char *text);
+        bool read_record(trace_record &entry);
+
+        int mode;
+        bus_thread *io_thread; /* NULL unless the calls are made on a bus thread */
+        FILE *trace;
+        vector <trace_record> records; /* the whole trace, when playing */
+        vector <bool> used; /* records that have answered a call */
+        size_t next; /* the first record that hasn't */
+        size_t last_reading; /* the last GetChannelValue in the trace */
+        chrono::steady_clock::time_point started;
+        mutex trace_mutex;
+};
+
+extern yasdi_bus g_bus;
+
+#endif /* BUS_HPP_INCLUDED */
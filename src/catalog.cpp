@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fstream>
+#include <sstream>
+#include "catalog.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* The JSON types that the catalog uses */
+#define JSON_NULL 0
+#define JSON_BOOL 1
+#define JSON_NUMBER 2
+#define JSON_STRING 3
+#define JSON_ARRAY 4
+#define JSON_OBJECT 5
+
+/* A parsed JSON value. The catalog is small and read once, so a plain tree is good enough */
+struct json_node {
+    int type;
+    double number;
+    string text;
+    vector <json_node> items;
+    vector <pair <string, json_node> > members;
+
+    /* A member of an object, or NULL if there is none */
+    const json_node *member(const char *name) const
+    {
+        for (size_t i = 0; i < this->members.size(); i++) {
+            if (this->members[i].first == name) return &this->members[i].second;
+        }
+        return NULL;
+    }
+};
+
+/* A recursive descent parser, for just enough JSON to read back what 'save' writes */
+class json_parser
+{
+    public:
+        json_parser(const string &text) : text(text), pos(0) {}
+
+        /* Parse the whole text. Returns false if it isn't valid JSON */
+        bool parse(json_node &node)
+        {
+            return (parse_value(node, 0)) and (skip_space() == this->text.size());
+        }
+
+    private:
+        size_t skip_space()
+        {
+            while ((this->pos < this->text.size()) and (isspace((unsigned char) this->text[this->pos]))) this->pos++;
+            return this->pos;
+        }
+
+        bool literal(const char *word)
+        {
+            size_t length = strlen(word);
+            if (this->text.compare(this->pos, length, word) != 0) return false;
+            this->pos += length;
+            return true;
+        }
+
+        bool parse_value(json_node &node, int depth)
+        {
+            if (depth > 16) return false;
+            skip_space();
+            if (this->pos >= this->text.size()) return false;
+
+            node.type = JSON_NULL;
+            node.number = 0;
+            char c = this->text[this->pos];
+            if (c == '{') return parse_object(node, depth);
+            if (c == '[') return parse_array(node, depth);
+            if (c == '"') {
+                node.type = JSON_STRING;
+                return parse_string(node.text);
+            }
+            if (literal("null")) return true;
+            if (literal("true")) {
+                node.type = JSON_BOOL;
+                node.number = 1;
+                return true;
+            }
+            if (literal("false")) {
+                node.type = JSON_BOOL;
+                return true;
+            }
+
+            const char *start = this->text.c_str() + this->pos;
+            char *end = NULL;
+            node.type = JSON_NUMBER;
+            node.number = strtod(start, &end);
+            if (end == start) return false;
+            this->pos += end - start;
+            return true;
+        }
+
+        bool parse_object(json_node &node, int depth)
+        {
+            node.type = JSON_OBJECT;
+            this->pos++;
+            if (this->text[skip_space()] == '}') {
+                this->pos++;
+                return true;
+            }
+            while (true) {
+                string name;
+                json_node value;
+                skip_space();
+                if ((this->pos >= this->text.size()) or (this->text[this->pos] != '"') or (not parse_string(name))) return false;
+                if ((skip_space() >= this->text.size()) or (this->text[this->pos] != ':')) return false;
+                this->pos++;
+                if (not parse_value(value, depth + 1)) return false;
+                node.members.push_back(make_pair(name, value));
+
+                if (skip_space() >= this->text.size()) return false;
+                char c = this->text[this->pos++];
+                if (c == '}') return true;
+                if (c != ',') return false;
+            }
+        }
+
+        bool parse_array(json_node &node, int depth)
+        {
+            node.type = JSON_ARRAY;
+            this->pos++;
+            if (this->text[skip_space()] == ']') {
+                this->pos++;
+                return true;
+            }
+            while (true) {
+                json_node value;
+                if (not parse_value(value, depth + 1)) return false;
+                node.items.push_back(value);
+
+                if (skip_space() >= this->text.size()) return false;
+                char c = this->text[this->pos++];
+                if (c == ']') return true;
+                if (c != ',') return false;
+            }
+        }
+
+        /* A quoted string. \u escapes are only expected for control characters, so only one byte is kept */
+        bool parse_string(string &out)
+        {
+            this->pos++;
+            while (this->pos < this->text.size()) {
+                char c = this->text[this->pos++];
+                if (c == '"') return true;
+                if (c != '\\') {
+                    out += c;
+                    continue;
+                }
+                if (this->pos >= this->text.size()) return false;
+                c = this->text[this->pos++];
+                if (c == 'u') {
+                    if (this->pos + 4 > this->text.size()) return false;
+                    out += (char) strtol(this->text.substr(this->pos, 4).c_str(), NULL, 16);
+                    this->pos += 4;
+                }
+                else if (c == 'n') out += '\n';
+                else if (c == 't') out += '\t';
+                else if (c == 'r') out += '\r';
+                else out += c;
+            }
+            return false;
+        }
+
+        const string &text;
+        size_t pos;
+};
+
+/* A quoted and escaped JSON string */
+static string quote(const string &text)
+{
+    string out = "\"";
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if ((c == '"') or (c == '\\')) {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+/* A JSON number, or null if there is none */
+static string number(bool valid, double value)
+{
+    if ((not valid) or (not isfinite(value))) return "null";
+    char text[32];
+    snprintf(text, sizeof(text), "%.15g", value);
+    return text;
+}
+
+/* A string member of an object, or empty if it is missing */
+static string text_member(const json_node &node, const char *name)
+{
+    const json_node *member = node.member(name);
+    return ((member) and (member->type == JSON_STRING)) ? member->text : "";
+}
+
+/* Access rights as "r", "w" or "rw", or empty if they are unknown */
+string format_access(int access)
+{
+    if (access < 0) return "";
+    string text;
+    if (access & CAR_READ) text += "r";
+    if (access & CAR_WRITE) text += "w";
+    return text;
+}
+
+/* Read a catalog written by 'save'. Returns false if it can't be read, or is from another version */
+bool channel_catalog::load(const string &path)
+{
+    ifstream reader(path.c_str());
+    if (!reader) return false;
+    stringstream buffer;
+    buffer << reader.rdbuf();
+    string text = buffer.str();
+
+    json_node root;
+    json_parser parser(text);
+    if ((not parser.parse(root)) or (root.type != JSON_OBJECT)) {
+        LOG_ERROR("The catalog is not valid JSON: " << path);
+        return false;
+    }
+    const json_node *version = root.member("version");
+    const json_node *devices = root.member("devices");
+    if ((!version) or (version->number != CATALOG_VERSION) or (!devices) or (devices->type != JSON_ARRAY)) {
+        LOG_ERROR("The catalog is not version " << CATALOG_VERSION << ": " << path);
+        return false;
+    }
+
+    for (size_t i = 0; i < devices->items.size(); i++) {
+        const json_node &item = devices->items[i];
+        catalog_device device;
+        device.name = text_member(item, "name");
+        const json_node *serial = item.member("serial");
+        device.serial = ((serial) and (serial->type == JSON_NUMBER)) ? (DWORD) serial->number : 0;
+        device.type = text_member(item, "type");
+        device.endpoint = text_member(item, "endpoint");
+        if (device.name.empty()) continue;
+
+        const json_node *channels = item.member("channels");
+        for (size_t j = 0; (channels) and (j < channels->items.size()); j++) {
+            const json_node &channel_item = channels->items[j];
+            catalog_channel channel;
+            channel.name = text_member(channel_item, "name");
+            channel.kind = text_member(channel_item, "kind");
+            channel.units = text_member(channel_item, "units");
+            const json_node *min = channel_item.member("min");
+            const json_node *max = channel_item.member("max");
+            channel.has_range = (min) and (max) and (min->type == JSON_NUMBER) and (max->type == JSON_NUMBER);
+            channel.min = (channel.has_range) ? min->number : 0;
+            channel.max = (channel.has_range) ? max->number : 0;
+            const json_node *access_node = channel_item.member("access");
+            string access = text_member(channel_item, "access");
+            channel.access = ((access_node) and (access_node->type == JSON_STRING)) ? 0 : -1;
+            if (access.find('r') != string::npos) channel.access |= CAR_READ;
+            if (access.find('w') != string::npos) channel.access |= CAR_WRITE;
+            const json_node *texts = channel_item.member("texts");
+            for (size_t k = 0; (texts) and (k < texts->items.size()); k++) {
+                channel.texts.push_back(texts->items[k].text);
+            }
+            channel.value = text_member(channel_item, "value");
+            if (not channel.name.empty()) device.channels.push_back(channel);
+        }
+        add(device);
+    }
+    return true;
+}
+
+/* Write the whole catalog. It is written to a temporary file and renamed, so it is never half written */
+bool channel_catalog::save(const string &path)
+{
+    lock_guard<mutex> lock(this->catalog_mutex);
+    string temp_path = path + ".tmp";
+
+    FILE *writer = fopen(temp_path.c_str(), "w");
+    if (!writer) {
+        LOG_ERROR("Could not write the catalog: " << temp_path);
+        return false;
+    }
+
+    /* One line for each channel, so that the catalog can be read and diffed */
+    fprintf(writer, "{\n  \"version\": %d,\n  \"devices\": [", CATALOG_VERSION);
+    for (size_t i = 0; i < this->devices.size(); i++) {
+        const catalog_device &device = this->devices[i];
+        fprintf(writer, "%s\n    {\n      \"name\": %s,\n      \"serial\": %lu,\n      \"type\": %s,\n      \"endpoint\": %s,\n      \"channels\": [",
+                (i > 0) ? "," : "", quote(device.name).c_str(), (unsigned long) device.serial, quote(device.type).c_str(),
+                quote(device.endpoint).c_str());
+
+        for (size_t j = 0; j < device.channels.size(); j++) {
+            const catalog_channel &channel = device.channels[j];
+            string line = "{\"name\": " + quote(channel.name) + ", \"kind\": " + quote(channel.kind) + ", \"units\": " + quote(channel.units) +
+                          ", \"min\": " + number(channel.has_range, channel.min) + ", \"max\": " + number(channel.has_range, channel.max) +
+                          ", \"access\": " + ((channel.access < 0) ? "null" : quote(format_access(channel.access))) + ", \"texts\": [";
+            for (size_t k = 0; k < channel.texts.size(); k++) {
+                line += ((k > 0) ? ", " : "") + quote(channel.texts[k]);
+            }
+            line += "]";
+            if (channel.kind == CATALOG_SPOT) line += ", \"value\": " + quote(channel.value);
+            line += "}";
+            fprintf(writer, "%s\n        %s", (j > 0) ? "," : "", line.c_str());
+        }
+        fprintf(writer, "\n      ]\n    }");
+    }
+    fprintf(writer, "\n  ]\n}\n");
+
+    if (fclose(writer) != 0) {
+        LOG_ERROR("Could not write the catalog: " << temp_path);
+        return false;
+    }
+    return (rename(temp_path.c_str(), path.c_str()) == 0);
+}
+
+/* Add a device. A device that is already in the catalog is replaced */
+void channel_catalog::add(const catalog_device &device)
+{
+    lock_guard<mutex> lock(this->catalog_mutex);
+    unordered_map <string, size_t>::const_iterator it = this->by_name.find(device.name);
+    if (it != this->by_name.end()) {
+        this->devices[it->second] = device;
+        return;
+    }
+    this->by_name[device.name] = this->devices.size();
+    this->devices.push_back(device);
+}
+
+/* Check if a device has been catalogued */
+bool channel_catalog::contains(const string &name)
+{
+    lock_guard<mutex> lock(this->catalog_mutex);
+    return (this->by_name.find(name) != this->by_name.end());
+}
+
+/* Get a copy of a device. Returns false if it isn't in the catalog */
+bool channel_catalog::find(const string &name, catalog_device &device_out)
+{
+    lock_guard<mutex> lock(this->catalog_mutex);
+    unordered_map <string, size_t>::const_iterator it = this->by_name.find(name);
+    if (it == this->by_name.end()) return false;
+    device_out = this->devices[it->second];
+    return true;
+}
+
+size_t channel_catalog::size()
+{
+    lock_guard<mutex> lock(this->catalog_mutex);
+    return this->devices.size();
+}
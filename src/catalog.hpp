@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CATALOG_HPP_INCLUDED
+#define CATALOG_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include "bus.hpp"
+
+/* The version of the catalog file. A catalog with another version is not loaded */
+#define CATALOG_VERSION 1
+
+/* The kinds of channel */
+#define CATALOG_SPOT "spot"
+#define CATALOG_PARAMETER "parameter"
+
+using namespace std;
+
+/* One channel of a device, as the library describes it */
+struct catalog_channel {
+    string name; /* the raw SMA name */
+    string kind; /* CATALOG_SPOT or CATALOG_PARAMETER */
+    string units;
+    bool has_range;
+    double min;
+    double max;
+    int access; /* CAR_READ and CAR_WRITE bits, or -1 if unknown */
+    vector <string> texts; /* the status texts, if the channel has any */
+    string value; /* the value read when it was catalogued. Only for spot channels */
+};
+
+/* One device and all of its channels */
+struct catalog_device {
+    string name; /* with spaces replaced, as used for its log directory */
+    DWORD serial;
+    string type;
+    string endpoint; /* the bus it answered on, if the buses were told apart (-z) */
+    vector <catalog_channel> channels;
+};
+
+/* This class holds the catalog that discovery writes: every device, and every spot and parameter channel with
+   its units, value range, access rights and status texts. It is saved as JSON after each device, by writing a
+   temporary file and renaming it, so an interrupted discovery leaves a valid catalog of the devices done so far
+   and carries on from there when it is run again.
+
+   When polling, the catalog stands in for asking the library for every channel's name and units. Devices can
+   be added from several threads at once */
+class channel_catalog
+{
+    public:
+        bool load(const string &path);
+        bool save(const string &path);
+        void add(const catalog_device &device);
+        bool contains(const string &name);
+        bool find(const string &name, catalog_device &device_out);
+        size_t size();
+
+    private:
+        vector <catalog_device> devices;
+        unordered_map <string, size_t> by_name;
+        mutex catalog_mutex;
+};
+
+string format_access(int access);
+
+#endif /* CATALOG_HPP_INCLUDED */
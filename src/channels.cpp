@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <map>
+#include "channels.hpp"
+
+using namespace std;
+
+const char *canonical_keys[CHANNEL_COUNT] = {
+    "pac", "yield", "pdc1", "pdc2", "vdc1", "vdc2", "vac1", "vac2", "vac3", "iac1", "iac2", "iac3",
+    "idc1", "idc2", "pac1", "pac2", "pac3", "gridfreq", "cosphi", "mode", "error", "op_hours", "isol"
+};
+
+/* Build the map of channel names to canonical channels. These are the same names that 'process_data' looks for */
+static map <string, int> build_canonical_names()
+{
+    map <string, int> names;
+
+    names["grid power"] = CHANNEL_PAC;
+    names["energy yield"] = CHANNEL_YIELD;
+    names["A.Ms.Watt"] = CHANNEL_PDC1;
+    names["B.Ms.Watt"] = CHANNEL_PDC2;
+    names["A.Ms.Vol"] = CHANNEL_VDC1;
+    names["pv input voltage"] = CHANNEL_VDC1;
+    names["B.Ms.Vol"] = CHANNEL_VDC2;
+    names["GridMs.PhV.phsA"] = CHANNEL_VAC1;
+    names["grid voltage"] = CHANNEL_VAC1;
+    names["GridMs.PhV.phsB"] = CHANNEL_VAC2;
+    names["GridMs.PhV.phsC"] = CHANNEL_VAC3;
+    names["GridMs.A.phsA"] = CHANNEL_IAC1;
+    names["current to grid"] = CHANNEL_IAC1;
+    names["GridMs.A.phsB"] = CHANNEL_IAC2;
+    names["GridMs.A.phsC"] = CHANNEL_IAC3;
+    names["A.Ms.Amp"] = CHANNEL_IDC1;
+    names["pv panels current"] = CHANNEL_IDC1;
+    names["B.Ms.Amp"] = CHANNEL_IDC2;
+    names["GridMs.W.phsA"] = CHANNEL_PAC1;
+    names["GridMs.W.phsB"] = CHANNEL_PAC2;
+    names["GridMs.W.phsC"] = CHANNEL_PAC3;
+    names["GridMs.Hz"] = CHANNEL_GRIDFREQ;
+    names["grid freq"] = CHANNEL_GRIDFREQ;
+    names["GridMs.TotPF"] = CHANNEL_COSPHI;
+    names["Mode"] = CHANNEL_MODE;
+    names["Status"] = CHANNEL_MODE;
+    names["Error"] = CHANNEL_ERROR;
+    names["error"] = CHANNEL_ERROR;
+    names["total operating hours"] = CHANNEL_OP_HOURS;
+    names["isol-resist"] = CHANNEL_ISOL;
+
+    return names;
+}
+
+/* Find the canonical channel for a channel name (after conversion). Returns -1 if it is not one of them */
+int find_canonical_channel(const string &name)
+{
+    static const map <string, int> names = build_canonical_names();
+
+    map <string, int>::const_iterator it = names.find(name);
+    if (it == names.end()) return -1;
+    return it->second;
+}
+
+/* Check if a canonical channel holds a text (keyword) value rather than a number */
+bool canonical_is_text(int channel)
+{
+    return (channel == CHANNEL_MODE) or (channel == CHANNEL_ERROR);
+}
+
+/* Convert a channel value string to a number. Returns false if it is not (entirely) a number */
+bool parse_channel_value(const string &value, double *number)
+{
+    if (value.empty()) return false;
+
+    char *end;
+    *number = strtod(value.c_str(), &end);
+    return (*end == '\0');
+}
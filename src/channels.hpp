@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CHANNELS_HPP_INCLUDED
+#define CHANNELS_HPP_INCLUDED
+
+#include <string>
+
+/* The canonical channels. These are the columns of the log files, in the same order as in 'process_data'.
+   Different inverter models use different channel names for the same thing (see 'process_data') */
+#define CHANNEL_PAC 0
+#define CHANNEL_YIELD 1
+#define CHANNEL_PDC1 2
+#define CHANNEL_PDC2 3
+#define CHANNEL_VDC1 4
+#define CHANNEL_VDC2 5
+#define CHANNEL_VAC1 6
+#define CHANNEL_VAC2 7
+#define CHANNEL_VAC3 8
+#define CHANNEL_IAC1 9
+#define CHANNEL_IAC2 10
+#define CHANNEL_IAC3 11
+#define CHANNEL_IDC1 12
+#define CHANNEL_IDC2 13
+#define CHANNEL_PAC1 14
+#define CHANNEL_PAC2 15
+#define CHANNEL_PAC3 16
+#define CHANNEL_GRIDFREQ 17
+#define CHANNEL_COSPHI 18
+#define CHANNEL_MODE 19
+#define CHANNEL_ERROR 20
+#define CHANNEL_OP_HOURS 21
+#define CHANNEL_ISOL 22
+#define CHANNEL_COUNT 23
+
+using namespace std;
+
+/* This is used by the vector to store all the data that is collected */
+struct vec_data {
+    string name;
+    string name_units;
+    string value;
+    string channel; /* raw SMA channel name, before any conversion */
+    string units;
+};
+
+/* Short, stable names of the canonical channels. Used as keys in the newer output formats */
+extern const char *canonical_keys[CHANNEL_COUNT];
+
+int find_canonical_channel(const string &name);
+bool canonical_is_text(int channel);
+bool parse_channel_value(const string &value, double *number);
+
+#endif /* CHANNELS_HPP_INCLUDED */
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include "endpoints.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Read Master.MaxCmdsParallel from yasdi.ini: how many requests the library will have on the go at once */
+int read_max_commands(const string &conf_file)
+{
+    ifstream reader(conf_file.c_str());
+    string line, section;
+    long commands = 1;
+    while (getline(reader, line)) {
+        line = trim_whitespace(line);
+        if ((line.empty()) or (line[0] == '#') or (line[0] == ';')) continue;
+        if (line[0] == '[') {
+            section = line.substr(1, line.find(']') - 1);
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if ((section != "Master") or (equals == string::npos)) continue;
+        if (trim_whitespace(line.substr(0, equals)) == "MaxCmdsParallel") {
+            convert_long(trim_whitespace(line.substr(equals + 1)), &commands);
+        }
+    }
+    return commands;
+}
+
+/* Constructor for the endpoint_table class */
+endpoint_table::endpoint_table()
+{
+    this->parallel = 0;
+}
+
+/* Poll up to 'parallel' endpoints at once. 'driver_names' are the names of the library's drivers by ID */
+void endpoint_table::initialize(int parallel, const map <DWORD, string> &driver_names)
+{
+    this->parallel = (parallel < 1) ? 1 : parallel;
+    this->driver_names = driver_names;
+}
+
+bool endpoint_table::enabled()
+{
+    return (this->parallel > 0);
+}
+
+/* Check if more than one endpoint is polled at once */
+bool endpoint_table::concurrent()
+{
+    return (this->parallel > 1) and (this->endpoints.size() > 1);
+}
+
+/* Name an endpoint after its driver, and the gateway's address for the IP driver */
+string endpoint_table::endpoint_name(BOOL routed, DWORD driver, DWORD peer)
+{
+    if (not routed) return ENDPOINT_UNROUTED;
+
+    map <DWORD, string>::const_iterator it = this->driver_names.find(driver);
+    string name = (it != this->driver_names.end()) ? it->second : "driver" + to_string(driver);
+    if (peer != 0) {
+        name += "/" + to_string((peer >> 24) & 0xff) + "." + to_string((peer >> 16) & 0xff) + "." +
+                to_string((peer >> 8) & 0xff) + "." + to_string(peer & 0xff);
+    }
+    return name;
+}
+
+/* Group the devices by the endpoint they answered on. Call whenever the devices are found again. An endpoint
+   that was already known keeps its state, so one that is down stays down */
+void endpoint_table::assign(device_registry &registry)
+{
+    if (not enabled()) return;
+
+    vector <bus_endpoint> previous;
+    previous.swap(this->endpoints);
+
+    for (size_t index = 0; index < registry.size(); index++) {
+        DWORD driver = 0, peer = 0;
+        BOOL routed = g_bus.device_endpoint(registry[index].handle, &driver, &peer);
+        if (not routed) {
+            driver = 0;
+            peer = 0;
+        }
+
+        size_t i = 0;
+        while ((i < this->endpoints.size()) and ((this->endpoints[i].driver != driver) or (this->endpoints[i].peer != peer))) i++;
+        if (i == this->endpoints.size()) {
+            bus_endpoint endpoint = { endpoint_name(routed, driver, peer), driver, peer, vector <size_t>(), 0, 0, ENDPOINT_MIN_RETRY, 0, 0, 0, 0 };
+            for (size_t j = 0; j < previous.size(); j++) {
+                if ((previous[j].driver != driver) or (previous[j].peer != peer)) continue;
+                endpoint.failures = previous[j].failures;
+                endpoint.retry_at = previous[j].retry_at;
+                endpoint.retry_interval = previous[j].retry_interval;
+            }
+            this->endpoints.push_back(endpoint);
+        }
+        this->endpoints[i].devices.push_back(index);
+    }
+
+    for (size_t i = 0; i < this->endpoints.size(); i++) {
+        LOG_INFO("Endpoint " << this->endpoints[i].name << " has " << this->endpoints[i].devices.size() << " devices");
+    }
+}
+
+/* Poll every device once. 'poll' reads one device, and says if it answered. Each endpoint is polled on its
+   own worker (the caller's thread is one of them), so 'poll' must be safe to call from several threads */
+void endpoint_table::sweep(device_registry &registry, const function<int(device_entry &)> &poll)
+{
+    if (not enabled()) {
+        for (size_t i = 0; i < registry.size(); i++) {
+            poll(registry[i]);
+        }
+        return;
+    }
+
+    time_t now = time(nullptr);
+    for (size_t i = 0; i < this->endpoints.size(); i++) {
+        bus_endpoint &endpoint = this->endpoints[i];
+        endpoint.read = 0;
+        endpoint.failed = 0;
+        endpoint.not_read = 0;
+        endpoint.seconds = 0;
+    }
+
+    /* Each worker takes the next endpoint that no one has polled yet */
+    atomic <size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < this->endpoints.size(); i = next++) {
+            poll_endpoint(this->endpoints[i], registry, poll, now);
+        }
+    };
+
+    size_t worker_count = ((size_t) this->parallel < this->endpoints.size()) ? this->parallel : this->endpoints.size();
+    vector <thread> workers;
+    for (size_t i = 1; i < worker_count; i++) {
+        workers.push_back(thread(worker));
+    }
+    worker();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+/* Poll the devices of one endpoint in turn, unless it is down */
+void endpoint_table::poll_endpoint(bus_endpoint &endpoint, device_registry &registry, const function<int(device_entry &)> &poll, time_t now)
+{
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    bool retrying = (endpoint.retry_at != 0);
+    if ((retrying) and (now < endpoint.retry_at)) {
+        endpoint.not_read = endpoint.devices.size();
+        return;
+    }
+
+    for (size_t i = 0; i < endpoint.devices.size(); i++) {
+        /* Once it is down, leave the rest of its devices until it is tried again */
+        if ((endpoint.retry_at != 0) and (not retrying)) {
+            endpoint.not_read++;
+            continue;
+        }
+
+        int result = poll(registry[endpoint.devices[i]]);
+        if (result == ENDPOINT_NOT_READ) {
+            endpoint.not_read++;
+        }
+        else if (result == ENDPOINT_READ_OK) {
+            endpoint.read++;
+            endpoint.failures = 0;
+            if (retrying) {
+                LOG_INFO("Endpoint " << endpoint.name << " is answering again");
+                endpoint.retry_at = 0;
+                endpoint.retry_interval = ENDPOINT_MIN_RETRY;
+                retrying = false;
+            }
+        }
+        else {
+            endpoint.failed++;
+            endpoint.failures++;
+            if (retrying) {
+                /* It is still down. Try again later, less often */
+                endpoint.retry_interval = (endpoint.retry_interval * 2 > ENDPOINT_MAX_RETRY) ? ENDPOINT_MAX_RETRY : endpoint.retry_interval * 2;
+                endpoint.retry_at = time(nullptr) + endpoint.retry_interval;
+                retrying = false;
+            }
+            else if (endpoint.failures >= ENDPOINT_MAX_FAILURES) {
+                endpoint.retry_at = time(nullptr) + endpoint.retry_interval;
+                LOG_ERROR("Endpoint " << endpoint.name << " is not answering. Trying it again in " << endpoint.retry_interval << " seconds");
+            }
+        }
+    }
+
+    endpoint.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+}
+
+/* The sweep has ended. A line for each endpoint is added to 'lines' */
+void endpoint_table::end_sweep(const string &datetime, vector <string> &lines)
+{
+    for (size_t i = 0; i < this->endpoints.size(); i++) {
+        const bus_endpoint &endpoint = this->endpoints[i];
+        lines.push_back(datetime + "," + endpoint.name + "," + to_string(endpoint.devices.size()) + "," + to_string(endpoint.read) + "," +
+                        to_string(endpoint.failed) + "," + to_string(endpoint.not_read) + "," + convert_double(endpoint.seconds) + "," +
+                        ((endpoint.retry_at == 0) ? "up" : "down"));
+    }
+}
+
+/* The name of the endpoint of a device (by its index in the registry), or empty if there is none */
+string endpoint_table::device_endpoint_name(size_t index)
+{
+    for (size_t i = 0; i < this->endpoints.size(); i++) {
+        const vector <size_t> &devices = this->endpoints[i].devices;
+        if (find(devices.begin(), devices.end(), index) != devices.end()) return this->endpoints[i].name;
+    }
+    return "";
+}
+
+/* The header of the endpoint log */
+string endpoint_table::header()
+{
+    return "#Datetime,endpoint,devices,read,failed,not read,seconds,state";
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef ENDPOINTS_HPP_INCLUDED
+#define ENDPOINTS_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include <functional>
+#include "bus.hpp"
+#include "registry.hpp"
+
+/* Name of the directory (in the logging directory) for the endpoint logs */
+#define ENDPOINT_DIRECTORY "endpoint"
+/* Reads in a row that get no answer before an endpoint is taken to be down */
+#define ENDPOINT_MAX_FAILURES 3
+/* Seconds before an endpoint that is down is tried again. This doubles up to ENDPOINT_MAX_RETRY */
+#define ENDPOINT_MIN_RETRY 60
+#define ENDPOINT_MAX_RETRY 900
+/* Name of the endpoint for devices that the library has no route to */
+#define ENDPOINT_UNROUTED "unrouted"
+
+/* What became of one device in a sweep */
+#define ENDPOINT_READ_OK 0
+#define ENDPOINT_READ_FAILED 1
+#define ENDPOINT_NOT_READ 2
+
+using namespace std;
+
+/* One bus: a serial port, or an RS485 gateway reached through the IP driver */
+struct bus_endpoint {
+    string name; /* eg; COM1 or IP1/192.168.1.50 */
+    DWORD driver;
+    DWORD peer; /* the gateway's IP address (host byte order), or 0 */
+    vector <size_t> devices; /* indexes into the registry */
+    int failures; /* reads in a row that got no answer */
+    time_t retry_at; /* when an endpoint that is down is tried again, or 0 if it is up */
+    int retry_interval;
+
+    /* This sweep */
+    int read;
+    int failed;
+    int not_read;
+    double seconds;
+};
+
+/* This class polls several buses at once. The devices are grouped by the bus they answered on (the route
+   that the library keeps for each device), and each bus is polled by its own worker, one device after
+   another, so an RS485 line still only carries one request at a time. Up to 'parallel' buses are polled
+   at once. The library runs requests to different devices side by side if Master.MaxCmdsParallel in
+   yasdi.ini allows it.
+
+   An endpoint that doesn't answer ENDPOINT_MAX_FAILURES reads in a row is taken to be down, and the rest of
+   its devices are left until it is tried again, after ENDPOINT_MIN_RETRY seconds and then at doubling
+   intervals. So a gateway that drops off the network costs a few timeouts, rather than one for every channel
+   of every inverter behind it, and doesn't hold up the other buses. The time, reads and failures of each
+   endpoint are kept for every sweep.
+
+   Until it is initialized, a sweep simply polls every device in turn on the caller's thread */
+class endpoint_table
+{
+    public:
+        endpoint_table();
+        void initialize(int parallel, const map <DWORD, string> &driver_names);
+        bool enabled();
+        bool concurrent();
+        void assign(device_registry &registry);
+        void sweep(device_registry &registry, const function<int(device_entry &)> &poll);
+        void end_sweep(const string &datetime, vector <string> &lines);
+        string device_endpoint_name(size_t index);
+        static string header();
+
+    private:
+        void poll_endpoint(bus_endpoint &endpoint, device_registry &registry, const function<int(device_entry &)> &poll, time_t now);
+        string endpoint_name(BOOL routed, DWORD driver, DWORD peer);
+
+        int parallel; /* 0 until initialized */
+        map <DWORD, string> driver_names;
+        vector <bus_endpoint> endpoints;
+};
+
+int read_max_commands(const string &conf_file);
+
+#endif /* ENDPOINTS_HPP_INCLUDED */
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+#include "fleet.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+/************************ Kernels ******************************/
+/* These work on whole columns. They have no branches (only selects), and NaN
+   passes through them as "missing", so they vectorize */
+
+/* A missing value counts as zero */
+static inline double or_zero(double x)
+{
+    return (x == x) ? x : 0.0;
+}
+
+/* DC power is the sum of the string powers. Older inverters have no string powers, so use current x voltage */
+static void kernel_dc_power(const double *pdc1, const double *pdc2, const double *idc1, const double *vdc1, double *dc, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        bool have_strings = (pdc1[i] == pdc1[i]) or (pdc2[i] == pdc2[i]);
+        double strings = or_zero(pdc1[i]) + or_zero(pdc2[i]);
+        dc[i] = have_strings ? strings : idc1[i] * vdc1[i];
+    }
+}
+
+/* DC to AC efficiency in percent */
+static void kernel_efficiency(const double *pac, const double *dc, double *efficiency, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        efficiency[i] = (dc[i] > 0) ? 100.0 * pac[i] / dc[i] : NAN;
+    }
+}
+
+/* Phase imbalance in percent: (highest - lowest phase power) / mean phase power */
+static void kernel_imbalance(const double *phase_a, const double *phase_b, const double *phase_c, double *imbalance, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        double a = phase_a[i], b = phase_b[i], c = phase_c[i];
+        double high = (a > b) ? a : b;
+        high = (high > c) ? high : c;
+        double low = (a < b) ? a : b;
+        low = (low < c) ? low : c;
+        double mean = (a + b + c) / 3.0;
+        imbalance[i] = (mean > 0) ? 100.0 * (high - low) / mean : NAN;
+    }
+}
+
+/* Sum of the values that are present */
+static double kernel_sum(const double *x, size_t n)
+{
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += or_zero(x[i]);
+    }
+    return sum;
+}
+
+/* Sum of the values where 'mask' is present */
+static double kernel_sum_where(const double *x, const double *mask, size_t n)
+{
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (mask[i] == mask[i]) ? or_zero(x[i]) : 0.0;
+    }
+    return sum;
+}
+
+/* Largest of the values that are present. NaN if there are none */
+static double kernel_max(const double *x, size_t n)
+{
+    double high = NAN;
+    for (size_t i = 0; i < n; i++) {
+        high = ((x[i] > high) or (high != high)) ? x[i] : high;
+    }
+    return high;
+}
+
+/************************ Kernels end ******************************/
+
+
+/* Constructor for the fleet_table class */
+fleet_table::fleet_table()
+{
+    for (int i = 0; i < CHANNEL_COUNT; i++) this->columns[i] = NULL;
+    for (int i = 0; i < DERIVED_COUNT; i++) this->derived_columns[i] = NULL;
+    this->rows = 0;
+    this->capacity = 0;
+    memset(&this->totals, 0, sizeof(this->totals));
+    reserve(FLEET_INITIAL_ROWS);
+}
+
+fleet_table::~fleet_table()
+{
+    for (int i = 0; i < CHANNEL_COUNT; i++) free(this->columns[i]);
+    for (int i = 0; i < DERIVED_COUNT; i++) free(this->derived_columns[i]);
+}
+
+/* Grow the columns to hold at least 'capacity' rows. Existing rows are kept */
+void fleet_table::reserve(size_t capacity)
+{
+    if (capacity <= this->capacity) return;
+
+    for (int i = 0; i < CHANNEL_COUNT + DERIVED_COUNT; i++) {
+        double **column = (i < CHANNEL_COUNT) ? &this->columns[i] : &this->derived_columns[i - CHANNEL_COUNT];
+        void *memory = NULL;
+        if (posix_memalign(&memory, FLEET_ALIGNMENT, capacity * sizeof(double)) != 0) {
+            throw bad_alloc();
+        }
+        if (*column) {
+            memcpy(memory, *column, this->rows * sizeof(double));
+            free(*column);
+        }
+        *column = (double *) memory;
+    }
+    this->capacity = capacity;
+}
+
+/* Empty the table, ready for the next sweep. The memory is kept */
+void fleet_table::clear()
+{
+    this->rows = 0;
+    this->devices.clear();
+}
+
+/* Add a row for a device, from the values read in this sweep. Returns the row */
+int fleet_table::add_device(const string &device, const vector <vec_data> &data_vector)
+{
+    if (this->rows == this->capacity) {
+        reserve(this->capacity * 2);
+    }
+
+    size_t row = this->rows++;
+    this->devices.push_back(device);
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        this->columns[i][row] = NAN;
+    }
+
+    for (auto iter = data_vector.begin(); iter != data_vector.end(); ++iter) {
+        int channel = find_canonical_channel(iter->name);
+        double number;
+        if ((channel >= 0) and (parse_channel_value(iter->value, &number))) {
+            this->columns[channel][row] = number;
+        }
+    }
+
+    return row;
+}
+
+/* Compute the derived metrics for every device, and the fleet totals */
+void fleet_table::compute()
+{
+    size_t n = this->rows;
+    double **c = this->columns;
+    double **d = this->derived_columns;
+
+    kernel_dc_power(c[CHANNEL_PDC1], c[CHANNEL_PDC2], c[CHANNEL_IDC1], c[CHANNEL_VDC1], d[DERIVED_DC_POWER], n);
+    kernel_efficiency(c[CHANNEL_PAC], d[DERIVED_DC_POWER], d[DERIVED_EFFICIENCY], n);
+    kernel_imbalance(c[CHANNEL_PAC1], c[CHANNEL_PAC2], c[CHANNEL_PAC3], d[DERIVED_IMBALANCE], n);
+
+    this->totals.devices = n;
+    this->totals.ac_power = kernel_sum(c[CHANNEL_PAC], n);
+    this->totals.dc_power = kernel_sum(d[DERIVED_DC_POWER], n);
+    /* Only devices with both AC and DC power count towards the fleet efficiency */
+    double ac_measured = kernel_sum_where(c[CHANNEL_PAC], d[DERIVED_EFFICIENCY], n);
+    double dc_measured = kernel_sum_where(d[DERIVED_DC_POWER], d[DERIVED_EFFICIENCY], n);
+    this->totals.efficiency = (dc_measured > 0) ? 100.0 * ac_measured / dc_measured : NAN;
+    this->totals.yield = kernel_sum(c[CHANNEL_YIELD], n);
+    this->totals.max_imbalance = kernel_max(d[DERIVED_IMBALANCE], n);
+}
+
+/* Number of devices in the table */
+size_t fleet_table::size()
+{
+    return this->rows;
+}
+
+/* Name of the device in a row */
+const string &fleet_table::device(size_t row)
+{
+    return this->devices[row];
+}
+
+/* A column of values for a canonical channel */
+const double *fleet_table::column(int channel)
+{
+    return this->columns[channel];
+}
+
+/* A column of a derived metric. Only valid after compute() */
+const double *fleet_table::derived(int metric)
+{
+    return this->derived_columns[metric];
+}
+
+/* The fleet totals. Only valid after compute() */
+fleet_totals fleet_table::get_totals()
+{
+    return this->totals;
+}
+
+/* Format a number for the log. Missing values are left empty, like missing channels in the device logs */
+static string format_metric(double number)
+{
+    if (number != number) return "";
+    return convert_double(number);
+}
+
+/* Make the log lines for this sweep: one per device, then one for the whole fleet (with a device name of 'fleet') */
+void fleet_table::format(const string &datetime, vector <string> &lines)
+{
+    for (size_t row = 0; row < this->rows; row++) {
+        lines.push_back(datetime + "," + this->devices[row] + ",1," + format_metric(this->columns[CHANNEL_PAC][row]) + "," +
+                        format_metric(this->derived_columns[DERIVED_DC_POWER][row]) + "," + format_metric(this->derived_columns[DERIVED_EFFICIENCY][row]) + "," +
+                        format_metric(this->derived_columns[DERIVED_IMBALANCE][row]) + "," + format_metric(this->columns[CHANNEL_YIELD][row]));
+    }
+
+    lines.push_back(datetime + ",fleet," + to_string(this->totals.devices) + "," + format_metric(this->totals.ac_power) + "," +
+                    format_metric(this->totals.dc_power) + "," + format_metric(this->totals.efficiency) + "," +
+                    format_metric(this->totals.max_imbalance) + "," + format_metric(this->totals.yield));
+}
+
+/* The header of the fleet log */
+string fleet_table::header()
+{
+    return "#Datetime,device,devices,ac power(W),dc power(W),efficiency(%),phase imbalance(%),energy yield(kWh)";
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef FLEET_HPP_INCLUDED
+#define FLEET_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include "channels.hpp"
+
+/* Columns are aligned to a cache line */
+#define FLEET_ALIGNMENT 64
+/* Initial number of rows allocated */
+#define FLEET_INITIAL_ROWS 16
+/* Name of the directory (in the logging directory) for the fleet metrics */
+#define FLEET_DIRECTORY "fleet"
+
+/* Derived metrics, per device */
+#define DERIVED_DC_POWER 0
+#define DERIVED_EFFICIENCY 1
+#define DERIVED_IMBALANCE 2
+#define DERIVED_COUNT 3
+
+using namespace std;
+
+/* Totals across all devices in a sweep */
+struct fleet_totals {
+    int devices;
+    double ac_power;
+    double dc_power;
+    double efficiency;
+    double yield;
+    double max_imbalance;
+};
+
+/* This class holds the values of one sweep as a table of doubles, with one contiguous column
+   per canonical channel and one row per device. Missing values are NaN. The derived metrics are
+   computed by simple loops over whole columns, which the compiler can vectorize */
+class fleet_table
+{
+    public:
+        fleet_table();
+        ~fleet_table();
+        void clear();
+        int add_device(const string &device, const vector <vec_data> &data_vector);
+        void compute();
+        size_t size();
+        const string &device(size_t row);
+        const double *column(int channel);
+        const double *derived(int metric);
+        fleet_totals get_totals();
+        void format(const string &datetime, vector <string> &lines);
+        static string header();
+
+    private:
+        void reserve(size_t capacity);
+
+        double *columns[CHANNEL_COUNT];
+        double *derived_columns[DERIVED_COUNT];
+        vector <string> devices;
+        size_t rows;
+        size_t capacity;
+        fleet_totals totals;
+};
+
+#endif /* FLEET_HPP_INCLUDED */
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <sstream>
+#include "journal.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Standard CRC-32, used to detect a record that was only partly written */
+static uint32_t crc32(const string &data)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < data.size(); i++) {
+        crc ^= (unsigned char) data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/* Sync a file or directory by name */
+static void sync_path(string path)
+{
+    int sync_fd = ::open(path.c_str(), O_RDONLY);
+    if (sync_fd >= 0) {
+        fsync(sync_fd);
+        ::close(sync_fd);
+    }
+}
+
+/* Constructor for the journal class. Nothing is journalled until open() is called */
+journal::journal()
+{
+    this->fd = -1;
+    this->commit_interval = 0;
+    this->last_commit = 0;
+    this->commits = 0;
+}
+
+journal::~journal()
+{
+    close();
+}
+
+/* Open the journal, and recover any rows left in it by a crash or power cut */
+bool journal::open(string path, int commit_interval)
+{
+    this->path = path;
+    this->commit_interval = commit_interval;
+    this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (this->fd < 0) {
+        LOG_ERROR("Could not open the journal: " << path);
+        return false;
+    }
+
+    recover();
+    this->last_commit = now_ms();
+    return true;
+}
+
+/* Commit anything pending, sync the log files and close the journal */
+void journal::close()
+{
+    if (this->fd < 0) return;
+
+    commit();
+    checkpoint();
+    ::close(this->fd);
+    this->fd = -1;
+}
+
+/* Check if rows are being journalled */
+bool journal::is_open()
+{
+    return (this->fd >= 0);
+}
+
+/* Change the time between commits. 0 means once per sweep */
+void journal::set_commit_interval(int commit_interval)
+{
+    this->commit_interval = commit_interval;
+}
+
+/* Add a row. It is not written anywhere until the next commit */
+void journal::append(string directory, string filename, string line, string header, bool log_to_latest)
+{
+    journal_row row = { directory, filename, line, header, log_to_latest };
+    this->pending.push_back(row);
+
+    if ((this->commit_interval > 0) and (now_ms() - this->last_commit >= this->commit_interval)) {
+        commit();
+    }
+}
+
+/* Called at the end of each sweep. Commits if it is time to */
+void journal::sweep_done()
+{
+    if ((this->commit_interval == 0) or (now_ms() - this->last_commit >= this->commit_interval)) {
+        commit();
+    }
+}
+
+/* Write all pending rows to the journal with one write and one sync, then write them to the log files */
+void journal::commit()
+{
+    this->last_commit = now_ms();
+    if ((this->fd < 0) or (this->pending.empty())) return;
+
+    /* Each record is: crc <tab> latest <tab> directory <tab> filename <tab> header <tab> line <newline> */
+    string records;
+    for (auto iter = this->pending.begin(); iter != this->pending.end(); ++iter) {
+        string payload = string(iter->log_to_latest ? "1" : "0") + "\t" + iter->directory + "\t" + iter->filename + "\t" + iter->header + "\t" + iter->line;
+        char crc_text[16];
+        snprintf(crc_text, sizeof(crc_text), "%08x", crc32(payload));
+        records += string(crc_text) + "\t" + payload + "\n";
+    }
+
+    const char *data = records.c_str();
+    size_t remaining = records.size();
+    while (remaining > 0) {
+        ssize_t written = write(this->fd, data, remaining);
+        if (written < 0) {
+            LOG_ERROR("Could not write to the journal: " << this->path);
+            break;
+        }
+        data += written;
+        remaining -= written;
+    }
+    fdatasync(this->fd);
+
+    /* Now it is safe to write the rows where they belong. Rows in a row for the same file go in one append */
+    for (size_t first = 0; first < this->pending.size(); ) {
+        const journal_row &row = this->pending[first];
+        string block = row.line;
+        size_t next = first + 1;
+        while ((next < this->pending.size()) and (this->pending[next].directory == row.directory) and
+               (this->pending[next].filename == row.filename) and (this->pending[next].header == row.header) and
+               (this->pending[next].log_to_latest == row.log_to_latest)) {
+            block += "\n" + this->pending[next].line;
+            next++;
+        }
+
+        log_line(row.directory, row.filename, block, row.header, row.log_to_latest);
+        string directory = row.directory;
+        if (*directory.rbegin() != '/') directory += "/";
+        this->touched.insert(directory + row.filename);
+        if (row.log_to_latest) this->touched.insert(directory + "latest.csv");
+        first = next;
+    }
+    this->pending.clear();
+
+    this->commits++;
+    if (this->commits >= JOURNAL_CHECKPOINT_COMMITS) {
+        checkpoint();
+    }
+}
+
+/* Check that every row that has been added is in the journal (or, if rows aren't journalled, in the log files) */
+bool journal::committed()
+{
+    return (this->fd < 0) or (this->pending.empty());
+}
+
+/* Sync every log file written since the last checkpoint (and their directories, for the 'latest.csv' renames),
+   then empty the journal. After this, the rows in the journal are no longer needed */
+void journal::checkpoint()
+{
+    if (this->fd < 0) return;
+
+    set <string> directories;
+    for (auto iter = this->touched.begin(); iter != this->touched.end(); ++iter) {
+        sync_path(*iter);
+        directories.insert(iter->substr(0, iter->rfind('/') + 1));
+    }
+    for (auto iter = directories.begin(); iter != directories.end(); ++iter) {
+        sync_path(*iter);
+    }
+
+    if (ftruncate(this->fd, 0) != 0) {
+        LOG_ERROR("Could not empty the journal: " << this->path);
+    }
+    fdatasync(this->fd);
+
+    this->touched.clear();
+    this->commits = 0;
+}
+
+/* Replay the journal after a restart. Rows that are already at the end of their log file are skipped */
+bool journal::recover()
+{
+    ifstream reader(this->path.c_str());
+    string record;
+    set <string> repaired;
+    int replayed = 0;
+
+    while (getline(reader, record)) {
+        /* A record that was only partly written fails the CRC (or has no newline, so it is the last one) */
+        if (reader.eof()) break;
+        size_t tab = record.find('\t');
+        if (tab == string::npos) continue;
+        string payload = record.substr(tab + 1);
+        char crc_text[16];
+        snprintf(crc_text, sizeof(crc_text), "%08x", crc32(payload));
+        if (record.substr(0, tab) != crc_text) continue;
+
+        journal_row row;
+        stringstream fields(payload);
+        string latest;
+        getline(fields, latest, '\t');
+        getline(fields, row.directory, '\t');
+        getline(fields, row.filename, '\t');
+        getline(fields, row.header, '\t');
+        getline(fields, row.line);
+        row.log_to_latest = (latest == "1");
+
+        string directory = row.directory;
+        if (*directory.rbegin() != '/') directory += "/";
+        string fullpath = directory + row.filename;
+        string latest_path = directory + "latest.csv";
+
+        /* Remove any partial line left at the end of the files */
+        if (repaired.insert(fullpath).second) repair_partial_line(fullpath);
+        if ((row.log_to_latest) and (repaired.insert(latest_path).second)) repair_partial_line(latest_path);
+
+        if (not file_tail_contains_line(fullpath, row.line)) {
+            log_line(row.directory, row.filename, row.line, row.header, row.log_to_latest);
+            replayed++;
+        }
+        this->touched.insert(fullpath);
+        if (row.log_to_latest) this->touched.insert(latest_path);
+    }
+
+    if (replayed) {
+        LOG_INFO("Recovered " << replayed << " rows from the journal");
+    }
+    checkpoint();
+
+    return true;
+}
+
+/* Monotonic time in milliseconds */
+long long journal::now_ms()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* If a file does not end in a newline, cut it back to the last complete line. Returns true if anything was removed */
+bool repair_partial_line(string path)
+{
+    int repair_fd = ::open(path.c_str(), O_RDWR);
+    if (repair_fd < 0) return false;
+
+    off_t size = lseek(repair_fd, 0, SEEK_END);
+    char last = '\n';
+    if ((size > 0) and (pread(repair_fd, &last, 1, size - 1) != 1)) last = '\n';
+    if (last == '\n') {
+        ::close(repair_fd);
+        return false;
+    }
+
+    /* Search backwards for the last newline */
+    char buffer[4096];
+    off_t end = size;
+    off_t keep = 0;
+    while (end > 0) {
+        off_t start = (end > (off_t) sizeof(buffer)) ? end - sizeof(buffer) : 0;
+        ssize_t length = pread(repair_fd, buffer, end - start, start);
+        if (length <= 0) break;
+        char *newline = (char *) memrchr(buffer, '\n', length);
+        if (newline) {
+            keep = start + (newline - buffer) + 1;
+            break;
+        }
+        end = start;
+    }
+
+    LOG_INFO("Removing a partial line from the end of: " << path);
+    bool result = (ftruncate(repair_fd, keep) == 0);
+    ::close(repair_fd);
+    return result;
+}
+
+/* Check if a line is one of the lines near the end of a file */
+bool file_tail_contains_line(string path, string line)
+{
+    int scan_fd = ::open(path.c_str(), O_RDONLY);
+    if (scan_fd < 0) return false;
+
+    off_t size = lseek(scan_fd, 0, SEEK_END);
+    off_t start = (size > JOURNAL_SCAN_SIZE) ? size - JOURNAL_SCAN_SIZE : 0;
+    string tail(size - start, '\0');
+    ssize_t length = pread(scan_fd, &tail[0], tail.size(), start);
+    ::close(scan_fd);
+    if (length < 0) return false;
+    tail.resize(length);
+
+    /* Make sure the match is a whole line */
+    tail = "\n" + tail;
+    return (tail.find("\n" + line + "\n") != string::npos);
+}
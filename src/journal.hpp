@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef JOURNAL_HPP_INCLUDED
+#define JOURNAL_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <set>
+
+/* Name of the journal file, in the logging directory */
+#define JOURNAL_FILE ".journal"
+/* The log files are synced, and the journal emptied, after this many commits */
+#define JOURNAL_CHECKPOINT_COMMITS 10
+/* How far back from the end of a log file to look for a row that is being recovered */
+#define JOURNAL_SCAN_SIZE 65536
+
+using namespace std;
+
+/* A row waiting to be written to the log files */
+struct journal_row {
+    string directory;
+    string filename;
+    string line;
+    string header;
+    bool log_to_latest;
+};
+
+/* This class is a write-ahead journal for the rows written by 'log_line'. Rows are buffered, and
+   on commit they are written to the journal with a single write and a single sync. Only then are they
+   written to the log files. Every JOURNAL_CHECKPOINT_COMMITS commits, the log files are synced
+   and the journal is emptied. On startup, any rows in the journal that did not make it into the log
+   files are written again, and partial lines at the end of the log files are removed */
+class journal
+{
+    public:
+        journal();
+        ~journal();
+        bool open(string path, int commit_interval);
+        void close();
+        bool is_open();
+        void set_commit_interval(int commit_interval);
+        void append(string directory, string filename, string line, string header, bool log_to_latest);
+        void sweep_done();
+        void commit();
+        bool committed();
+
+    private:
+        bool recover();
+        void checkpoint();
+        long long now_ms();
+
+        int fd;
+        string path;
+        int commit_interval; /* milliseconds between commits. 0 means once per sweep */
+        long long last_commit;
+        int commits;
+        vector <journal_row> pending;
+        set <string> touched;
+};
+
+bool repair_partial_line(string path);
+bool file_tail_contains_line(string path, string line);
+
+#endif /* JOURNAL_HPP_INCLUDED */
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "logger.hpp"
+
+using namespace std;
+
+/* The one and only logger */
+logger g_logger;
+
+/* Constructor for the message buffer. Leave room for nothing else; the length is tracked separately */
+log_message_buf::log_message_buf(char *buffer, size_t size)
+{
+    setp(buffer, buffer + size);
+    this->truncated = false;
+}
+
+/* Number of characters formatted so far */
+size_t log_message_buf::length()
+{
+    return pptr() - pbase();
+}
+
+/* Called when the buffer is full. Drop the character, but report success so the stream stays good. The first
+   time, the end of the message is overwritten with the marker, so that it is clear that it was cut short */
+int log_message_buf::overflow(int c)
+{
+    size_t marker = sizeof(LOG_TRUNCATED_MARKER) - 1;
+    if ((not this->truncated) and (length() >= marker)) {
+        memcpy(pptr() - marker, LOG_TRUNCATED_MARKER, marker);
+        this->truncated = true;
+    }
+    return traits_type::not_eof(c);
+}
+
+/* Constructor for the logger class. The ring is allocated once, here */
+logger::logger()
+{
+    this->ring = new log_entry[LOG_RING_SIZE];
+    this->head = 0;
+    this->tail = 0;
+    this->dropped = 0;
+    this->level = LOG_LEVEL_INFO;
+    this->stream = stdout;
+    this->running = false;
+}
+
+logger::~logger()
+{
+    stop();
+    delete[] this->ring;
+}
+
+/* Start the background drain thread. Until this is called, messages are written synchronously */
+void logger::start()
+{
+    lock_guard<mutex> lock(this->ring_mutex);
+    if (this->running) return;
+    this->running = true;
+    this->drain_thread = thread(&logger::drain, this);
+}
+
+/* Stop the drain thread, after it has written everything in the ring */
+void logger::stop()
+{
+    {
+        lock_guard<mutex> lock(this->ring_mutex);
+        if (not this->running) return;
+        this->running = false;
+    }
+    this->ring_ready.notify_one();
+    this->drain_thread.join();
+}
+
+/* Set the runtime log level */
+void logger::set_level(int level)
+{
+    this->level = level;
+}
+
+/* Check if a level is enabled at runtime */
+bool logger::enabled(int level)
+{
+    return (level <= this->level);
+}
+
+/* Write to another stream, eg; stderr when stdout is used for data. Call this before 'start' */
+void logger::set_stream(FILE *stream)
+{
+    this->stream = stream;
+}
+
+/* Copy a message into the ring. This never blocks on I/O */
+void logger::write(const char *text, size_t length)
+{
+    if (length > LOG_LINE_SIZE) length = LOG_LINE_SIZE;
+
+    unique_lock<mutex> lock(this->ring_mutex);
+    if (not this->running) {
+        /* No drain thread, so write it now */
+        fwrite(text, 1, length, this->stream);
+        fputc('\n', this->stream);
+        return;
+    }
+
+    if (this->head - this->tail >= LOG_RING_SIZE) {
+        this->dropped++;
+        return;
+    }
+
+    log_entry *entry = &this->ring[this->head % LOG_RING_SIZE];
+    memcpy(entry->text, text, length);
+    entry->length = length;
+    this->head++;
+    lock.unlock();
+
+    this->ring_ready.notify_one();
+}
+
+/* Body of the drain thread. Writes out all pending messages, then flushes once per batch */
+void logger::drain()
+{
+    unique_lock<mutex> lock(this->ring_mutex);
+    while (true) {
+        this->ring_ready.wait(lock, [this] { return (this->head != this->tail) or (not this->running); });
+
+        while (this->tail != this->head) {
+            /* The slot cannot be reused until 'tail' moves past it, so it is safe to write it unlocked */
+            log_entry *entry = &this->ring[this->tail % LOG_RING_SIZE];
+            lock.unlock();
+            fwrite(entry->text, 1, entry->length, this->stream);
+            fputc('\n', this->stream);
+            lock.lock();
+            this->tail++;
+        }
+
+        if (this->dropped) {
+            fprintf(this->stream, "Logger dropped %lu messages\n", this->dropped);
+            this->dropped = 0;
+        }
+        fflush(this->stream);
+
+        if (not this->running) break;
+    }
+}
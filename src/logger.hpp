@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LOGGER_HPP_INCLUDED
+#define LOGGER_HPP_INCLUDED
+
+#include <stdio.h>
+#include <string>
+#include <iostream>
+#include <streambuf>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* Log levels. A message is written if its level is <= the runtime level */
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_DEBUG 2
+
+/* Messages above this level are compiled out entirely. Set from CMake */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/* Number of preallocated slots in the ring, and the max length of one message */
+#define LOG_RING_SIZE 1024
+#define LOG_LINE_SIZE 1024
+/* Put at the end of a message that was too long for LOG_LINE_SIZE */
+#define LOG_TRUNCATED_MARKER "..."
+
+using namespace std;
+
+/* One slot in the ring buffer */
+struct log_entry {
+    size_t length;
+    char text[LOG_LINE_SIZE];
+};
+
+/* A stream buffer that formats into a fixed char array. A message that doesn't fit is cut short, and ends with
+   LOG_TRUNCATED_MARKER. This lets the log macros use '<<' without any heap allocation */
+class log_message_buf : public streambuf
+{
+    public:
+        log_message_buf(char *buffer, size_t size);
+        size_t length();
+
+    protected:
+        int overflow(int c);
+
+    private:
+        bool truncated;
+};
+
+/* This class is a leveled logger. Messages are copied into a preallocated ring buffer
+   and written to stdout (or another stream) by a background thread, so the caller never waits on a flush.
+   If the ring is full, messages are dropped (and counted) rather than blocking */
+class logger
+{
+    public:
+        logger();
+        ~logger();
+        void start();
+        void stop();
+        void set_level(int level);
+        void set_stream(FILE *stream);
+        bool enabled(int level);
+        void write(const char *text, size_t length);
+
+    private:
+        void drain();
+
+        log_entry *ring;
+        size_t head;
+        size_t tail;
+        unsigned long dropped;
+        int level;
+        FILE *stream;
+        bool running;
+        thread drain_thread;
+        mutex ring_mutex;
+        condition_variable ring_ready;
+};
+
+extern logger g_logger;
+
+/* Log a message at a given level. Disabled levels cost nothing at compile time,
+   and only an integer compare at runtime */
+#define LOG_AT(log_level, message) \
+    do { \
+        if (((log_level) <= LOG_COMPILE_LEVEL) && g_logger.enabled(log_level)) { \
+            char log_text_[LOG_LINE_SIZE]; \
+            log_message_buf log_buf_(log_text_, sizeof(log_text_)); \
+            ostream log_stream_(&log_buf_); \
+            log_stream_ << message; \
+            g_logger.write(log_text_, log_buf_.length()); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(message) LOG_AT(LOG_LEVEL_ERROR, message)
+#define LOG_INFO(message) LOG_AT(LOG_LEVEL_INFO, message)
+#define LOG_DEBUG(message) LOG_AT(LOG_LEVEL_DEBUG, message)
+
+#endif /* LOGGER_HPP_INCLUDED */
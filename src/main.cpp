@@ -31,41 +31,78 @@ extern "C" {
 
 #include <iostream>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <vector>
 #include <string>
 #include <ctime>
 #include <map>
+#include <set>
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
+#include <chrono>
+#include <thread>
+#include <mutex>
 #include "utils.hpp"
 #include "arguments.hpp"
-
-
-#define DEVICE_MAX 50
+#include "logger.hpp"
+#include "query.hpp"
+#include "polling.hpp"
+#include "reload.hpp"
+#include "journal.hpp"
+#include "channels.hpp"
+#include "fleet.hpp"
+#include "rollup.hpp"
+#include "anomaly.hpp"
+#include "replay.hpp"
+#include "bus.hpp"
+#include "ndjson.hpp"
+#include "spool.hpp"
+#include "realtime.hpp"
+#include "profiler.hpp"
+#include "endpoints.hpp"
+#include "registry.hpp"
+#include "catalog.hpp"
+#include "parameters.hpp"
+#include "memory.hpp"
+#include "watchdog.hpp"
+#include "sitelog.hpp"
+#include "schema.hpp"
+
+
+/* Room for this many device and channel handles at first. There is no limit: the arrays grow when they are full */
+#define DEVICE_HANDLES_INITIAL 50
+#define CHANNEL_HANDLES_INITIAL 500
 #define SIZE_NAME 64
 #define MAXDRIVERS 10
-#define MAX_CHANNEL_COUNT 500
 
 using namespace std;
 
 /* Global variables. */
 int g_debug = DEFAULT_DEBUG_VALUE;
 
-/* This is used by the vector to store all the data that is collected */
-struct vec_data {
-    string name;
-    string name_units;
-    string value;
-};
-
-
 /* function prototypes */
 bool detect_devices( int device_count);
-void record_devices(map <DWORD, string> &device_map, bool discovery);
-bool fetch_dynamic_data(DWORD device_handle, string *header_out, string *data_out, bool discovery, arguments arguments_list);
+void record_devices(device_registry &registry, bool discovery);
+bool load_channels(device_entry &device);
+bool describe_device(device_entry &device, arguments &arguments_list, catalog_device &device_out);
+void apply_catalog(device_registry &registry, channel_catalog &catalog);
+bool device_driver(device_registry &registry, DWORD handle, DWORD *drivers, DWORD driver_count, DWORD *driver);
+bool recover_drivers(device_registry &registry, const DWORD *driver, DWORD *drivers, DWORD driver_count);
+bool fetch_dynamic_data(device_entry &device, string *header_out, string *data_out, vector <vec_data> *vector_out, bool discovery, arguments &arguments_list);
+bool read_channel_value(DWORD channel_handle, DWORD device_handle, arguments &arguments_list, string &value_out);
+void serve_queries(query_server &queries, device_registry &registry, arguments &arguments_list);
+bool read_mode(DWORD device_handle, arguments &arguments_list, string &mode_out);
+string find_mode(vector <vec_data> &data_vector);
+void reload_settings(arguments &arguments_list, polling_policy &policy);
+void write_lines(journal &row_journal, string directory, string filename, vector <string> &lines, string header, bool log_to_latest);
 string list_texts(DWORD channel_handle, string channel_name);
-void process_data(vector <vec_data> data_vector, int debug, string& line, string& header);
+void process_sweep(arguments &arguments_list, journal &row_journal, fleet_table &fleet, anomaly_detector &anomalies, rollup &rollups, time_t start, string datetime);
+int replay_logs(arguments &arguments_list);
+void process_data(const vector <vec_data> &data_vector, int debug, string datetime, string& line, string& header, const device_schema *schema, bool logged);
+void schema_columns(const device_entry &device, arguments &arguments_list, string columns[CHANNEL_COUNT]);
 
 /************************ Functions start ******************************/
 
@@ -74,137 +111,251 @@ bool detect_devices( int device_count)
 {
     int error;
 
-    if (g_debug > 0) {
-        cout << "Trying to detect the following number of devices: " << device_count << endl;
-    }
+    LOG_DEBUG("Trying to detect the following number of devices: " << device_count);
 
-    /* Blocking call to detect devices */
-    error = DoStartDeviceDetection(device_count, TRUE);
+    /* Blocking call to detect devices. It can take minutes, so it is only a stall if it takes much longer than
+       any other call */
+    g_watchdog.pause(WATCHDOG_DETECTION_STALLS * g_watchdog.stall_limit());
+    error = g_bus.detect_devices(device_count, TRUE);
+    g_watchdog.progress();
     switch(error) {
         case YE_OK:
             return true;
 
         case YE_DEV_DETECT_IN_PROGRESS:
-            cout << "Error: Detection in progress" << endl;
+            LOG_ERROR("Error: Detection in progress");
             return false;
 
         case YE_NOT_ALL_DEVS_FOUND:
-            cout << "Error: Not all devices were found" << endl;
+            LOG_ERROR("Error: Not all devices were found");
             return false;
 
         default:
-            cout << "Error: Unknown YASDI error" << endl;
+            LOG_ERROR("Error: Unknown YASDI error");
             return false;
     }
 }
 
 
-/* Record all devices to a vector, and (if discovery or debug is on) print the list of devices */
-void record_devices(map <DWORD, string> &device_map, bool discovery)
+/* Record all devices in the registry, and (if discovery or debug is on) print the list of devices */
+void record_devices(device_registry &registry, bool discovery)
 {
-    DWORD handles_array[DEVICE_MAX], device, count = -1;
+    vector <DWORD> handles(DEVICE_HANDLES_INITIAL);
+    DWORD count = 0;
     char namebuf[SIZE_NAME] = "";
 
-    /* Clear the map */
-    device_map.clear();
+    /* Clear the registry */
+    registry.clear();
 
-    /* get all device handles...*/
-    count   = GetDeviceHandles(handles_array, DEVICE_MAX);
+    /* get all device handles. If they filled the array, there may be more */
+    while ((count = g_bus.device_handles(&handles[0], handles.size())) >= handles.size()) {
+        handles.resize(handles.size() * 2);
+    }
     if (count > 0) {
-        for (device=0; device < count ; device++) {
+        handles.resize(count);
+        sort(handles.begin(), handles.end());
+        registry.reserve(count);
+        for (DWORD device = 0; device < count; device++) {
             /* get the name of this device */
-            GetDeviceName(handles_array[device], namebuf, sizeof(namebuf)-1);
-            if ((g_debug) or (discovery)) cout << "Found device with a handle of : " << handles_array[device] << " and a name of: " << namebuf << "\n" << endl;
+            g_bus.device_name(handles[device], namebuf, sizeof(namebuf)-1);
+            if (discovery) cout << "Found device with a handle of : " << handles[device] << " and a name of: " << namebuf << "\n" << endl;
+            else LOG_DEBUG("Found device with a handle of : " << handles[device] << " and a name of: " << namebuf);
             string device_raw = string(namebuf);
             string device_name = replace_spaces(device_raw);
-            /* Add it to the map */
-            device_map[handles_array[device]] = device_name;
+            /* Add it to the registry */
+            registry.add(handles[device], device_name);
         }
     }
     else {
-        if ((g_debug) or (discovery))cout << "No devices have been found" << endl;
+        if (discovery) cout << "No devices have been found" << endl;
+        else LOG_DEBUG("No devices have been found");
     }
 }
 
 
-/* This function will retrieve the channel and header data as a comma separated list
-   If 'discovery' or 'debug' is listed as true, it will also print the values
-   */
-bool fetch_dynamic_data(DWORD device_handle, string *header_out, string *data_out, bool discovery, arguments arguments_list)
+/* Ask the library for the spot channels of a device, with their names and units. This is only done the first
+   time a device is read, since they don't change */
+bool load_channels(device_entry &device)
 {
-    DWORD channel_array[MAX_CHANNEL_COUNT];
-    int channel_count = -1;
+    vector <DWORD> handles(CHANNEL_HANDLES_INITIAL);
+    DWORD count = 0;
     char channel_name[SIZE_NAME];
     char channel_units[SIZE_NAME];
-    char channel_value[SIZE_NAME];
-    string header_entry;
-    int result;
-    string channel_value_str;
-    double double_val = 0;
-    vector <vec_data> data_vector;
-    /* maximum age of the channel value in seconds. If the age of the data (as determined by the SMA inverter) is greater than this, then
-       query the inverter to get the lastest data. If it can't log a line, it returns a FALSE */
-    DWORD max_age = 5;
 
-    channel_count = GetChannelHandlesEx(device_handle, channel_array, MAX_CHANNEL_COUNT, SPOTCHANNELS);
-    if (channel_count < 1) {
-        if (g_debug) cout << "Could not get the channel count" << endl;
+    while ((count = g_bus.channel_handles(device.handle, &handles[0], handles.size(), SPOTCHANNELS)) >= handles.size()) {
+        handles.resize(handles.size() * 2);
+    }
+    if (count < 1) {
+        LOG_DEBUG("Could not get the channel count");
         return false;
     }
 
-    /* Print each of the channel values */
-    for(int i = 0; i < channel_count; i++) {
-        vec_data vec_data_temp = { { 0 } };
-        channel_value_str = "";
-        string unit_str;
-        string name_str;
-
-        result = GetChannelName(channel_array[i], channel_name, sizeof(channel_name)-1);
-        if(result == YE_OK) {
-            /* also get the units of the readings type ..eg; kWh, V, etc */
-            GetChannelUnit(channel_array[i], channel_units, sizeof(channel_units)-1);
-            unit_str = channel_units;
-            name_str = channel_name;
-            if (arguments_list.convert.find(name_str) != arguments_list.convert.end()) {
-                name_str = arguments_list.convert[name_str];
+    device.channels.clear();
+    device.channels.reserve(count);
+    for (DWORD i = 0; i < count; i++) {
+        if (g_bus.channel_name(handles[i], channel_name, sizeof(channel_name)-1) != YE_OK) {
+            /* If a channel's name cannot be read, then leave it out */
+            LOG_DEBUG("Error reading the name of channel: " << handles[i]);
+            continue;
+        }
+        /* also get the units of the readings type ..eg; kWh, V, etc */
+        channel_units[0] = '\0';
+        g_bus.channel_unit(handles[i], channel_units, sizeof(channel_units)-1);
+
+        channel_entry channel = { handles[i], channel_name, channel_units };
+        device.channels.push_back(channel);
+    }
+    device.channels_known = true;
+    device.schema = NULL;
+    return true;
+}
+
+
+/* Describe a device and all of its spot and parameter channels for the catalog. Apart from the spot values,
+   the library answers these from the channel list it read when the device was found */
+bool describe_device(device_entry &device, arguments &arguments_list, catalog_device &device_out)
+{
+    char text[SIZE_NAME];
+
+    device_out.name = device.name;
+    device_out.serial = 0;
+    g_bus.device_serial(device.handle, &device_out.serial);
+    text[0] = '\0';
+    g_bus.device_type(device.handle, text, sizeof(text)-1);
+    device_out.type = text;
+    device_out.channels.clear();
+
+    TChanType types[] = { SPOTCHANNELS, PARAMCHANNELS };
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        vector <DWORD> handles(CHANNEL_HANDLES_INITIAL);
+        DWORD count = 0;
+        while ((count = g_bus.channel_handles(device.handle, &handles[0], handles.size(), types[t])) >= handles.size()) {
+            handles.resize(handles.size() * 2);
+        }
+
+        for (DWORD i = 0; i < count; i++) {
+            catalog_channel channel;
+            if (g_bus.channel_name(handles[i], text, sizeof(text)-1) != YE_OK) {
+                LOG_DEBUG("Error reading the name of channel: " << handles[i]);
+                continue;
+            }
+            channel.name = text;
+            channel.kind = (types[t] == SPOTCHANNELS) ? CATALOG_SPOT : CATALOG_PARAMETER;
+            text[0] = '\0';
+            g_bus.channel_unit(handles[i], text, sizeof(text)-1);
+            channel.units = text;
+            channel.min = 0;
+            channel.max = 0;
+            channel.has_range = (g_bus.channel_range(handles[i], &channel.min, &channel.max) == YE_OK);
+            BYTE rights = 0;
+            channel.access = (g_bus.channel_access(handles[i], &rights) == YE_OK) ? rights : -1;
+
+            int text_count = g_bus.stat_text_count(handles[i]);
+            for (int j = 0; j < text_count; j++) {
+                text[0] = '\0';
+                g_bus.stat_text(handles[i], j, text, sizeof(text)-1);
+                channel.texts.push_back(text);
             }
 
+            /* Only the spot channels are read. Reading every parameter would take much longer, and tell little */
+            if (types[t] == SPOTCHANNELS) {
+                read_channel_value(handles[i], device.handle, arguments_list, channel.value);
+            }
+            device_out.channels.push_back(channel);
         }
-        else {
-            /* If a channel cannot be read, then continue */
-            if (g_debug) cout << "Error reading channel value for channel: " << channel_name << endl;
+    }
+
+    return (not device_out.channels.empty());
+}
+
+
+/* Take the spot channels of each device from the catalog, instead of asking the library for every channel's name
+   and units. Channel handles only last for a session, so each one is looked up by name. A device that isn't in
+   the catalog, or whose channels have changed, has its channels asked for as usual */
+void apply_catalog(device_registry &registry, channel_catalog &catalog)
+{
+    for (size_t i = 0; i < registry.size(); i++) {
+        device_entry &device = registry[i];
+        catalog_device described;
+        if (not catalog.find(device.name, described)) {
+            LOG_INFO("Device " << device.name << " is not in the catalog");
             continue;
         }
 
-        /* And get the channel value. If a channel cannot be read, then exit */
-        result = GetChannelValue(channel_array[i], device_handle, &double_val, channel_value, sizeof(channel_value)-1, max_age);
-        if(result == YE_OK) {
-            /* Convert the value to a string. Do not use 'to_string'. Does not work well at all */
-            channel_value_str = channel_value;
-            if (channel_value_str.empty()) {
-                channel_value_str = convert_double(double_val);
-            }
-            else {
-                if (arguments_list.convert.find(channel_value_str) != arguments_list.convert.end()) {
-                    channel_value_str = arguments_list.convert[channel_value_str];
-                }
-            }
+        vector <channel_entry> channels;
+        for (size_t j = 0; j < described.channels.size(); j++) {
+            const catalog_channel &catalogued = described.channels[j];
+            if (catalogued.kind != CATALOG_SPOT) continue;
+
+            /* FindChannelName takes a non-const buffer */
+            char name_buffer[SIZE_NAME] = "";
+            strncpy(name_buffer, catalogued.name.c_str(), sizeof(name_buffer)-1);
+            DWORD handle = g_bus.find_channel(device.handle, name_buffer);
+            if (handle == INVALID_HANDLE) break;
+            channel_entry channel = { handle, catalogued.name, catalogued.units };
+            channels.push_back(channel);
         }
-        else {
-            if (g_debug) cout << "Error reading channel value for channel: " << channel_name << endl;
+
+        if ((channels.empty()) or (channels.size() != (size_t) count_if(described.channels.begin(), described.channels.end(),
+                [](const catalog_channel &channel) { return channel.kind == CATALOG_SPOT; }))) {
+            LOG_INFO("The channels of device " << device.name << " don't match the catalog");
             continue;
         }
+        device.channels.swap(channels);
+        device.channels_known = true;
+        device.schema = NULL;
+    }
+}
 
 
-        vec_data_temp.name = name_str;
-        vec_data_temp.name_units = name_str + "(" + unit_str + ")";
-        vec_data_temp.value = channel_value_str;
-        data_vector.push_back(vec_data_temp);
+/* This function will retrieve the channel and header data as a comma separated list
+   If 'discovery' or 'debug' is listed as true, it will also print the values
+   The individual channel values are returned in 'vector_out'. Its entries are reused from one sweep to the next
+   (pass the same vector for the same device), so once it has grown to the device's channels, strings that are no
+   longer than before are written over rather than allocated again
+   */
+bool fetch_dynamic_data(device_entry &device, string *header_out, string *data_out, vector <vec_data> *vector_out, bool discovery, arguments &arguments_list)
+{
+    string header_entry;
+    string channel_value_str;
+    vector <vec_data> &data_vector = *vector_out;
+    size_t used = 0;
+
+    if ((not device.channels_known) and (not load_channels(device))) {
+        data_vector.clear();
+        return false;
+    }
+
+    /* Print each of the channel values */
+    data_vector.reserve(device.channels.size());
+    for (size_t i = 0; i < device.channels.size(); i++) {
+        const channel_entry &channel = device.channels[i];
+
+        /* Skip channels that have not been selected in the settings file. This costs nothing on the bus */
+        if (not arguments_list.channel_selected(channel.name)) continue;
+
+        /* And get the channel value. If a channel cannot be read, then exit */
+        if (not read_channel_value(channel.handle, device.handle, arguments_list, channel_value_str)) {
+            LOG_DEBUG("Error reading channel value for channel: " << channel.name);
+            continue;
+        }
+
+        map <string, string>::const_iterator converted = arguments_list.convert.find(channel.name);
+        const string &name_str = (converted != arguments_list.convert.end()) ? converted->second : channel.name;
+
+        if (used == data_vector.size()) data_vector.push_back(vec_data());
+        vec_data &entry = data_vector[used++];
+        entry.name.assign(name_str);
+        entry.name_units.assign(name_str).append("(").append(channel.units).append(")");
+        entry.value.assign(channel_value_str);
+        entry.channel.assign(channel.name);
+        entry.units.assign(channel.units);
 
         if (discovery) {
-            list_texts(channel_array[i], header_entry);
+            list_texts(channel.handle, header_entry);
         }
     }
+    data_vector.resize(used);
 
     if (discovery) {
         for (auto iter = data_vector.begin(); iter != data_vector.end(); ++iter) {
@@ -217,10 +368,10 @@ bool fetch_dynamic_data(DWORD device_handle, string *header_out, string *data_ou
 
     string data_line = "";
     string header_line = "";
-    process_data(data_vector, g_debug, data_line, header_line);
+    process_data(data_vector, g_debug, get_current_datetime(), data_line, header_line, device.schema, false);
 
-    *header_out = header_line;
-    *data_out = data_line;
+    header_out->swap(header_line);
+    data_out->swap(data_line);
 
     ////*************************************************************************
     ////*********************	int i = 0;
@@ -247,17 +398,289 @@ bool fetch_dynamic_data(DWORD device_handle, string *header_out, string *data_ou
 }
 
 
+/* Read a single channel value, and convert it to a string. Status texts are converted via the 'convert' map */
+bool read_channel_value(DWORD channel_handle, DWORD device_handle, arguments &arguments_list, string &value_out)
+{
+    char channel_value[SIZE_NAME] = "";
+    double double_val = 0;
+    /* maximum age of the channel value in seconds. If the age of the data (as determined by the SMA inverter) is greater than this, then
+       query the inverter to get the lastest data. If it can't log a line, it returns a FALSE */
+    DWORD max_age = 5;
+
+    int result = g_bus.channel_value(channel_handle, device_handle, &double_val, channel_value, sizeof(channel_value)-1, max_age);
+    g_watchdog.progress();
+    if (result != YE_OK) {
+        return false;
+    }
+
+    /* Convert the value to a string. Do not use 'to_string'. Does not work well at all */
+    value_out = channel_value;
+    if (value_out.empty()) {
+        value_out = convert_double(double_val);
+    }
+    else {
+        map <string, string>::const_iterator converted = arguments_list.convert.find(value_out);
+        if (converted != arguments_list.convert.end()) {
+            value_out = converted->second;
+        }
+    }
+
+    return true;
+}
+
+
+/* Read any values that have been asked for on the query socket, and are not fresh in the cache.
+   This is called between scheduled reads, so queries go onto the bus ahead of the rest of the sweep */
+void serve_queries(query_server &queries, device_registry &registry, arguments &arguments_list)
+{
+    string device_name, channel_name;
+
+    while (queries.next_request(device_name, channel_name)) {
+        device_entry *device = registry.find(device_name);
+        if (!device) {
+            queries.fail(device_name, channel_name, "unknown device");
+            continue;
+        }
+        DWORD device_handle = device->handle;
+
+        /* FindChannelName takes a non-const buffer */
+        char name_buffer[SIZE_NAME] = "";
+        strncpy(name_buffer, channel_name.c_str(), sizeof(name_buffer)-1);
+        DWORD channel_handle = g_bus.find_channel(device_handle, name_buffer);
+        if (channel_handle == INVALID_HANDLE) {
+            queries.fail(device_name, channel_name, "unknown channel");
+            continue;
+        }
+
+        char channel_units[SIZE_NAME] = "";
+        string value;
+        g_bus.channel_unit(channel_handle, channel_units, sizeof(channel_units)-1);
+        if (read_channel_value(channel_handle, device_handle, arguments_list, value)) {
+            LOG_DEBUG("Query read " << device_name << " " << channel_name << ": " << value);
+            queries.update(device_name, channel_name, value, channel_units);
+        }
+        else {
+            queries.fail(device_name, channel_name, "could not read channel");
+        }
+    }
+}
+
+
+/* Read only the mode channel of a device. This is the cheap liveness check used for sleeping devices */
+bool read_mode(DWORD device_handle, arguments &arguments_list, string &mode_out)
+{
+    /* Newer inverters call it 'Mode', older ones 'Status'. FindChannelName takes a non-const buffer */
+    char mode_name[] = "Mode";
+    char status_name[] = "Status";
+
+    DWORD channel_handle = g_bus.find_channel(device_handle, mode_name);
+    if (channel_handle == INVALID_HANDLE) {
+        channel_handle = g_bus.find_channel(device_handle, status_name);
+    }
+    if (channel_handle == INVALID_HANDLE) {
+        return false;
+    }
+
+    return read_channel_value(channel_handle, device_handle, arguments_list, mode_out);
+}
+
+
+/* Find the (converted) value of the mode channel in a set of channel values. Returns empty if there is none */
+string find_mode(vector <vec_data> &data_vector)
+{
+    for (auto iter = data_vector.begin(); iter != data_vector.end(); ++iter) {
+        if ((iter->channel == "Mode") or (iter->channel == "Status")) {
+            return iter->value;
+        }
+    }
+
+    return "";
+}
+
+
+/* Reload the settings file. This is only called between sweeps, so a sweep never sees a mix of old and new settings.
+   The YASDI session and the device handles are left alone */
+void reload_settings(arguments &arguments_list, polling_policy &policy)
+{
+    arguments reloaded = arguments_list;
+
+    if (not reloaded.load_settings()) {
+        LOG_ERROR("Could not reload the settings file. Keeping the current settings");
+        return;
+    }
+    /* The journal, the spool, the schemas and the rest were opened in the logging directory at startup */
+    if (not same_directory(reloaded.get_log_directory(), arguments_list.get_log_directory())) {
+        LOG_ERROR("The logging directory can't be changed while running. Restart the service to use: " << reloaded.get_log_directory() << ". Keeping the current settings");
+        return;
+    }
+    if (not create_directory(reloaded.get_log_directory())) {
+        LOG_ERROR("Could not create the logging directory: " << reloaded.get_log_directory() << ". Keeping the current settings");
+        return;
+    }
+
+    arguments_list = reloaded;
+    g_debug = arguments_list.get_debug();
+    g_logger.set_level(g_debug ? LOG_LEVEL_DEBUG : LOG_LEVEL_INFO);
+    policy.initialize(arguments_list.get_backoff(), arguments_list.get_delay());
+    LOG_INFO("Reloaded settings from: " << arguments_list.get_settings_file());
+}
+
+
+/* Log a set of lines to one file. With a journal, each line goes through the journal. Otherwise they are written with a single append */
+void write_lines(journal &row_journal, string directory, string filename, vector <string> &lines, string header, bool log_to_latest)
+{
+    if (lines.empty()) return;
+
+    if (row_journal.is_open()) {
+        for (auto iter = lines.begin(); iter != lines.end(); ++iter) {
+            row_journal.append(directory, filename, *iter, header, log_to_latest);
+        }
+        return;
+    }
+
+    string block = lines[0];
+    for (size_t i = 1; i < lines.size(); i++) {
+        block += "\n" + lines[i];
+    }
+    log_line(directory, filename, block, header, log_to_latest);
+}
+
+
+/* The stages that work on a whole sweep, after every device has been read: fleet metrics, anomalies and rollups.
+   'start' is when the sweep started. The rollup state is not checkpointed here */
+void process_sweep(arguments &arguments_list, journal &row_journal, fleet_table &fleet, anomaly_detector &anomalies, rollup &rollups, time_t start, string datetime)
+{
+    string current_date = get_date(start);
+
+    /* Derived metrics across the whole fleet */
+    if ((arguments_list.get_fleet_metrics()) and (fleet.size() > 0)) {
+        vector <string> lines;
+        fleet.compute();
+        fleet.format(datetime, lines);
+        string fleet_dir = arguments_list.get_log_directory() + "/" + FLEET_DIRECTORY;
+        write_lines(row_journal, fleet_dir, current_date + ".csv", lines, fleet_table::header(), false);
+    }
+
+    /* Devices that diverge from the rest of the fleet */
+    if ((arguments_list.get_anomalies()) and (fleet.size() > 0)) {
+        vector <string> events;
+        anomalies.process(fleet, datetime, events);
+        if (not events.empty()) {
+            string anomaly_dir = arguments_list.get_log_directory() + "/" + ANOMALY_DIRECTORY;
+            write_lines(row_journal, anomaly_dir, current_date + ".csv", events, anomaly_detector::header(), false);
+        }
+    }
+
+    /* Rollups. Lines are only made for the intervals that ended with this sweep */
+    if (arguments_list.get_rollups()) {
+        map <string, vector <string> > files;
+        rollups.process(fleet, start, files);
+        for (auto iter = files.begin(); iter != files.end(); ++iter) {
+            size_t slash = iter->first.rfind('/');
+            string rollup_dir = arguments_list.get_log_directory() + "/" + iter->first.substr(0, slash);
+            write_lines(row_journal, rollup_dir, iter->first.substr(slash + 1), iter->second, rollup::header(), false);
+        }
+    }
+}
+
+
+/* Feed the device logs in the replay directory through the same processing and logging as the bus readings,
+   as fast as possible or at a multiple of real time. The bus is not used */
+int replay_logs(arguments &arguments_list)
+{
+    replay_source source;
+    journal row_journal;
+    fleet_table fleet;
+    rollup rollups;
+    anomaly_detector anomalies;
+    ndjson_output records;
+    upload_spool spool;
+    vector <replay_row> rows;
+    long sweeps = 0, lines = 0;
+    time_t previous = 0;
+
+    if (not source.open(arguments_list.get_replay_directory())) {
+        cout << "No device logs found to replay in: " << arguments_list.get_replay_directory() << endl;
+        return 1;
+    }
+
+    /* Journal rows before logging them, as for the bus readings */
+    if (arguments_list.get_journal_interval() >= 0) {
+        row_journal.open(arguments_list.get_log_directory() + "/" + JOURNAL_FILE, arguments_list.get_journal_interval());
+    }
+    rollups.initialize(arguments_list.get_log_directory());
+    if (not arguments_list.get_ndjson_target().empty()) {
+        records.open(arguments_list.get_ndjson_target());
+    }
+    if (not arguments_list.get_upload_url().empty()) {
+        spool.start(arguments_list.get_log_directory(), arguments_list.get_upload_url(), arguments_list.get_upload_rate());
+    }
+
+    /* The logs have the converted channel names. The records are keyed by the raw SMA names, as they are when
+       polling, so the names are converted back */
+    map <string, string> raw_names;
+    for (auto iter = arguments_list.convert.begin(); iter != arguments_list.convert.end(); ++iter) {
+        raw_names[iter->second] = iter->first;
+    }
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    while (source.next_sweep(arguments_list.get_delay(), rows)) {
+        /* Keep the original gaps between sweeps, sped up */
+        if ((arguments_list.get_replay_speed() > 0) and (previous != 0) and (rows[0].when > previous)) {
+            this_thread::sleep_for(chrono::duration<double>((rows[0].when - previous) / arguments_list.get_replay_speed()));
+        }
+        previous = rows[0].when;
+
+        fleet.clear();
+        for (auto iter = rows.begin(); iter != rows.end(); ++iter) {
+            for (auto entry = iter->data.begin(); entry != iter->data.end(); ++entry) {
+                map <string, string>::iterator raw = raw_names.find(entry->name);
+                if (raw != raw_names.end()) entry->channel = raw->second;
+            }
+
+            string data, header;
+            process_data(iter->data, g_debug, get_datetime(iter->when), data, header, NULL, true);
+            if (data.empty()) continue;
+
+            vector <string> device_lines(1, data);
+            string full_dir = arguments_list.get_log_directory() + "/" + iter->device;
+            write_lines(row_journal, full_dir, get_date(iter->when) + ".csv", device_lines, header, true);
+            fleet.add_device(iter->device, iter->data);
+            records.emit(iter->device, iter->when, iter->data);
+            spool.append(iter->device, iter->when, iter->data);
+            lines++;
+        }
+
+        process_sweep(arguments_list, row_journal, fleet, anomalies, rollups, rows[0].when, get_datetime(rows[0].when));
+        row_journal.sweep_done();
+        spool.sweep_done();
+        sweeps++;
+    }
+
+    row_journal.close();
+    if (arguments_list.get_rollups()) rollups.checkpoint();
+    spool.stop();
+
+    /* With "-o -", cout goes to stderr (see main) */
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    cout << "Replayed " << lines << " lines in " << sweeps << " sweeps from " << source.get_devices() << " devices in " << seconds << " seconds";
+    if (seconds > 0) cout << " (" << (long) (lines / seconds) << " lines per second)";
+    cout << endl;
+    return 0;
+}
+
+
 /* This function will get all status texts associated with a channel. It is used for data discovery */
 string list_texts(DWORD channel_handle, string channel_name)
 {
     int i;
-    int text_count = GetChannelStatTextCnt(channel_handle);
+    int text_count = g_bus.stat_text_count(channel_handle);
     string output;
     if (text_count) {
         cout << "Channel name has the following text options (these names are raw from the SMA device): " << endl;
         for(i=0; i < text_count; i++) {
             char stat_text[SIZE_NAME];
-            GetChannelStatText(channel_handle, i, stat_text, sizeof(stat_text)-1);
+            g_bus.stat_text(channel_handle, i, stat_text, sizeof(stat_text)-1);
             cout << "\tChannel name: " << channel_name << " has the text: " << stat_text << "\n";
         }
     }
@@ -267,8 +690,11 @@ string list_texts(DWORD channel_handle, string channel_name)
 
 
 
-/* This function processes the data that is in a vector of structs */
-void process_data(vector <vec_data> data_vector, int debug, string& line, string& header)
+/* This function processes the data that is in a vector of structs. The line and header are only made once all of the
+   channels have been picked out. If there are no channels, they are left as they are. With a 'schema', the header
+   is the schema's, and a channel of the schema that wasn't read is a null of its type. 'logged' values were read
+   back from the logs (see replay_logs), so they have already been converted */
+void process_data(const vector <vec_data> &data_vector, int debug, string datetime, string& line, string& header, const device_schema *schema, bool logged)
 {
     string pac_header, yield_header, pdc1_header, pdc2_header, vdc1_header, vdc2_header, vac1_header, vac2_header, vac3_header, iac1_header, iac2_header, iac3_header, idc1_header, idc2_header;
     string pac1_header, pac2_header, pac3_header, gridfreq_header, cosphi_header, mode_header, error_header, op_hours_header, isol_header;
@@ -307,9 +733,9 @@ void process_data(vector <vec_data> data_vector, int debug, string& line, string
 
 
     for (auto iter = data_vector.begin(); iter != data_vector.end(); ++iter) {
-        string value = iter->value;
-        string name_units = iter->name_units;
-        string name = iter->name;
+        const string &value = iter->value;
+        const string &name_units = iter->name_units;
+        const string &name = iter->name;
 
         if ((name == "A.Ms.Amp") or (name == "pv panels current")) {
             idc1_header = name_units;
@@ -424,6 +850,7 @@ void process_data(vector <vec_data> data_vector, int debug, string& line, string
         if ((name == "isol-resist")) {
             isol_header = name_units;
             isol_str = value;
+            if (logged) continue;
 
             // Convert "isol_str" to a float
             size_t idx;
@@ -432,32 +859,44 @@ void process_data(vector <vec_data> data_vector, int debug, string& line, string
                 resist = stof(isol_str, &idx);
             }
             catch ( const std::exception& e ) {
-                cout << "Could not convert isol_str value to a float: " << isol_str << endl;
+                LOG_ERROR("Could not convert isol_str value to a float: " << isol_str);
             }
             resist = resist/1000;
             stringstream stream;
             stream << fixed << setprecision(2) << resist;
             isol_str = stream.str();
         }
+    }
 
+    if (data_vector.empty()) return;
 
-        string datetime = get_current_datetime();
-        header = "#Datetime," + pac_header + "," + yield_header + "," + pdc1_header  + "," + pdc2_header + "," + vdc1_header + "," +
-            vdc2_header + "," + vac1_header + "," + vac2_header + "," + vac3_header + "," + iac1_header + "," + iac2_header + "," + iac3_header + "," +
-            idc1_header + "," + idc2_header + "," + pac1_header + "," + pac2_header + "," + pac3_header + "," + gridfreq_header + "," + cosphi_header + "," + 
-            mode_header + "," + error_header + "," + op_hours_header + "," + isol_header;
+    if (schema) {
+        /* In the same order as the canonical channels */
+        string *values[CHANNEL_COUNT] = { &pac_str, &yield_str, &pdc1_str, &pdc2_str, &vdc1_str, &vdc2_str, &vac1_str, &vac2_str,
+            &vac3_str, &iac1_str, &iac2_str, &iac3_str, &idc1_str, &idc2_str, &pac1_str, &pac2_str, &pac3_str, &gridfreq_str,
+            &cosphi_str, &mode_str, &error_str, &op_hours_str, &isol_str };
+        for (int i = 0; i < CHANNEL_COUNT; i++) {
+            if (schema->columns[i].empty()) values[i]->clear();
+            else if (values[i]->empty()) *values[i] = schema_null(i);
+        }
+    }
 
-        line = datetime + "," + pac_str + "," + yield_str + "," + pdc1_str + "," + pdc2_str + "," + vdc1_str + "," + vdc2_str + "," +
-            vac1_str + "," + vac2_str + "," + vac3_str + "," + iac1_str + "," + iac2_str + "," + iac3_str + "," +
-            idc1_str + "," + idc2_str + "," + pac1_str + "," + pac2_str + "," + pac3_str + "," + gridfreq_str + "," + cosphi_str + "," + mode_str + "," + 
-            error_str + "," + op_hours_str + "," + isol_str;
+    if (schema) header = schema->header;
+    else header = "#Datetime," + pac_header + "," + yield_header + "," + pdc1_header  + "," + pdc2_header + "," + vdc1_header + "," +
+        vdc2_header + "," + vac1_header + "," + vac2_header + "," + vac3_header + "," + iac1_header + "," + iac2_header + "," + iac3_header + "," +
+        idc1_header + "," + idc2_header + "," + pac1_header + "," + pac2_header + "," + pac3_header + "," + gridfreq_header + "," + cosphi_header + "," + 
+        mode_header + "," + error_header + "," + op_hours_header + "," + isol_header;
 
+    line = datetime + "," + pac_str + "," + yield_str + "," + pdc1_str + "," + pdc2_str + "," + vdc1_str + "," + vdc2_str + "," +
+        vac1_str + "," + vac2_str + "," + vac3_str + "," + iac1_str + "," + iac2_str + "," + iac3_str + "," +
+        idc1_str + "," + idc2_str + "," + pac1_str + "," + pac2_str + "," + pac3_str + "," + gridfreq_str + "," + cosphi_str + "," + mode_str + "," + 
+        error_str + "," + op_hours_str + "," + isol_str;
+    if (schema) line += "," + to_string(schema->version);
 
-        if (debug >= 1) {
-            cout << "Header: " << header << endl;
-            cout << "Line: " << line << endl;
-        }
 
+    if (debug >= 1) {
+        LOG_DEBUG("Header: " << header);
+        LOG_DEBUG("Line: " << line);
     }
 
     return;
@@ -466,6 +905,71 @@ void process_data(vector <vec_data> data_vector, int debug, string& line, string
 
 
 
+/* The columns of a device's fixed schema: each canonical channel that the device has (and that is selected),
+   named as 'fetch_dynamic_data' names it, whether or not it can be read */
+void schema_columns(const device_entry &device, arguments &arguments_list, string columns[CHANNEL_COUNT])
+{
+    for (size_t i = 0; i < device.channels.size(); i++) {
+        const channel_entry &channel = device.channels[i];
+        if (not arguments_list.channel_selected(channel.name)) continue;
+
+        map <string, string>::const_iterator converted = arguments_list.convert.find(channel.name);
+        const string &name = (converted != arguments_list.convert.end()) ? converted->second : channel.name;
+        int canonical = find_canonical_channel(name);
+        if (canonical >= 0) columns[canonical] = name + "(" + channel.units + ")";
+    }
+}
+
+
+/* Get the driver that a device is on. With one driver, that is the one. Otherwise the library is asked for the
+   route to the device, which it only has once the device has answered, and the answer is kept. Returns false if
+   it isn't known */
+bool device_driver(device_registry &registry, DWORD handle, DWORD *drivers, DWORD driver_count, DWORD *driver)
+{
+    if (driver_count == 1) {
+        *driver = drivers[0];
+        return true;
+    }
+
+    device_entry *entry = registry.find(handle);
+    if (!entry) return false;
+    if (not entry->driver_known) {
+        DWORD peer = 0;
+        entry->driver_known = g_bus.device_endpoint(handle, &entry->driver, &peer);
+    }
+    *driver = entry->driver;
+    return entry->driver_known;
+}
+
+/* Recover a driver on which no device has answered for a while (eg; the USB to RS485 converter dropped off and
+   came back). It (or every driver, if 'driver' is NULL) is switched offline and back online, which opens the port
+   again. The library keeps its devices while that is done, so they don't have to be detected again. Returns false
+   if they are gone all the same */
+bool recover_drivers(device_registry &registry, const DWORD *driver, DWORD *drivers, DWORD driver_count)
+{
+    set <DWORD> affected;
+    if (driver) affected.insert(*driver);
+    else affected.insert(drivers, drivers + driver_count);
+
+    for (auto iter = affected.begin(); iter != affected.end(); ++iter) {
+        char name[SIZE_NAME] = "";
+        g_bus.driver_name(*iter, name, sizeof(name) - 1);
+        g_bus.driver_offline(*iter);
+        bool online = g_bus.driver_online(*iter);
+        g_watchdog.progress();
+        if (online) LOG_INFO("Switched driver " << name << " offline and back online");
+        else LOG_ERROR("Driver " << name << " could not be switched back online");
+    }
+
+    /* The devices that were known before must still be known to the library */
+    for (size_t i = 0; i < registry.size(); i++) {
+        char name[SIZE_NAME] = "";
+        if (g_bus.device_name(registry[i].handle, name, sizeof(name) - 1) != YE_OK) return false;
+    }
+    return true;
+}
+
+
 /************************ Functions end ******************************/
 
 
@@ -477,7 +981,67 @@ int main(int argc, char *argv[])
     char DriverName[SIZE_NAME];
     bool any_driver = false;
     DWORD Driver[MAXDRIVERS];
-    map <DWORD, string> device_map;
+    device_registry registry;
+    query_server queries;
+    polling_policy policy;
+    settings_watcher watcher;
+    journal row_journal;
+    fleet_table fleet;
+    rollup rollups;
+    anomaly_detector anomalies;
+    ndjson_output records;
+    upload_spool spool;
+    bus_thread bus_io;
+    bus_profiler profiler;
+    endpoint_table endpoints;
+    map <DWORD, string> driver_names;
+    channel_catalog catalog;
+    parameter_audit audit;
+    memory_monitor memory;
+    site_log site;
+    schema_store schemas;
+
+    /* This class object defines the initial configuration parameters */
+    arguments arguments_list;
+    result = arguments_list.initialize(argc, argv);
+    if (result != 0) {
+        cerr << "Incorrect arguments" << endl;
+        return 3;
+    }
+
+    /* set the global debug value. this only changes if the settings file is reloaded */
+    g_debug = arguments_list.get_debug();
+
+    /* Logging goes to stderr when stdout carries the NDJSON records, and so does anything printed to the console
+       (eg; the reason for exiting early). The records are written straight to the file descriptor, not to cout */
+    if (arguments_list.get_ndjson_target() == "-") {
+        g_logger.set_stream(stderr);
+        cout.rdbuf(cerr.rdbuf());
+    }
+
+    /* A replay only reads and writes log files, so it doesn't need root, and can run alongside the service */
+    if (not arguments_list.get_replay_directory().empty()) {
+        g_logger.start();
+        result = replay_logs(arguments_list);
+        g_logger.stop();
+        return result;
+    }
+
+    /* Discovery carries on from the devices already in the catalog. Polling takes the channels from it */
+    string catalog_file = arguments_list.get_catalog_file();
+    if (not catalog_file.empty()) {
+        bool loaded = catalog.load(catalog_file);
+        if (arguments_list.get_discovery()) {
+            if (loaded) cout << "Carrying on from the catalog: " << catalog.size() << " devices are already in it" << endl;
+        }
+        else if (not loaded) {
+            cout << "Could not read the catalog file: " << catalog_file << endl;
+            return 4;
+        }
+    }
+
+    /* Set up the allocator for a memory budget before any threads are started */
+    memory.initialize(arguments_list.get_memory_budget());
 
     /* If not run as root, exit */
     if (check_root() == false) {
@@ -490,31 +1054,47 @@ int main(int argc, char *argv[])
         return 2;
     }
 
-    /* This class object defines the initial configuration parameters */
-    arguments arguments_list;
-    result = arguments_list.initialize(argc, argv);
-    if (result != 0) {
-        cerr << "Incorrect arguments" << endl;
-        return 3;
+    /* Discovery prints straight to the console, so only run the logger in the background when polling */
+    if (not arguments_list.get_discovery()) {
+        g_logger.start();
     }
 
-    /* set the global debug value. this won't change during runtime */
-    g_debug = arguments_list.get_debug();
+    /* Record every call to the library, or answer them from a recording */
+    if (not arguments_list.get_capture_file().empty()) {
+        if (not g_bus.capture(arguments_list.get_capture_file())) {
+            cout << "Could not write the trace file: " << arguments_list.get_capture_file() << endl;
+            return 4;
+        }
+    }
+    else if (not arguments_list.get_play_file().empty()) {
+        if (not g_bus.play(arguments_list.get_play_file())) {
+            cout << "Could not read the trace file: " << arguments_list.get_play_file() << endl;
+            return 4;
+        }
+    }
+
+    /* Make the library calls on a bus thread. It is started before the library, so the threads that the
+       library starts inherit its scheduling */
+    if ((not arguments_list.get_discovery()) and (arguments_list.get_realtime_priority() >= 0)) {
+        bus_io.start(arguments_list.get_realtime_priority(), arguments_list.get_bus_cpus());
+        g_bus.use_thread(&bus_io);
+    }
 
     string conf_file = arguments_list.get_config_file();
     /* init Yasdi- and Yasdi-Master-Library */
-    yasdiMasterInitialize(conf_file.c_str(), &drivers);
+    g_bus.initialize(conf_file.c_str(), &drivers);
     /* get List of all supported drivers...*/
-    drivers = yasdiMasterGetDriver(Driver, MAXDRIVERS );
+    drivers = g_bus.get_drivers(Driver, MAXDRIVERS );
     /* Switch all drivers online */
     for(DWORD i=0; i < drivers; i++) {
-        if (g_debug) {
+        if ((g_debug) or (arguments_list.get_endpoints() > 0)) {
             /* The name of the driver */
-            yasdiGetDriverName(Driver[i], DriverName, sizeof(DriverName) - 1);
-            cout << "Switching on driver: " << DriverName << endl;
+            g_bus.driver_name(Driver[i], DriverName, sizeof(DriverName) - 1);
+            LOG_DEBUG("Switching on driver: " << DriverName);
+            driver_names[Driver[i]] = DriverName;
         }
 
-        if (yasdiSetDriverOnline(Driver[i])) {
+        if (g_bus.driver_online(Driver[i])) {
             any_driver = true;
         }
     }
@@ -525,12 +1105,87 @@ int main(int argc, char *argv[])
         return 4;
     }
 
+    /* Profile the bus. The library's counters can be found once its drivers are loaded */
+    if ((not arguments_list.get_discovery()) and (arguments_list.get_profile())) {
+        profiler.initialize(conf_file);
+    }
+
+    /* Poll the buses separately. The library only has as many requests on the go as yasdi.ini allows. Discovery
+       is done the same way, a bus at a time on each worker */
+    if (arguments_list.get_endpoints() > 0) {
+        endpoints.initialize(arguments_list.get_endpoints(), driver_names);
+        int max_commands = read_max_commands(conf_file);
+        if ((g_bus.get_mode() != BUS_PLAY) and (max_commands < arguments_list.get_endpoints())) {
+            LOG_ERROR("Master.MaxCmdsParallel in " << conf_file << " is " << max_commands << ", so only that many buses are polled at once");
+        }
+    }
+
+    /* Watch for stalls and for a bus on which no device answers, and tell systemd that the service is up. This is
+       done before detection, which can take minutes: systemd would give up on a start that takes that long, and
+       the watchdog keeps telling it that all is well in the meantime */
+    if (not arguments_list.get_discovery()) {
+        if (arguments_list.get_stall_seconds() > 0) g_watchdog.start(arguments_list.get_stall_seconds());
+        g_watchdog.notify("READY=1");
+    }
+
     /* If not all devices are found, then we will try again later */
     bool all_devices_found = detect_devices(arguments_list.get_number());
-    record_devices(device_map, arguments_list.get_discovery());
+    record_devices(registry, arguments_list.get_discovery());
+    endpoints.assign(registry);
+    if ((not catalog_file.empty()) and (not arguments_list.get_discovery())) apply_catalog(registry, catalog);
 
     bool run = true;
     if (arguments_list.get_discovery()) run = false;
+    memory.report("at startup");
+
+    /* In discovery mode, every device is always read */
+    policy.initialize((run) and (arguments_list.get_backoff()), arguments_list.get_delay());
+
+    /* Journal rows before logging them, and recover any rows lost by a crash */
+    if ((run) and (arguments_list.get_journal_interval() >= 0)) {
+        string journal_path = arguments_list.get_log_directory() + "/" + JOURNAL_FILE;
+        row_journal.open(journal_path, arguments_list.get_journal_interval());
+    }
+
+    /* Carry on with the rollup intervals from before a restart */
+    if (run) {
+        rollups.initialize(arguments_list.get_log_directory());
+    }
+
+    /* Reload the settings file when it changes */
+    if ((run) and (not arguments_list.get_settings_file().empty())) {
+        watcher.start(arguments_list.get_settings_file());
+    }
+
+    /* Stream each reading as NDJSON */
+    if ((run) and (not arguments_list.get_ndjson_target().empty())) {
+        records.open(arguments_list.get_ndjson_target());
+    }
+
+    /* Spool each reading and forward it to an HTTP endpoint */
+    if ((run) and (not arguments_list.get_upload_url().empty())) {
+        spool.start(arguments_list.get_log_directory(), arguments_list.get_upload_url(), arguments_list.get_upload_rate());
+    }
+
+    /* Log each device with a fixed schema */
+    if ((run) and (arguments_list.get_typed_schema())) {
+        schemas.initialize(arguments_list.get_log_directory());
+    }
+
+    /* Log the whole site to one file */
+    if (run) {
+        site.initialize(arguments_list.get_site_log());
+    }
+
+    /* Audit the parameter channels between sweeps */
+    if ((run) and (arguments_list.get_audit_interval() > 0)) {
+        audit.initialize(arguments_list.get_audit_interval(), arguments_list.get_log_directory());
+    }
+
+    /* Answer value queries from other processes while polling */
+    if ((run) and (not arguments_list.get_query_socket().empty())) {
+        queries.start(arguments_list.get_query_socket());
+    }
 
     /* A few things about this loop:
        1. If discovery has been set, it will print one set of values for all devices found and then exit
@@ -539,43 +1194,277 @@ int main(int argc, char *argv[])
     string current_date = get_current_date();
     string previous_date = get_current_date();
     int running_total = 0;
-    bool success_read = false;
-    do {
+    /* Only one device of each bus is read at a time, but with -z the buses are read at once. The polling policy
+       and everything that is done with the readings are shared between them */
+    mutex sweep_mutex;
+    mutex console_mutex;
+    string current_sweep_date;
+    auto poll_device = [&](device_entry &entry) -> int {
+        const string &device = entry.name;
+        DWORD handle = entry.handle;
+
+        /* Discovery with a catalog adds each device to it, and saves it straight away, so that an interrupted
+           discovery doesn't have to do the device again */
+        if ((arguments_list.get_discovery()) and (not catalog_file.empty())) {
+            if (catalog.contains(device)) {
+                lock_guard<mutex> lock(console_mutex);
+                cout << "Already in the catalog: " << device << endl;
+                return ENDPOINT_READ_OK;
+            }
+
+            catalog_device described;
+            bool answered = describe_device(entry, arguments_list, described);
+            described.endpoint = endpoints.device_endpoint_name(&entry - &registry[0]);
+            if (answered) {
+                catalog.add(described);
+                catalog.save(catalog_file);
+            }
+
+            lock_guard<mutex> lock(console_mutex);
+            if (answered) cout << "Catalogued " << device << " (" << described.type << ", serial " << described.serial << "): " <<
+                              described.channels.size() << " channels" << endl;
+            else cout << "Could not catalogue " << device << endl;
+            return (answered) ? ENDPOINT_READ_OK : ENDPOINT_READ_FAILED;
+        }
+
+        /* Otherwise discovery prints everything about a device, so one device is printed at a time */
+        unique_lock<mutex> console_lock(console_mutex, defer_lock);
+        if (arguments_list.get_discovery()) console_lock.lock();
+
+        /* Queries jump the queue, ahead of the next scheduled read. When the buses are polled at once, this worker
+           doesn't own the bus of the device asked for, so queries wait for the gap between sweeps */
+        if (not endpoints.concurrent()) serve_queries(queries, registry, arguments_list);
+
+        /* Devices that are asleep only get a liveness check, and only when it is due */
+        time_t now = time(nullptr);
+        int action = POLL_FULL;
+        {
+            lock_guard<mutex> lock(sweep_mutex);
+            action = policy.next_action(device, now);
+        }
+        if (action == POLL_SKIP) return ENDPOINT_NOT_READ;
+
+        /* The bus is only profiled for each device when the devices are read one at a time */
+        bool profile_device = not endpoints.concurrent();
+        if (profile_device) profiler.begin_device();
+        if (action == POLL_LIVENESS) {
+            string mode;
+            bool alive = read_mode(handle, arguments_list, mode);
+            lock_guard<mutex> lock(sweep_mutex);
+            policy.report(device, alive, mode, now);
+            if (policy.next_action(device, now) != POLL_FULL) {
+                if (profile_device) profiler.end_device(device);
+                return (alive) ? ENDPOINT_READ_OK : ENDPOINT_READ_FAILED;
+            }
+        }
+
+        /* The schema comes from the channels, not from what is read, so it is worked out before the read */
+        if ((schemas.enabled()) and (entry.schema == NULL) and ((entry.channels_known) or (load_channels(entry)))) {
+            string columns[CHANNEL_COUNT];
+            schema_columns(entry, arguments_list, columns);
+            lock_guard<mutex> lock(sweep_mutex);
+            if (schemas.update(device, columns, get_current_datetime(), &entry.schema)) entry.segment_due = true;
+        }
+
         string data, header;
+        vector <vec_data> &data_vector = entry.readings;
+        bool success_read = fetch_dynamic_data(entry, &header, &data, &data_vector, arguments_list.get_discovery(), arguments_list);
+        if (profile_device) profiler.end_device(device);
+        /* If this is a discovery query, then print data and exit */
+        if (arguments_list.get_discovery()) {
+            cout << "Data: " << data << endl;
+            cout << "Header: " << header << endl;
+            return ENDPOINT_READ_OK;
+        }
+
+        lock_guard<mutex> lock(sweep_mutex);
+        policy.report(device, success_read, find_mode(data_vector), now);
+
+        /* Keep the query cache up to date with every value read */
+        for (auto iter = data_vector.begin(); iter != data_vector.end(); ++iter) {
+            queries.update(device, iter->channel, iter->value, iter->units);
+        }
+
+        /* Only log a line if it was a success */
+        if (success_read && !data.empty()) {
+            /* Log the line based on the inverter name, in the logging directory, or with the rest of the site */
+            if (site.enabled()) {
+                site.add(device, header, data);
+            }
+            else {
+                string full_dir = arguments_list.get_log_directory() + "/" + device;
+                /* log to a date and to a 'latest' file. A new schema starts a new segment with its header, unless
+                   the file is new and gets the header anyway */
+                vector <string> lines;
+                struct stat st_file;
+                if ((entry.segment_due) and (stat((full_dir + "/" + current_sweep_date + ".csv").c_str(), &st_file) == 0)) {
+                    lines.push_back(header);
+                }
+                lines.push_back(data);
+                write_lines(row_journal, full_dir, current_sweep_date + ".csv", lines, header, true);
+            }
+            entry.segment_due = false;
+
+            fleet.add_device(device, data_vector);
+            records.emit(device, now, data_vector);
+            spool.append(device, now, data_vector);
+        }
+        /* A device whose channels all went unanswered (eg; its gateway is down) didn't answer */
+        return ((success_read) and (not data_vector.empty())) ? ENDPOINT_READ_OK : ENDPOINT_READ_FAILED;
+    };
+
+    /* The devices that answered and failed in each sweep, for the watchdog */
+    vector <DWORD> answered;
+    vector <DWORD> failed;
+    auto watch_device = [&](device_entry &entry) -> int {
+        int read = poll_device(entry);
+        lock_guard<mutex> lock(sweep_mutex);
+        if (read == ENDPOINT_READ_OK) answered.push_back(entry.handle);
+        else if (read == ENDPOINT_READ_FAILED) failed.push_back(entry.handle);
+        return read;
+    };
+
+    do {
+        if (watcher.changed()) {
+            reload_settings(arguments_list, policy);
+            /* Other channels may be selected or converted now */
+            for (size_t i = 0; i < registry.size(); i++) registry[i].schema = NULL;
+        }
+
+        g_watchdog.progress();
         string current_date = get_current_date();
+        current_sweep_date = current_date;
         time_t start = time(nullptr);
-        for(map<DWORD, string>::const_iterator it = device_map.begin(); it != device_map.end(); ++it) {
-            success_read = fetch_dynamic_data(it->first, &header, &data, arguments_list.get_discovery(), arguments_list);
-            /* If this is a discovery query, then print data and exit */
-            if (arguments_list.get_discovery()) {
-                cout << "Data: " << data << endl;
-                cout << "Header: " << header << endl;
-                run = false;
+        chrono::steady_clock::time_point sweep_started = chrono::steady_clock::now();
+        double cpu_start = get_cpu_seconds();
+        fleet.clear();
+        profiler.begin_sweep();
+        answered.clear();
+        failed.clear();
+        site.begin_sweep(current_date);
+        endpoints.sweep(registry, watch_device);
+        /* Discovery reads every device once */
+        if (arguments_list.get_discovery()) run = false;
+
+        /* Every device's row, in one append */
+        if ((run) and (site.enabled())) {
+            vector <string> lines;
+            site.end_sweep(lines);
+            string site_dir = arguments_list.get_log_directory() + "/" + SITE_DIRECTORY;
+            write_lines(row_journal, site_dir, current_date + ".csv", lines, site_log::header(), true);
+        }
+        if (run) {
+            process_sweep(arguments_list, row_journal, fleet, anomalies, rollups, start, get_current_datetime());
+        }
+
+        /* How busy the bus was, for each device and the whole sweep */
+        if ((run) and (arguments_list.get_profile())) {
+            vector <string> lines;
+            profiler.end_sweep(get_current_datetime(), lines);
+            string profile_dir = arguments_list.get_log_directory() + "/" + PROFILE_DIRECTORY;
+            write_lines(row_journal, profile_dir, current_date + ".csv", lines, bus_profiler::header(), false);
+        }
+
+        /* The reads, failures and time of each bus */
+        if ((run) and (endpoints.enabled())) {
+            vector <string> lines;
+            endpoints.end_sweep(get_current_datetime(), lines);
+            string endpoint_dir = arguments_list.get_log_directory() + "/" + ENDPOINT_DIRECTORY;
+            write_lines(row_journal, endpoint_dir, current_date + ".csv", lines, endpoint_table::header(), false);
+        }
+
+        row_journal.sweep_done();
+        spool.sweep_done();
+        /* The rollup state is only saved once the rollup rows are committed, so a crash can't lose rows that the
+           state says were written. Otherwise it waits for a later sweep */
+        if ((run) and (arguments_list.get_rollups()) and (row_journal.committed())) rollups.checkpoint();
+        bus_io.report_if_due();
+        memory.end_sweep();
+
+        /* Recover a driver once no device on it has answered for WATCHDOG_FAILED_SWEEPS sweeps, whatever the devices
+           on the other drivers do. The drivers are only looked up when a device has failed. Failed devices whose
+           driver isn't known are taken together, and only count when no device at all has answered. If the library
+           has lost the devices as well, they are detected again. A device on the driver that failed is asked for its
+           mode to see if that helped */
+        if ((run) and (g_watchdog.enabled())) {
+            map <DWORD, int> answered_on;
+            map <DWORD, vector <DWORD> > failed_on;
+            vector <DWORD> failed_unknown;
+            for (size_t i = 0; (not failed.empty()) and (i < answered.size()); i++) {
+                DWORD driver = 0;
+                if (device_driver(registry, answered[i], Driver, drivers, &driver)) answered_on[driver]++;
             }
-            else {
-                /* Only log a line if it was a success */
-                if (success_read && !data.empty()) {
-                    /* Log the line based on the inverter name, in the logging directory */
-                    string full_dir = arguments_list.get_log_directory() + "/" + it->second;
-                    /* log to a date and to a 'latest' file */
-                    log_line(full_dir, current_date + ".csv", data, header, true);
+            for (size_t i = 0; i < failed.size(); i++) {
+                DWORD driver = 0;
+                if (device_driver(registry, failed[i], Driver, drivers, &driver)) failed_on[driver].push_back(failed[i]);
+                else failed_unknown.push_back(failed[i]);
+            }
+
+            /* Each driver, and then the failed devices of unknown drivers */
+            for (DWORD i = 0; i <= drivers; i++) {
+                bool known = (i < drivers);
+                DWORD driver = (known) ? Driver[i] : WATCHDOG_UNKNOWN_DRIVER;
+                vector <DWORD> &driver_failed = (known) ? failed_on[driver] : failed_unknown;
+                int driver_answered = (known) ? answered_on[driver] : answered.size();
+                if (not g_watchdog.end_sweep(driver, driver_answered, driver_failed.size())) continue;
+
+                if (known) LOG_ERROR("No device on driver " << ((driver_names.count(driver) > 0) ? driver_names[driver] : to_string(driver)) <<
+                                     " has answered for " << WATCHDOG_FAILED_SWEEPS << " sweeps. Recovering it");
+                else LOG_ERROR("No device has answered for " << WATCHDOG_FAILED_SWEEPS << " sweeps. Recovering the bus");
+                if (not recover_drivers(registry, (known) ? &driver : NULL, Driver, drivers)) {
+                    LOG_INFO("The devices were lost with the drivers. Detecting them again");
+                    all_devices_found = detect_devices(arguments_list.get_number());
+                    record_devices(registry, false);
+                    endpoints.assign(registry);
+                    if (not catalog_file.empty()) apply_catalog(registry, catalog);
+                }
+
+                /* The devices may have been detected again, so only one that is still known is asked */
+                bool recovered = false;
+                for (size_t j = 0; j < driver_failed.size(); j++) {
+                    if (!registry.find(driver_failed[j])) continue;
+                    string mode;
+                    recovered = read_mode(driver_failed[j], arguments_list, mode);
+                    break;
                 }
+                if (recovered) LOG_INFO("The bus has been recovered");
+                g_watchdog.recovered(driver, recovered);
             }
         }
-        time_t end = time(nullptr);
-        if (g_debug) cout << "Query took: " << (end-start) << " Seconds\n" << endl;
+        LOG_DEBUG("Query took: " << convert_double(chrono::duration<double>(chrono::steady_clock::now() - sweep_started).count()) << " Seconds, " << registry.size() << " devices, CPU " <<
+                  convert_double((get_cpu_seconds() - cpu_start) * 1000) << " ms, RSS " << get_rss_kb() << " kB");
+
+        /* A playback ends when every call in the trace has been answered */
+        if ((run) and (g_bus.get_mode() == BUS_PLAY) and (g_bus.played_out())) {
+            LOG_INFO("The trace has been played to the end");
+            run = false;
+        }
         previous_date = current_date;
-        /* If the loop will run continuously, then run a delay */
-        if (run) sleep(arguments_list.get_delay());
+        /* If the loop will run continuously, then run a delay. Any queries that arrive in the meantime are served straight away.
+           The parameter audit has the bus when there are no queries, as long as it can finish before the next sweep */
+        if (run) {
+            time_t wake = time(nullptr) + arguments_list.get_delay();
+            while (time(nullptr) < wake) {
+                g_watchdog.progress();
+                serve_queries(queries, registry, arguments_list);
+                if (audit.read_next(registry, policy, wake)) continue;
+                g_watchdog.pause();
+                if (queries.wait_for_requests(wake)) {
+                    serve_queries(queries, registry, arguments_list);
+                }
+            }
+        }
 
         /* if not all devices have been found, then try to find them at least once every 20 minutes */
-        if ((not all_devices_found) and (run)) {
+        if ((not all_devices_found) and (run) and (not policy.all_asleep())) {
             /* Add a running total. If it is greater than 20 minutes, redo 'detect_devices' and 'record_devices' */
             running_total += arguments_list.get_delay();
             if (running_total > 1200) {
-                if (g_debug) cout << "Not all devices were found in the original run, trying to find them now" << endl;
+                LOG_DEBUG("Not all devices were found in the original run, trying to find them now");
                 all_devices_found = detect_devices(arguments_list.get_number());
-                record_devices(device_map, false);
+                record_devices(registry, false);
+                endpoints.assign(registry);
+                if (not catalog_file.empty()) apply_catalog(registry, catalog);
                 running_total = 0;
             }
         }
@@ -583,15 +1472,27 @@ int main(int argc, char *argv[])
     } while (run);
 
 
+    g_watchdog.notify("STOPPING=1");
+    g_watchdog.stop();
+    queries.stop();
+    row_journal.close();
+    /* Every row is written now */
+    if ((not arguments_list.get_discovery()) and (arguments_list.get_rollups())) rollups.checkpoint();
+    spool.stop();
+
     /* Shutdown all yasdi drivers... */
     for(DWORD i=0; i < drivers; i++) {
-        yasdiGetDriverName(Driver[i], DriverName, sizeof(DriverName));
-        yasdiSetDriverOffline( Driver[i] );
+        g_bus.driver_name(Driver[i], DriverName, sizeof(DriverName));
+        g_bus.driver_offline( Driver[i] );
     }
 
     /* Shutdown YASDI */
-    yasdiMasterShutdown();
+    g_bus.shutdown();
+    g_bus.close();
+    g_bus.use_thread(NULL);
+    bus_io.stop();
 
     remove_pid_file();
+    g_logger.stop();
     return 0;
 }
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <malloc.h>
+#include <sys/resource.h>
+#include "memory.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Heap in use (allocated and not freed), in kB. mallinfo2 is only in newer C libraries; mallinfo's
+   counts wrap at 2 GB, which is far more than this service uses */
+long get_heap_kb()
+{
+#if (__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    return (long) ((info.uordblks + info.hblkhd) / 1024);
+}
+
+/* The most memory that has been resident at once, in kB */
+long get_peak_rss_kb()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;
+}
+
+/* Constructor for the memory_monitor class */
+memory_monitor::memory_monitor()
+{
+    this->budget_kb = 0;
+    this->peak_heap_kb = 0;
+    this->next_report = 0;
+}
+
+/* Keep the memory within 'budget_kb'. Call before any threads are started, so that they share the arena */
+void memory_monitor::initialize(long budget_kb)
+{
+    this->budget_kb = budget_kb;
+    if (not enabled()) return;
+
+    mallopt(M_ARENA_MAX, MEMORY_ARENAS);
+    mallopt(M_TRIM_THRESHOLD, MEMORY_TRIM_THRESHOLD);
+    mallopt(M_MMAP_THRESHOLD, MEMORY_MMAP_THRESHOLD);
+    this->next_report = time(nullptr) + MEMORY_REPORT_INTERVAL;
+}
+
+bool memory_monitor::enabled()
+{
+    return (this->budget_kb > 0);
+}
+
+/* A sweep has ended. Note the heap, give back what was freed, and report if it is time */
+void memory_monitor::end_sweep()
+{
+    if (not enabled()) return;
+
+    long heap_kb = get_heap_kb();
+    if (heap_kb > this->peak_heap_kb) this->peak_heap_kb = heap_kb;
+    malloc_trim(0);
+
+    if (time(nullptr) >= this->next_report) {
+        report("after " + to_string(MEMORY_REPORT_INTERVAL / 60) + " minutes");
+        this->next_report = time(nullptr) + MEMORY_REPORT_INTERVAL;
+    }
+}
+
+/* Log the memory in use, and if it is over the budget */
+void memory_monitor::report(const string &when)
+{
+    if (not enabled()) return;
+
+    long rss_kb = get_rss_kb();
+    long heap_kb = get_heap_kb();
+    if (heap_kb > this->peak_heap_kb) this->peak_heap_kb = heap_kb;
+
+    LOG_INFO("Memory " << when << ": RSS " << rss_kb << " kB (peak " << get_peak_rss_kb() << " kB), heap " << heap_kb <<
+             " kB (peak " << this->peak_heap_kb << " kB), budget " << this->budget_kb << " kB");
+    if (rss_kb > this->budget_kb) {
+        LOG_ERROR("The memory in use (" << rss_kb << " kB) is over the budget of " << this->budget_kb << " kB");
+    }
+}
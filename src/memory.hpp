@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef MEMORY_HPP_INCLUDED
+#define MEMORY_HPP_INCLUDED
+
+#include <string>
+#include <ctime>
+
+/* Seconds between memory reports */
+#define MEMORY_REPORT_INTERVAL 3600
+/* The allocator's arenas. Normally each thread can get its own, which is a lot of memory for a few threads */
+#define MEMORY_ARENAS 1
+/* Freed memory at the top of the heap above this many bytes is given back to the system */
+#define MEMORY_TRIM_THRESHOLD (128 * 1024)
+/* Allocations of this many bytes or more get their own mapping, which is given back as soon as they are freed */
+#define MEMORY_MMAP_THRESHOLD (64 * 1024)
+
+using namespace std;
+
+/* This class keeps the memory of the service flat, for gateways with little RAM. It is turned on with a budget.
+   The allocator is then set to use one arena for every thread, and after each sweep (when everything made for
+   the sweep has been freed) the memory that was freed is given back to the system. The readings of each device
+   are kept between sweeps and written over (see fetch_dynamic_data), so a sweep allocates little once the
+   first one is done.
+
+   The resident memory (and its peak) and the heap in use (and its peak, as seen at the end of each sweep) are
+   logged at startup and every MEMORY_REPORT_INTERVAL seconds, with an error if the resident memory is over
+   the budget. Without a budget, none of this is done */
+class memory_monitor
+{
+    public:
+        memory_monitor();
+        void initialize(long budget_kb);
+        bool enabled();
+        void end_sweep();
+        void report(const string &when);
+
+    private:
+        long budget_kb; /* 0 if there is no budget */
+        long peak_heap_kb;
+        time_t next_report;
+};
+
+long get_heap_kb();
+long get_peak_rss_kb();
+
+#endif /* MEMORY_HPP_INCLUDED */
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ndjson.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/************************ json_encoder ******************************/
+
+/* Constructor for the json_encoder class */
+json_encoder::json_encoder()
+{
+    reset();
+}
+
+/* Start a new record */
+void json_encoder::reset()
+{
+    this->length = 0;
+    this->overflow = false;
+    this->depth = 0;
+    this->after_key = false;
+}
+
+void json_encoder::put(char c)
+{
+    if (this->length < NDJSON_RECORD_SIZE) this->buffer[this->length++] = c;
+    else this->overflow = true;
+}
+
+void json_encoder::put(const char *text, size_t length)
+{
+    if (this->length + length > NDJSON_RECORD_SIZE) {
+        this->overflow = true;
+        return;
+    }
+    memcpy(this->buffer + this->length, text, length);
+    this->length += length;
+}
+
+/* Write a comma if this is not the first member of an object */
+void json_encoder::separator()
+{
+    if (this->after_key) {
+        this->after_key = false;
+        return;
+    }
+    if ((this->depth == 0) or (this->depth > NDJSON_MAX_DEPTH)) return;
+    if (not this->first[this->depth - 1]) put(',');
+    this->first[this->depth - 1] = false;
+}
+
+void json_encoder::begin_object()
+{
+    separator();
+    put('{');
+    if (this->depth < NDJSON_MAX_DEPTH) this->first[this->depth] = true;
+    else this->overflow = true;
+    this->depth++;
+}
+
+void json_encoder::end_object()
+{
+    put('}');
+    if (this->depth > 0) this->depth--;
+}
+
+/* A member name */
+void json_encoder::key(const char *name)
+{
+    separator();
+    put_string(name, strlen(name));
+    put(':');
+    this->after_key = true;
+}
+
+void json_encoder::string_value(const char *text, size_t length)
+{
+    separator();
+    put_string(text, length);
+}
+
+/* A quoted and escaped string */
+void json_encoder::put_string(const char *text, size_t length)
+{
+    put('"');
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        if ((c == '"') or (c == '\\')) {
+            put('\\');
+            put(c);
+        }
+        else if (c < 0x20) {
+            char escaped[8];
+            int written = snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            put(escaped, written);
+        }
+        else {
+            put(c);
+        }
+    }
+    put('"');
+}
+
+/* A number. NaN and infinity are not allowed in JSON, so they are written as null */
+void json_encoder::number_value(double number)
+{
+    if (not isfinite(number)) {
+        null_value();
+        return;
+    }
+    separator();
+    char text[32];
+    int written = snprintf(text, sizeof(text), "%.15g", number);
+    put(text, written);
+}
+
+void json_encoder::null_value()
+{
+    separator();
+    put("null", 4);
+}
+
+/* End the record */
+void json_encoder::newline()
+{
+    put('\n');
+}
+
+const char *json_encoder::data()
+{
+    return this->buffer;
+}
+
+size_t json_encoder::size()
+{
+    return this->length;
+}
+
+bool json_encoder::overflowed()
+{
+    return this->overflow;
+}
+
+/************************ Records ******************************/
+
+/* Encode the record of one device reading, as one line:
+   {"device":"WR21TL06_SN:2001234567","serial":"2001234567","timestamp":"2018-03-01T10:15:00+1000","time":1519863300,
+    "values":{"Pac":{"value":1635,"units":"W"},"Mode":{"value":"Mpp","units":""}}}
+   Values that are numbers are written as numbers, others as strings. The keys are the raw SMA channel names.
+   Check 'overflowed' afterwards */
+void encode_record(json_encoder &json, const string &device, time_t when, const vector <vec_data> &data_vector)
+{
+    json.reset();
+    json.begin_object();
+    json.key("device");
+    json.string_value(device.data(), device.size());
+
+    /* The serial number is the part of the device name after "SN:" */
+    json.key("serial");
+    size_t serial = device.find("SN:");
+    if (serial != string::npos) json.string_value(device.data() + serial + 3, device.size() - serial - 3);
+    else json.null_value();
+
+    char timestamp[32];
+    struct tm timeinfo;
+    localtime_r(&when, &timeinfo);
+    size_t timestamp_length = strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S%z", &timeinfo);
+    json.key("timestamp");
+    json.string_value(timestamp, timestamp_length);
+    json.key("time");
+    json.number_value(when);
+
+    json.key("values");
+    json.begin_object();
+    for (auto iter = data_vector.begin(); iter != data_vector.end(); ++iter) {
+        json.key(iter->channel.c_str());
+        json.begin_object();
+        json.key("value");
+        double number;
+        if (parse_channel_value(iter->value, &number)) json.number_value(number);
+        else if (iter->value.empty()) json.null_value();
+        else json.string_value(iter->value.data(), iter->value.size());
+        json.key("units");
+        json.string_value(iter->units.data(), iter->units.size());
+        json.end_object();
+    }
+    json.end_object();
+    json.end_object();
+    json.newline();
+}
+
+/************************ ndjson_output ******************************/
+
+/* Constructor for the ndjson_output class */
+ndjson_output::ndjson_output()
+{
+    this->fd = -1;
+    this->is_socket = false;
+    this->last_attempt = 0;
+    this->dropped = 0;
+}
+
+ndjson_output::~ndjson_output()
+{
+    close();
+}
+
+/* Set where the records go: "-" for stdout, or the path of a FIFO, Unix domain socket or file.
+   Returns false if it can't be opened now; it will be tried again later */
+bool ndjson_output::open(const string &target)
+{
+    this->target = target;
+    this->last_attempt = 0;
+    return reopen();
+}
+
+/* Check if NDJSON output is wanted */
+bool ndjson_output::is_open()
+{
+    return not this->target.empty();
+}
+
+void ndjson_output::close()
+{
+    if ((this->fd >= 0) and (this->fd != STDOUT_FILENO)) ::close(this->fd);
+    this->fd = -1;
+}
+
+/* (Re)open the output. A FIFO with no reader, or a socket with no listener, fails straight away */
+bool ndjson_output::reopen()
+{
+    close();
+    this->last_attempt = time(nullptr);
+
+    if (this->target == "-") {
+        this->fd = STDOUT_FILENO;
+        this->is_socket = false;
+        return true;
+    }
+
+    struct stat st;
+    if ((stat(this->target.c_str(), &st) == 0) and (S_ISSOCK(st.st_mode))) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, this->target.c_str(), sizeof(address.sun_path) - 1);
+
+        int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (socket_fd < 0) return false;
+        if (connect(socket_fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+            LOG_DEBUG("Cannot connect to the NDJSON socket: " << this->target);
+            ::close(socket_fd);
+            return false;
+        }
+        fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) | O_NONBLOCK);
+        this->fd = socket_fd;
+        this->is_socket = true;
+        return true;
+    }
+
+    /* A FIFO or a plain file. If a FIFO's reader goes away, the write fails (EPIPE) instead of killing the service */
+    signal(SIGPIPE, SIG_IGN);
+    this->fd = ::open(this->target.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644);
+    if (this->fd < 0) {
+        LOG_DEBUG("Cannot open the NDJSON output: " << this->target << " (" << strerror(errno) << ")");
+        return false;
+    }
+    this->is_socket = false;
+    return true;
+}
+
+/* Write a whole record. Once part of a record is written, the rest must follow (or the stream would be
+   corrupt), so then it waits a short time for the reader. Returns false if the record was not written */
+bool ndjson_output::write_record(const char *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result;
+        if (this->is_socket) result = send(this->fd, data + written, size - written, MSG_NOSIGNAL);
+        else result = ::write(this->fd, data + written, size - written);
+
+        if (result > 0) {
+            written += result;
+            continue;
+        }
+        if ((result < 0) and (errno == EINTR)) continue;
+        if ((result < 0) and (errno == EAGAIN) and (written == 0)) {
+            /* The reader is behind. Drop this record, but keep the output */
+            return false;
+        }
+        if ((result < 0) and (errno == EAGAIN)) {
+            struct pollfd waiting = { this->fd, POLLOUT, 0 };
+            if (poll(&waiting, 1, NDJSON_WRITE_TIMEOUT) > 0) continue;
+        }
+
+        /* The reader has gone, or is stuck part way through a record */
+        LOG_ERROR("NDJSON output closed: " << this->target);
+        close();
+        return false;
+    }
+    return true;
+}
+
+/* Write the record of one device reading (see 'encode_record') */
+void ndjson_output::emit(const string &device, time_t when, const vector <vec_data> &data_vector)
+{
+    if (this->target.empty()) return;
+    if (this->fd < 0) {
+        if (time(nullptr) - this->last_attempt < NDJSON_RETRY) {
+            this->dropped++;
+            return;
+        }
+        if (not reopen()) {
+            this->dropped++;
+            return;
+        }
+    }
+
+    json_encoder &json = this->encoder;
+    encode_record(json, device, when, data_vector);
+
+    if (json.overflowed()) {
+        LOG_ERROR("NDJSON record too big for device: " << device);
+        this->dropped++;
+        return;
+    }
+    if (not write_record(json.data(), json.size())) {
+        this->dropped++;
+        if ((this->dropped % 100) == 1) LOG_ERROR("NDJSON records dropped so far: " << this->dropped);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef NDJSON_HPP_INCLUDED
+#define NDJSON_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include "channels.hpp"
+
+/* Largest record. A device with every channel is well under this */
+#define NDJSON_RECORD_SIZE 16384
+/* Deepest nesting of objects */
+#define NDJSON_MAX_DEPTH 8
+/* Seconds between attempts to reopen the output when it has gone away */
+#define NDJSON_RETRY 10
+/* Milliseconds to wait for a slow reader to take the rest of a record, once part of it has been written */
+#define NDJSON_WRITE_TIMEOUT 1000
+
+using namespace std;
+
+/* A JSON encoder that writes into a fixed buffer, so encoding a record needs no heap allocation.
+   If a record doesn't fit, 'overflowed' is set and the record should be dropped */
+class json_encoder
+{
+    public:
+        json_encoder();
+        void reset();
+        void begin_object();
+        void end_object();
+        void key(const char *name);
+        void string_value(const char *text, size_t length);
+        void number_value(double number);
+        void null_value();
+        void newline();
+        const char *data();
+        size_t size();
+        bool overflowed();
+
+    private:
+        void separator();
+        void put(char c);
+        void put(const char *text, size_t length);
+        void put_string(const char *text, size_t length);
+
+        char buffer[NDJSON_RECORD_SIZE];
+        size_t length;
+        bool overflow;
+        int depth;
+        bool first[NDJSON_MAX_DEPTH]; /* no member written yet at this depth */
+        bool after_key;
+};
+
+void encode_record(json_encoder &json, const string &device, time_t when, const vector <vec_data> &data_vector);
+
+/* This class writes one NDJSON line per device reading to stdout ("-"), a FIFO, a Unix domain socket
+   (connected to as a client) or a plain file. Writes to a FIFO or socket never block for long: if there is no
+   reader, or the reader is too slow, records are dropped and counted, and the output is reopened later.
+   stdout is written normally, so a slow pipe holds the service up, as for any other program */
+class ndjson_output
+{
+    public:
+        ndjson_output();
+        ~ndjson_output();
+        bool open(const string &target);
+        void close();
+        bool is_open();
+        void emit(const string &device, time_t when, const vector <vec_data> &data_vector);
+
+    private:
+        bool reopen();
+        bool write_record(const char *data, size_t size);
+
+        string target;
+        int fd;
+        bool is_socket;
+        time_t last_attempt;
+        unsigned long dropped;
+        json_encoder encoder;
+};
+
+#endif /* NDJSON_HPP_INCLUDED */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <chrono>
+#include <fstream>
+#include "parameters.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+#include "watchdog.hpp"
+
+/* Room for this many parameter channel handles at first. The array grows when it is full */
+#define PARAMETER_HANDLES_INITIAL 200
+#define PARAMETER_TEXT_SIZE 64
+
+using namespace std;
+
+/* Constructor for the parameter_audit class */
+parameter_audit::parameter_audit()
+{
+    this->interval = 0;
+    this->next_audit = 0;
+    this->auditing = false;
+    this->audit_started = 0;
+    this->changed = 0;
+    this->device_index = 0;
+    this->device_handle = 0;
+    this->channel_index = 0;
+    this->attempts = 0;
+    this->unreadable = 0;
+    this->slowest_read = PARAMETER_READ_ESTIMATE;
+    this->read_timed = false;
+}
+
+/* Audit every 'interval' seconds. The first audit starts in the first gap between sweeps */
+void parameter_audit::initialize(int interval, const string &log_directory)
+{
+    this->interval = interval;
+    this->log_directory = log_directory;
+    this->next_audit = time(nullptr);
+}
+
+bool parameter_audit::enabled()
+{
+    return (this->interval > 0);
+}
+
+/* Read the next parameter channel, if there is one to read and it can be done before 'deadline' (when the next
+   sweep is due). Returns false if nothing was read, in which case there is nothing more to do before then */
+bool parameter_audit::read_next(device_registry &registry, polling_policy &policy, time_t deadline)
+{
+    if (not enabled()) return false;
+
+    time_t now = time(nullptr);
+    if (not this->auditing) {
+        if (now < this->next_audit) return false;
+        LOG_DEBUG("Starting an audit of the parameters of " << registry.size() << " devices");
+        this->auditing = true;
+        this->audit_started = now;
+        this->changed = 0;
+        this->device_index = 0;
+        this->device_name.clear();
+    }
+
+    /* Leave the bus alone unless even the slowest read would be done well before the next sweep */
+    if (now + this->slowest_read + PARAMETER_MARGIN > deadline) return false;
+
+    while (this->device_name.empty()) {
+        if (this->device_index >= registry.size()) {
+            this->auditing = false;
+            this->next_audit = this->audit_started + this->interval;
+            LOG_INFO("Audited the parameters of " << registry.size() << " devices in " << (now - this->audit_started) <<
+                     " seconds. " << this->changed << " changed");
+            return false;
+        }
+
+        device_entry &device = registry[this->device_index++];
+        if (policy.is_asleep(device.name)) continue;
+        start_device(device);
+    }
+
+    /* The devices may have been found again since this one was started */
+    device_entry *device = registry.find(this->device_name);
+    if ((!device) or (device->handle != this->device_handle)) {
+        this->device_name.clear();
+        return true;
+    }
+
+    parameter_value &parameter = this->values[this->channel_index];
+    char text[PARAMETER_TEXT_SIZE] = "";
+    double number = 0;
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    int result = g_bus.channel_value(parameter.handle, this->device_handle, &number, text, sizeof(text)-1, PARAMETER_MAX_AGE);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    g_watchdog.progress();
+
+    /* Until a read has been timed, the estimate stands. After that, it is the slowest read */
+    if ((not this->read_timed) or (seconds > this->slowest_read)) this->slowest_read = seconds;
+    this->read_timed = true;
+
+    if (result != YE_OK) {
+        /* Try it again in the next read, and after that, carry on without it */
+        if (++this->attempts < PARAMETER_ATTEMPTS) return true;
+        LOG_DEBUG("Could not read parameter " << parameter.name << " of " << this->device_name << " in " << this->attempts << " attempts");
+        parameter.read = false;
+        if (++this->unreadable >= PARAMETER_ATTEMPTS) {
+            /* A partial snapshot would look like a change, so the device is left until the next audit */
+            LOG_DEBUG(this->device_name << " isn't answering. Leaving it until the next audit");
+            this->device_name.clear();
+            return true;
+        }
+    }
+    else {
+        parameter.value = (text[0] != '\0') ? string(text) : convert_double(number);
+        parameter.read = true;
+        this->unreadable = 0;
+    }
+
+    this->channel_index++;
+    this->attempts = 0;
+    if (this->channel_index >= this->values.size()) {
+        finish_device();
+    }
+    return true;
+}
+
+/* Get the parameter channels of a device, ready to read them. The library already has them, so this doesn't
+   use the bus. Returns false if the device has none */
+bool parameter_audit::start_device(device_entry &device)
+{
+    vector <DWORD> handles(PARAMETER_HANDLES_INITIAL);
+    DWORD count = 0;
+    char text[PARAMETER_TEXT_SIZE];
+
+    while ((count = g_bus.channel_handles(device.handle, &handles[0], handles.size(), PARAMCHANNELS)) >= handles.size()) {
+        handles.resize(handles.size() * 2);
+    }
+
+    this->values.clear();
+    for (DWORD i = 0; i < count; i++) {
+        parameter_value parameter;
+        parameter.handle = handles[i];
+        if (g_bus.channel_name(handles[i], text, sizeof(text)-1) != YE_OK) continue;
+        parameter.name = text;
+        text[0] = '\0';
+        g_bus.channel_unit(handles[i], text, sizeof(text)-1);
+        parameter.units = text;
+        this->values.push_back(parameter);
+    }
+    if (this->values.empty()) return false;
+
+    this->device_name = device.name;
+    this->device_handle = device.handle;
+    this->channel_index = 0;
+    this->attempts = 0;
+    this->unreadable = 0;
+    return true;
+}
+
+/* Every parameter of the device has been read. Log a snapshot if any have changed */
+void parameter_audit::finish_device()
+{
+    map <string, string>::iterator it = this->snapshots.find(this->device_name);
+    if (it == this->snapshots.end()) {
+        it = this->snapshots.insert(make_pair(this->device_name, last_snapshot(this->device_name))).first;
+    }
+
+    string snapshot;
+    int unread = 0;
+    for (size_t i = 0; i < this->values.size(); i++) {
+        if (not this->values[i].read) {
+            this->values[i].value = last_value(it->second, this->values[i].name);
+            unread++;
+        }
+        snapshot += this->values[i].name + "," + this->values[i].value + "," + this->values[i].units + "\n";
+    }
+    if (unread == (int) this->values.size()) {
+        LOG_DEBUG("No parameters of " << this->device_name << " could be read. Leaving it until the next audit");
+        this->device_name.clear();
+        return;
+    }
+    if (unread > 0) LOG_INFO(unread << " parameters of " << this->device_name << " could not be read. They keep their last values");
+
+    if (snapshot != it->second) {
+        if (not it->second.empty()) LOG_INFO("The parameters of " << this->device_name << " have changed");
+        string datetime = get_current_datetime();
+        string block;
+        for (size_t i = 0; i < this->values.size(); i++) {
+            if (i > 0) block += "\n";
+            block += datetime + "," + this->values[i].name + "," + this->values[i].value + "," + this->values[i].units;
+        }
+        log_line(this->log_directory + "/" + PARAMETER_DIRECTORY, this->device_name + ".csv", block, header(), false);
+        it->second = snapshot;
+        this->changed++;
+    }
+
+    this->device_name.clear();
+}
+
+/* Read the last snapshot of a device back from its log: the lines at the end that have the same time.
+   Returns empty if there is none */
+string parameter_audit::last_snapshot(const string &device)
+{
+    ifstream reader((this->log_directory + "/" + PARAMETER_DIRECTORY + "/" + device + ".csv").c_str());
+    string line, datetime, snapshot;
+    while (getline(reader, line)) {
+        size_t comma = line.find(',');
+        if ((line.empty()) or (line[0] == '#') or (comma == string::npos)) continue;
+        if (line.compare(0, comma, datetime) != 0) {
+            datetime = line.substr(0, comma);
+            snapshot.clear();
+        }
+        snapshot += line.substr(comma + 1) + "\n";
+    }
+    return snapshot;
+}
+
+/* The value of a channel in a snapshot. Returns empty if it isn't there */
+string parameter_audit::last_value(const string &snapshot, const string &name)
+{
+    string prefix = name + ",";
+    size_t start = (snapshot.compare(0, prefix.size(), prefix) == 0) ? 0 : snapshot.find("\n" + prefix);
+    if (start == string::npos) return "";
+    if (start > 0) start++;
+
+    /* The line is "name,value,units". The value is what is between the name and the last comma */
+    size_t end = snapshot.find('\n', start);
+    string line = snapshot.substr(start, (end == string::npos) ? string::npos : end - start);
+    size_t units = line.rfind(',');
+    if (units < prefix.size()) return "";
+    return line.substr(prefix.size(), units - prefix.size());
+}
+
+/* The header of a device's parameter log */
+string parameter_audit::header()
+{
+    return "#Datetime,channel,value,units";
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef PARAMETERS_HPP_INCLUDED
+#define PARAMETERS_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include "bus.hpp"
+#include "registry.hpp"
+#include "polling.hpp"
+
+/* Name of the directory (in the logging directory) for the parameter snapshots */
+#define PARAMETER_DIRECTORY "parameters"
+/* Seconds that a parameter read is taken to need, until one has been timed. After that, the slowest read is used */
+#define PARAMETER_READ_ESTIMATE 5
+/* Seconds that are always left free before the next sweep */
+#define PARAMETER_MARGIN 2
+/* Maximum age in seconds of a parameter value held by the library */
+#define PARAMETER_MAX_AGE 5
+/* Times a parameter is tried before it is taken to be unreadable. As many unreadable parameters in a row mean
+   that the device isn't answering */
+#define PARAMETER_ATTEMPTS 3
+
+using namespace std;
+
+/* One parameter channel of the device being audited */
+struct parameter_value {
+    DWORD handle;
+    string name;
+    string units;
+    string value;
+    bool read; /* false if it couldn't be read in this audit */
+};
+
+/* This class audits the parameter channels (grid limits, country settings and so on) of every device, once
+   every 'interval' seconds. It only uses the bus between sweeps: one channel is read at a time, and only if
+   the slowest read so far (plus PARAMETER_MARGIN) still ends before the next sweep is due, so a sweep is never
+   held up. An audit can take many gaps to get through every device. Devices that are asleep are left out.
+
+   When a device has been read, its parameters are compared with its last snapshot. Only if any have changed
+   is a new snapshot (a line for each channel, with the same time) added to PARAMETER_DIRECTORY/<device>.csv.
+   The last snapshot is read back from there after a restart. A channel that can't be read is tried again in
+   the audit; if it still can't be read, it keeps its value from the last snapshot, so that it doesn't look
+   like a change */
+class parameter_audit
+{
+    public:
+        parameter_audit();
+        void initialize(int interval, const string &log_directory);
+        bool enabled();
+        bool read_next(device_registry &registry, polling_policy &policy, time_t deadline);
+
+    private:
+        bool start_device(device_entry &device);
+        void finish_device();
+        string last_snapshot(const string &device);
+        static string last_value(const string &snapshot, const string &name);
+        static string header();
+
+        int interval; /* 0 if there is no audit */
+        string log_directory;
+        time_t next_audit;
+        bool auditing;
+        time_t audit_started;
+        int changed;
+
+        /* The device being read */
+        size_t device_index;
+        string device_name;
+        DWORD device_handle;
+        vector <parameter_value> values;
+        size_t channel_index;
+        int attempts; /* of the channel at 'channel_index' */
+        int unreadable; /* channels in a row that couldn't be read */
+
+        double slowest_read;
+        bool read_timed; /* false until a read has been timed */
+        map <string, string> snapshots; /* the last snapshot of each device, as it is compared */
+};
+
+#endif /* PARAMETERS_HPP_INCLUDED */
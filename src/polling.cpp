@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include "polling.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Constructor for the polling_policy class. It is disabled (ie; always poll fully) until initialized */
+polling_policy::polling_policy()
+{
+    this->enabled = false;
+    this->base_interval = 0;
+
+    /* Modes in which the inverter is not producing. These are the values *after* the conversions
+       in 'arguments::initialise_conversions', plus the raw 'Stop' of the newer inverters */
+    this->sleep_modes.insert("waiting");
+    this->sleep_modes.insert("failure");
+    this->sleep_modes.insert("Stop");
+}
+
+/* Turn the policy on or off. 'base_interval' is the first liveness interval, normally the delay between readings */
+void polling_policy::initialize(bool enabled, int base_interval)
+{
+    this->enabled = enabled;
+    this->base_interval = base_interval;
+}
+
+/* Decide how to poll a device now */
+int polling_policy::next_action(string device, time_t now)
+{
+    if (not this->enabled) return POLL_FULL;
+
+    map <string, poll_state>::iterator it = this->devices.find(device);
+    if ((it == this->devices.end()) or (not it->second.asleep)) return POLL_FULL;
+
+    if (now >= it->second.next_poll) return POLL_LIVENESS;
+
+    return POLL_SKIP;
+}
+
+/* Report the result of a poll. 'mode' is the converted value of the mode channel, or empty */
+void polling_policy::report(string device, bool success, string mode, time_t now)
+{
+    if (not this->enabled) return;
+
+    poll_state &state = this->devices[device];
+    bool awake = success and (this->sleep_modes.find(mode) == this->sleep_modes.end());
+
+    if (awake) {
+        if (state.asleep) {
+            LOG_INFO("Device " << device << " is awake. Resuming full polling");
+        }
+        state.asleep = false;
+        state.interval = 0;
+        return;
+    }
+
+    if (not state.asleep) {
+        LOG_INFO("Device " << device << " is " << (success ? mode : "not responding") << ". Backing off");
+        state.asleep = true;
+        state.interval = this->base_interval;
+    }
+    else {
+        state.interval *= 2;
+        if (state.interval > POLL_MAX_INTERVAL) state.interval = POLL_MAX_INTERVAL;
+    }
+    LOG_DEBUG("Next liveness check of " << device << " in " << state.interval << " seconds");
+    state.next_poll = now + state.interval;
+}
+
+/* Check if a device is asleep */
+bool polling_policy::is_asleep(string device)
+{
+    if (not this->enabled) return false;
+
+    map <string, poll_state>::iterator it = this->devices.find(device);
+    return (it != this->devices.end()) and (it->second.asleep);
+}
+
+/* Check if every known device is asleep. If so, there is no point looking for missing devices either */
+bool polling_policy::all_asleep()
+{
+    if ((not this->enabled) or (this->devices.empty())) return false;
+
+    for (map <string, poll_state>::iterator it = this->devices.begin(); it != this->devices.end(); ++it) {
+        if (not it->second.asleep) return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef POLLING_HPP_INCLUDED
+#define POLLING_HPP_INCLUDED
+
+#include <string>
+#include <map>
+#include <set>
+#include <ctime>
+
+/* What to do with a device in this sweep */
+#define POLL_FULL 0
+#define POLL_LIVENESS 1
+#define POLL_SKIP 2
+
+/* Longest time between liveness checks of a sleeping device, in seconds */
+#define POLL_MAX_INTERVAL 900
+
+using namespace std;
+
+/* Polling state of one device */
+struct poll_state {
+    bool asleep;
+    time_t next_poll;
+    int interval;
+};
+
+/* This class decides how each device is polled. A device that stops answering, or reports
+   a state such as 'waiting' (ie; night time), is put to sleep. While asleep only the mode
+   channel is read, and the time between reads doubles up to POLL_MAX_INTERVAL. As soon
+   as the device reports any other state it is fully polled again */
+class polling_policy
+{
+    public:
+        polling_policy();
+        void initialize(bool enabled, int base_interval);
+        int next_action(string device, time_t now);
+        void report(string device, bool success, string mode, time_t now);
+        bool all_asleep();
+        bool is_asleep(string device);
+
+    private:
+        map <string, poll_state> devices;
+        set <string> sleep_modes;
+        bool enabled;
+        int base_interval;
+};
+
+#endif /* POLLING_HPP_INCLUDED */
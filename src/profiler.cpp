@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <fstream>
+#include "profiler.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Format a number for the log. Missing values are left empty */
+static string format_number(double number)
+{
+    if (number != number) return "";
+    return convert_double(number);
+}
+
+/* Constructor for the bus_profiler class */
+bus_profiler::bus_profiler()
+{
+    this->enabled = false;
+    this->baudrate = PROFILE_DEFAULT_BAUDRATE;
+    this->packets_written = NULL;
+    this->packets_read = NULL;
+    this->serial_bytes_read = NULL;
+    this->serial_driver = NULL;
+}
+
+bus_profiler::~bus_profiler()
+{
+    for (size_t i = 0; i < this->ports.size(); i++) {
+        if (this->ports[i].fd >= 0) close(this->ports[i].fd);
+    }
+    if (this->serial_driver) dlclose(this->serial_driver);
+}
+
+/* Read the serial ports (the COM sections with a Device) and their baud rates from yasdi.ini */
+void bus_profiler::read_ports(const string &conf_file)
+{
+    ifstream reader(conf_file.c_str());
+    string line, section;
+    while (getline(reader, line)) {
+        line = trim_whitespace(line);
+        if ((line.empty()) or (line[0] == '#') or (line[0] == ';')) continue;
+        if (line[0] == '[') {
+            section = line.substr(1, line.find(']') - 1);
+            continue;
+        }
+        if (section.compare(0, 3, "COM") != 0) continue;
+
+        size_t equals = line.find('=');
+        if (equals == string::npos) continue;
+        string key = trim_whitespace(line.substr(0, equals));
+        string value = trim_whitespace(line.substr(equals + 1));
+
+        if ((this->ports.empty()) or (this->ports.back().name != section)) {
+            profile_port port = { section, "", PROFILE_DEFAULT_BAUDRATE, -1 };
+            this->ports.push_back(port);
+        }
+        if (key == "Device") this->ports.back().device = value;
+        if (key == "Baudrate") convert_long(value, &this->ports.back().baudrate);
+    }
+}
+
+/* Find the counters and the serial ports. Call after the library has loaded its drivers.
+   Returns false if the library's frame counters can't be found */
+bool bus_profiler::initialize(const string &conf_file)
+{
+    this->enabled = true;
+    read_ports(conf_file);
+    if (not this->ports.empty()) this->baudrate = this->ports[0].baudrate;
+
+    /* The ports are opened only to read their counters. Without TIOCGICOUNT, the bytes sent are estimated */
+    for (size_t i = 0; i < this->ports.size(); i++) {
+        profile_port &port = this->ports[i];
+        if (port.device.empty()) continue;
+        port.fd = open(port.device.c_str(), O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        struct serial_icounter_struct counters;
+        if ((port.fd >= 0) and (ioctl(port.fd, TIOCGICOUNT, &counters) != 0)) {
+            close(port.fd);
+            port.fd = -1;
+        }
+        LOG_DEBUG("Profiling " << port.name << " (" << port.device << ") at " << port.baudrate << " baud, " <<
+                  ((port.fd >= 0) ? "counted by the port" : "counted by the driver"));
+    }
+
+    /* The library is linked, so its counters are found by name. The serial driver was loaded by the library */
+    this->packets_written = (const uint32_t *) dlsym(RTLD_DEFAULT, "dwPacketWrite");
+    this->packets_read = (const uint32_t *) dlsym(RTLD_DEFAULT, "dwPacketRead");
+    this->serial_driver = dlopen(PROFILE_SERIAL_DRIVER, RTLD_LAZY | RTLD_NOLOAD);
+    if (this->serial_driver) {
+        this->serial_bytes_read = (const int *) dlsym(this->serial_driver, "dBytesReadTotal");
+    }
+
+    sample(this->sweep_start);
+    sample(this->device_start);
+
+    if ((!this->packets_written) or (!this->packets_read)) {
+        LOG_ERROR("The library's frame counters were not found. The profile will be empty");
+        return false;
+    }
+    return true;
+}
+
+/* Read all of the counters now */
+void bus_profiler::sample(profile_counters &counters)
+{
+    counters.when = chrono::steady_clock::now();
+    counters.frames_sent = (this->packets_written) ? *(const volatile uint32_t *) this->packets_written : 0;
+    counters.frames_received = (this->packets_read) ? *(const volatile uint32_t *) this->packets_read : 0;
+    counters.bytes_sent = 0;
+    counters.bytes_received = 0;
+    counters.exact_bytes_sent = true;
+
+    bool counted = false;
+    for (size_t i = 0; i < this->ports.size(); i++) {
+        struct serial_icounter_struct port_counters;
+        if ((this->ports[i].fd < 0) or (ioctl(this->ports[i].fd, TIOCGICOUNT, &port_counters) != 0)) continue;
+        counters.bytes_sent += port_counters.tx;
+        counters.bytes_received += port_counters.rx;
+        counted = true;
+    }
+
+    if (not counted) {
+        counters.bytes_received = (this->serial_bytes_read) ? *(const volatile int *) this->serial_bytes_read : 0;
+        counters.exact_bytes_sent = false;
+    }
+}
+
+/* Make the line for the time between two samples */
+string bus_profiler::format(const string &datetime, const string &device, const profile_counters &from, const profile_counters &to)
+{
+    double seconds = chrono::duration<double>(to.when - from.when).count();
+    uint32_t frames_sent = to.frames_sent - from.frames_sent;
+    uint32_t frames_received = to.frames_received - from.frames_received;
+    uint32_t retries = (frames_sent > frames_received) ? frames_sent - frames_received : 0;
+    uint32_t bytes_received = to.bytes_received - from.bytes_received;
+    uint32_t bytes_sent = (to.exact_bytes_sent) ? to.bytes_sent - from.bytes_sent : frames_sent * PROFILE_REQUEST_BYTES;
+
+    double wire_time = (double) (bytes_sent + bytes_received) * PROFILE_BITS_PER_BYTE / this->baudrate;
+    size_t port_count = (this->ports.empty()) ? 1 : this->ports.size();
+    double utilisation = (seconds > 0) ? 100.0 * wire_time / (seconds * port_count) : NAN;
+
+    return datetime + "," + device + "," + format_number(seconds) + "," + to_string(frames_sent) + "," + to_string(frames_received) + "," +
+           to_string(retries) + "," + to_string(bytes_sent) + "," + to_string(bytes_received) + "," +
+           (to.exact_bytes_sent ? "1" : "0") + "," + format_number(wire_time) + "," + format_number(utilisation);
+}
+
+/* A sweep is starting */
+void bus_profiler::begin_sweep()
+{
+    if (not this->enabled) return;
+    this->device_lines.clear();
+    sample(this->sweep_start);
+}
+
+/* A device is about to be read */
+void bus_profiler::begin_device()
+{
+    if (not this->enabled) return;
+    sample(this->device_start);
+}
+
+/* A device has been read. Its line is kept until the end of the sweep */
+void bus_profiler::end_device(const string &device)
+{
+    if (not this->enabled) return;
+    profile_counters now;
+    sample(now);
+    this->device_lines.push_back(format("", device, this->device_start, now));
+}
+
+/* The sweep has ended. The lines for each device and then one for the whole sweep (with a device name
+   of 'sweep') are added to 'lines' */
+void bus_profiler::end_sweep(const string &datetime, vector <string> &lines)
+{
+    if (not this->enabled) return;
+
+    profile_counters now;
+    sample(now);
+
+    /* The devices' lines were made (without a time) before the sweep's time was known */
+    for (size_t i = 0; i < this->device_lines.size(); i++) {
+        lines.push_back(datetime + this->device_lines[i]);
+    }
+    lines.push_back(format(datetime, "sweep", this->sweep_start, now));
+    this->device_lines.clear();
+}
+
+/* The header of the profile log */
+string bus_profiler::header()
+{
+    return "#Datetime,device,seconds,frames sent,frames received,retries,bytes sent,bytes received,bytes sent counted,wire time(s),utilisation(%)";
+}
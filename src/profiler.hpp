@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef PROFILER_HPP_INCLUDED
+#define PROFILER_HPP_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+/* Name of the directory (in the logging directory) for the profile logs */
+#define PROFILE_DIRECTORY "profile"
+/* Bits on the wire for each byte: a start bit, 8 data bits and a stop bit */
+#define PROFILE_BITS_PER_BYTE 10
+/* YASDI's baud rate for a serial port that has no Baudrate in yasdi.ini */
+#define PROFILE_DEFAULT_BAUDRATE 19200
+/* Size of a request frame (SMANet framing around a short SMAData command). Only used to estimate the bytes
+   sent when the serial port can't count them */
+#define PROFILE_REQUEST_BYTES 20
+/* The serial driver that YASDI loads, which counts the bytes it reads */
+#define PROFILE_SERIAL_DRIVER "libyasdi_drv_serial.so"
+
+using namespace std;
+
+/* One serial port from yasdi.ini */
+struct profile_port {
+    string name; /* eg; COM1 */
+    string device; /* eg; /dev/ttyUSB0 */
+    long baudrate;
+    int fd; /* opened only to read the port's counters, or -1 */
+};
+
+/* The bus counters at one point in time */
+struct profile_counters {
+    chrono::steady_clock::time_point when;
+    /* These wrap, like YASDI's own counters. Only the differences are used */
+    uint32_t frames_sent;
+    uint32_t frames_received;
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+    bool exact_bytes_sent; /* false if the port can't count the bytes sent */
+};
+
+/* This class profiles how busy the bus is. YASDI counts every frame that it sends and receives (the counters
+   behind its statistic writer), and its serial driver counts the bytes it reads. Where the serial port supports
+   TIOCGICOUNT, the bytes sent and received are read from the port itself. The counters are sampled around each
+   device's read and around the whole sweep. From the bytes, the time they take on the wire at the Baudrate in
+   yasdi.ini is worked out, and the utilisation is that time as a share of the time taken. With several ports,
+   the bytes are added up and the utilisation is the average over the ports.
+
+   Retries are not counted by YASDI, so they are estimated: each request that gets no answer is sent again, so
+   the frames sent beyond the frames received are taken as retries.
+
+   Until it is initialized, the profiler does nothing, so the calls can be left in the polling loop */
+class bus_profiler
+{
+    public:
+        bus_profiler();
+        ~bus_profiler();
+        bool initialize(const string &conf_file);
+        void begin_sweep();
+        void begin_device();
+        void end_device(const string &device);
+        void end_sweep(const string &datetime, vector <string> &lines);
+        static string header();
+
+    private:
+        void sample(profile_counters &counters);
+        string format(const string &datetime, const string &device, const profile_counters &from, const profile_counters &to);
+        void read_ports(const string &conf_file);
+
+        bool enabled;
+        vector <profile_port> ports;
+        long baudrate; /* of the first port */
+        const uint32_t *packets_written; /* YASDI's counters, or NULL if not found */
+        const uint32_t *packets_read;
+        const int *serial_bytes_read;
+        void *serial_driver;
+        profile_counters sweep_start;
+        profile_counters device_start;
+        vector <string> device_lines;
+};
+
+#endif /* PROFILER_HPP_INCLUDED */
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
+#include <chrono>
+#include <sstream>
+#include "query.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Constructor for the query_server class. Nothing is listening until start() is called */
+query_server::query_server()
+{
+    this->listen_fd = -1;
+    this->active_clients = 0;
+    this->running = false;
+}
+
+query_server::~query_server()
+{
+    stop();
+}
+
+/* Create the socket and start accepting clients */
+bool query_server::start(string socket_path)
+{
+    struct sockaddr_un address;
+
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        LOG_ERROR("Query socket path is too long: " << socket_path);
+        return false;
+    }
+
+    this->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->listen_fd < 0) {
+        LOG_ERROR("Could not create the query socket");
+        return false;
+    }
+
+    /* Remove a stale socket left behind by a previous run */
+    unlink(socket_path.c_str());
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path)-1);
+    if ((bind(this->listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0) or (listen(this->listen_fd, QUERY_MAX_CLIENTS) != 0)) {
+        LOG_ERROR("Could not bind the query socket: " << socket_path);
+        close(this->listen_fd);
+        this->listen_fd = -1;
+        return false;
+    }
+
+    this->socket_path = socket_path;
+    this->running = true;
+    this->accept_thread = thread(&query_server::accept_loop, this);
+    LOG_DEBUG("Listening for queries on: " << socket_path);
+
+    return true;
+}
+
+/* Stop accepting clients, and wait for the ones being served to finish. Their threads are detached but use
+   this object, so this doesn't return while any of them is still running */
+void query_server::stop()
+{
+    {
+        unique_lock<mutex> lock(this->cache_mutex);
+        if (not this->running) return;
+        this->running = false;
+    }
+
+    /* Wake up accept() and any clients waiting on a value */
+    shutdown(this->listen_fd, SHUT_RDWR);
+    this->value_ready.notify_all();
+    this->accept_thread.join();
+    close(this->listen_fd);
+    this->listen_fd = -1;
+    unlink(this->socket_path.c_str());
+
+    /* Cut off the clients still being served, so that none of them holds this up. Once they are cut off and
+       woken up, each of them can only be held up by its socket timeouts (QUERY_CLIENT_TIMEOUT) */
+    unique_lock<mutex> lock(this->cache_mutex);
+    for (set <int>::iterator it = this->client_fds.begin(); it != this->client_fds.end(); ++it) {
+        shutdown(*it, SHUT_RDWR);
+    }
+    if (not this->value_ready.wait_for(lock, chrono::seconds(QUERY_CLIENT_TIMEOUT), [this] { return this->active_clients == 0; })) {
+        LOG_ERROR(this->active_clients << " query clients did not finish in time. Waiting for them");
+        this->value_ready.wait(lock, [this] { return this->active_clients == 0; });
+    }
+}
+
+/* Store a value that has been read from the bus. Anyone waiting on it is woken up */
+void query_server::update(string device, string channel, string value, string units)
+{
+    string key = device + "\t" + channel;
+
+    lock_guard<mutex> lock(this->cache_mutex);
+    query_entry &entry = this->cache[key];
+    entry.device = device;
+    entry.channel = channel;
+    entry.value = value;
+    entry.units = units;
+    entry.error = "";
+    entry.timestamp = time(nullptr);
+
+    if (entry.pending or entry.in_flight) {
+        entry.pending = false;
+        entry.in_flight = false;
+        entry.generation++;
+        this->value_ready.notify_all();
+    }
+}
+
+/* Mark a queued request as failed. Anyone waiting on it is woken up */
+void query_server::fail(string device, string channel, string error)
+{
+    string key = device + "\t" + channel;
+
+    lock_guard<mutex> lock(this->cache_mutex);
+    query_entry &entry = this->cache[key];
+    entry.error = error;
+    entry.pending = false;
+    entry.in_flight = false;
+    entry.generation++;
+    this->value_ready.notify_all();
+}
+
+/* Get the next value that must be read from the bus. Returns false if there are none */
+bool query_server::next_request(string &device, string &channel)
+{
+    lock_guard<mutex> lock(this->cache_mutex);
+    while (not this->queue.empty()) {
+        string key = this->queue.front();
+        this->queue.pop_front();
+
+        /* It may have been filled by the polling loop while it was queued */
+        map <string, query_entry>::iterator it = this->cache.find(key);
+        if ((it == this->cache.end()) or (not it->second.pending)) continue;
+
+        it->second.pending = false;
+        it->second.in_flight = true;
+        device = it->second.device;
+        channel = it->second.channel;
+        return true;
+    }
+
+    return false;
+}
+
+/* Sleep until 'deadline', or until a request is queued. Returns true if there are requests to serve */
+bool query_server::wait_for_requests(time_t deadline)
+{
+    unique_lock<mutex> lock(this->cache_mutex);
+    return this->request_ready.wait_until(lock, chrono::system_clock::from_time_t(deadline),
+                                          [this] { return not this->queue.empty(); });
+}
+
+/* Body of the accept thread. Each client gets its own thread, up to QUERY_MAX_CLIENTS */
+void query_server::accept_loop()
+{
+    while (true) {
+        int client_fd = accept(this->listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            lock_guard<mutex> lock(this->cache_mutex);
+            if (not this->running) break;
+            continue;
+        }
+
+        {
+            lock_guard<mutex> lock(this->cache_mutex);
+            if (this->active_clients >= QUERY_MAX_CLIENTS) {
+                string busy = "error,busy\n";
+                send(client_fd, busy.c_str(), busy.size(), MSG_NOSIGNAL);
+                close(client_fd);
+                continue;
+            }
+            this->active_clients++;
+            this->client_fds.insert(client_fd);
+        }
+
+        thread(&query_server::handle_client, this, client_fd).detach();
+    }
+}
+
+/* Read one request line from a client and reply to it */
+void query_server::handle_client(int client_fd)
+{
+    char buffer[QUERY_LINE_SIZE];
+    size_t length = 0;
+    ssize_t received;
+    string reply;
+
+    /* A client that connects and then sends nothing (or never reads the reply) must not keep its thread */
+    struct timeval timeout;
+    timeout.tv_sec = QUERY_CLIENT_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Read up to the first newline */
+    while (length < sizeof(buffer) - 1) {
+        received = recv(client_fd, buffer + length, sizeof(buffer) - 1 - length, 0);
+        if (received <= 0) break;
+        length += received;
+        if (memchr(buffer, '\n', length)) break;
+    }
+    buffer[length] = '\0';
+
+    string device, channel, max_age_raw;
+    long max_age = QUERY_MAX_AGE;
+    istringstream request(buffer);
+    request >> device >> channel >> max_age_raw;
+
+    if (device.empty() or channel.empty()) {
+        reply = "error,expected: <device> <channel> [max age]\n";
+    }
+    else if ((not max_age_raw.empty()) and (not convert_long(max_age_raw, &max_age))) {
+        reply = "error,max age must be a number\n";
+    }
+    else {
+        reply = lookup(device, channel, (int) max_age);
+    }
+
+    send(client_fd, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+
+    /* Closed under the lock, so that stop() never shuts down a descriptor that has been reused */
+    lock_guard<mutex> lock(this->cache_mutex);
+    this->client_fds.erase(client_fd);
+    close(client_fd);
+    this->active_clients--;
+    this->value_ready.notify_all();
+}
+
+/* Get a value from the cache if it is fresh enough, otherwise queue it for the bus and wait */
+string query_server::lookup(string device, string channel, int max_age)
+{
+    string key = device + "\t" + channel;
+
+    unique_lock<mutex> lock(this->cache_mutex);
+    query_entry &entry = this->cache[key];
+    entry.device = device;
+    entry.channel = channel;
+
+    time_t now = time(nullptr);
+    if ((entry.timestamp == 0) or (now - entry.timestamp > max_age)) {
+        /* If another client is already waiting on this value, just wait with it */
+        if ((not entry.pending) and (not entry.in_flight)) {
+            entry.pending = true;
+            this->queue.push_back(key);
+            this->request_ready.notify_one();
+        }
+
+        unsigned long generation = entry.generation;
+        entry.waiters++;
+        bool done = this->value_ready.wait_for(lock, chrono::seconds(QUERY_TIMEOUT),
+                                               [this, &entry, generation] { return (entry.generation != generation) or (not this->running); });
+        entry.waiters--;
+        if (not done) {
+            return "error,timed out\n";
+        }
+        if (not entry.error.empty()) {
+            string reply = "error," + entry.error + "\n";
+            /* Don't keep entries for devices or channels that don't exist */
+            if ((entry.timestamp == 0) and (entry.waiters == 0) and (not entry.pending) and (not entry.in_flight)) {
+                this->cache.erase(key);
+            }
+            return reply;
+        }
+        if (entry.timestamp == 0) {
+            return "error,shutting down\n";
+        }
+        now = time(nullptr);
+    }
+
+    return "ok," + entry.value + "," + entry.units + "," + to_string((long) (now - entry.timestamp)) + "\n";
+}
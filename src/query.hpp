@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef QUERY_HPP_INCLUDED
+#define QUERY_HPP_INCLUDED
+
+#include <string>
+#include <map>
+#include <set>
+#include <deque>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* Default maximum age (in seconds) of a cached value before a query goes to the bus */
+#define QUERY_MAX_AGE 30
+/* How long a client will wait for a value to be read from the bus */
+#define QUERY_TIMEOUT 120
+/* Maximum number of clients being served at once */
+#define QUERY_MAX_CLIENTS 16
+#define QUERY_LINE_SIZE 256
+/* How long (in seconds) a client has to send its request, or to take the reply */
+#define QUERY_CLIENT_TIMEOUT 5
+
+using namespace std;
+
+/* A channel value in the cache. If 'pending' or 'in_flight' is set, it is also a request for the bus */
+struct query_entry {
+    string device;
+    string channel;
+    string value;
+    string units;
+    string error;
+    time_t timestamp;
+    bool pending;
+    bool in_flight;
+    int waiters;
+    unsigned long generation;
+};
+
+/* This class serves channel values on a Unix domain socket. Each request is a line of the form
+   "<device> <channel> [max age]", and the reply is "ok,<value>,<units>,<age>" or "error,<reason>".
+   Values come from a cache filled by the polling loop. If the cached value is too old, the request is
+   queued for the bus, and the polling loop reads it between its scheduled reads. Clients asking
+   for the same value at the same time share a single bus read */
+class query_server
+{
+    public:
+        query_server();
+        ~query_server();
+        bool start(string socket_path);
+        void stop();
+        void update(string device, string channel, string value, string units);
+        void fail(string device, string channel, string error);
+        bool next_request(string &device, string &channel);
+        bool wait_for_requests(time_t deadline);
+
+    private:
+        void accept_loop();
+        void handle_client(int client_fd);
+        string lookup(string device, string channel, int max_age);
+
+        map <string, query_entry> cache;
+        deque <string> queue;
+        string socket_path;
+        int listen_fd;
+        int active_clients;
+        set <int> client_fds; /* of the clients being served */
+        bool running;
+        thread accept_thread;
+        mutex cache_mutex;
+        condition_variable value_ready;
+        condition_variable request_ready;
+};
+
+#endif /* QUERY_HPP_INCLUDED */
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/* ardexa-sma-range prints the logged rows of one or more devices over a time range, using the time
+   index next to each daily log to read only the rows that are needed. For example, the last hour:
+
+       ardexa-sma-range -l /opt/ardexa/sma/logs -d WR21TL06_SN:2001234567 -s 3600
+
+   Each row is printed with the device name in front of it */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include "utils.hpp"
+#include "timeindex.hpp"
+
+#define DEFAULT_LOG_DIRECTORY "/opt/ardexa/sma/logs"
+
+using namespace std;
+
+/* Global variables. */
+int g_debug = 0;
+
+static void usage()
+{
+    cout << "Usage: ardexa-sma-range -d device[,device...] [-l log directory] [-f from datetime] [-t to datetime] [-s seconds back]" << endl;
+    cout << "Datetimes are as in the logs, eg; 2018-03-01T10:15:00+1000. The default is up to now" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    string log_directory = DEFAULT_LOG_DIRECTORY;
+    string device_list, from_raw, to_raw, back_raw;
+
+    while ((opt = getopt(argc, argv, "l:d:f:t:s:")) != -1) {
+        switch (opt) {
+            case 'l':
+                log_directory = optarg;
+                break;
+            case 'd':
+                device_list = optarg;
+                break;
+            case 'f':
+                from_raw = optarg;
+                break;
+            case 't':
+                to_raw = optarg;
+                break;
+            case 's':
+                back_raw = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    time_t to = time(nullptr);
+    time_t from = 0;
+    long back = 0;
+    if ((not to_raw.empty()) and (not parse_datetime(to_raw, &to))) {
+        cout << "Cannot read the 'to' datetime: " << to_raw << endl;
+        usage();
+        return 1;
+    }
+    if (not from_raw.empty()) {
+        if (not parse_datetime(from_raw, &from)) {
+            cout << "Cannot read the 'from' datetime: " << from_raw << endl;
+            usage();
+            return 1;
+        }
+    }
+    else if ((convert_long(back_raw, &back)) and (back >= 0)) {
+        from = to - back;
+    }
+    else {
+        cout << "Either a 'from' datetime or a number of seconds back is needed" << endl;
+        usage();
+        return 1;
+    }
+    if (device_list.empty()) {
+        usage();
+        return 1;
+    }
+
+    stringstream devices(device_list);
+    string device;
+    while (getline(devices, device, ',')) {
+        vector <string> lines;
+        read_device_range(log_directory, device, from, to, lines);
+        for (size_t i = 0; i < lines.size(); i++) {
+            cout << device << "," << lines[i] << "\n";
+        }
+    }
+    cout.flush();
+
+    return 0;
+}
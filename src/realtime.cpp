@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include "realtime.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Microseconds between two points in time, clamped to fit a sample */
+static uint32_t elapsed_us(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to)
+{
+    long long us = chrono::duration_cast<chrono::microseconds>(to - from).count();
+    if (us < 0) return 0;
+    if (us > UINT32_MAX) return UINT32_MAX;
+    return us;
+}
+
+/* Parse a list of CPUs such as "1" or "0,2-3" */
+bool parse_cpu_list(const string &cpus, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    stringstream list(cpus);
+    string item;
+    int found = 0;
+    while (getline(list, item, ',')) {
+        char *end = NULL;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+        if (end == item.c_str()) return false;
+        if (*end == '-') {
+            const char *second = end + 1;
+            last = strtol(second, &end, 10);
+            if (end == second) return false;
+        }
+        if ((*end != '\0') or (first < 0) or (last < first) or (last >= CPU_SETSIZE)) return false;
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+            found++;
+        }
+    }
+    return (found > 0);
+}
+
+/* Constructor for the latency_stats class */
+latency_stats::latency_stats()
+{
+    reset();
+}
+
+/* Add a sample. The oldest is overwritten when the samples are full */
+void latency_stats::add(uint32_t microseconds)
+{
+    this->samples[this->next] = microseconds;
+    this->next = (this->next + 1) % RT_SAMPLES;
+    this->count++;
+    if (microseconds > this->worst) this->worst = microseconds;
+}
+
+void latency_stats::reset()
+{
+    this->next = 0;
+    this->count = 0;
+    this->worst = 0;
+}
+
+/* Median, 99th percentile and worst, in microseconds */
+string latency_stats::summary()
+{
+    if (this->count == 0) return "none";
+
+    size_t kept = (this->count < RT_SAMPLES) ? this->count : RT_SAMPLES;
+    vector <uint32_t> sorted(this->samples, this->samples + kept);
+    sort(sorted.begin(), sorted.end());
+    uint32_t median = sorted[kept / 2];
+    uint32_t p99 = sorted[(kept * 99) / 100];
+
+    return "p50 " + to_string(median) + " p99 " + to_string(p99) + " max " + to_string(this->worst) +
+           " jitter " + to_string(p99 - median) + " us (" + to_string(this->count) + ")";
+}
+
+/* Constructor for the bus_thread class */
+bus_thread::bus_thread()
+{
+    this->priority = 0;
+    this->running = false;
+    this->call = NULL;
+}
+
+bus_thread::~bus_thread()
+{
+    stop();
+}
+
+/* Start the thread. With a priority of 1 to 99 it runs under SCHED_FIFO, and all of the process's memory is
+   locked. With 0 it has normal scheduling, which is useful as a baseline for the measurements.
+   'cpus' (eg; "1" or "2-3") pins it to those CPUs, or is empty */
+bool bus_thread::start(int priority, const string &cpus)
+{
+    this->priority = priority;
+    this->cpus = cpus;
+
+    /* Page faults on the bus thread would be as bad as being preempted. MCL_ONFAULT locks pages as they are
+       first touched, rather than making every thread stack resident up front */
+    if (priority > 0) {
+        int flags = MCL_CURRENT | MCL_FUTURE;
+#ifdef MCL_ONFAULT
+        flags |= MCL_ONFAULT;
+#endif
+        if (mlockall(flags) != 0) {
+            LOG_ERROR("Could not lock memory: " << strerror(errno));
+        }
+    }
+
+    lock_guard<mutex> lock(this->call_mutex);
+    this->running = true;
+    this->last_report = chrono::steady_clock::now();
+    this->io_thread = thread(&bus_thread::body, this);
+    this->io_thread_id = this->io_thread.get_id();
+    return true;
+}
+
+/* Stop the thread, after any call in progress. The measurements are reported a last time */
+void bus_thread::stop()
+{
+    {
+        lock_guard<mutex> lock(this->call_mutex);
+        if (not this->running) return;
+        this->running = false;
+    }
+    this->call_ready.notify_one();
+    this->io_thread.join();
+    report();
+}
+
+/* Check if this is the bus thread */
+bool bus_thread::is_current()
+{
+    return (this_thread::get_id() == this->io_thread_id);
+}
+
+/* Make a call on the bus thread, and wait for it to finish. Returns false (without making the call)
+   if the thread is not running */
+bool bus_thread::run(const function<void()> &call)
+{
+    lock_guard<mutex> caller(this->caller_mutex);
+    unique_lock<mutex> lock(this->call_mutex);
+    if (not this->running) return false;
+
+    this->call = &call;
+    this->call_posted = chrono::steady_clock::now();
+    this->call_ready.notify_one();
+    this->call_done.wait(lock, [this] { return this->call == NULL; });
+    return true;
+}
+
+/* Scheduling, affinity and a prefaulted stack. Called on the bus thread */
+void bus_thread::setup()
+{
+    volatile char stack[RT_STACK_PREFAULT];
+    memset((char *) stack, 0, sizeof(stack));
+
+    if (this->priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = this->priority;
+        int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (result != 0) LOG_ERROR("Could not run the bus thread under SCHED_FIFO: " << strerror(result));
+    }
+
+    if (not this->cpus.empty()) {
+        cpu_set_t set;
+        parse_cpu_list(this->cpus, &set);
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (result != 0) LOG_ERROR("Could not pin the bus thread to CPUs " << this->cpus << ": " << strerror(result));
+    }
+}
+
+/* Body of the bus thread. It makes the calls it is handed, and while idle it wakes every RT_PROBE_INTERVAL
+   to measure how late it wakes */
+void bus_thread::body()
+{
+    setup();
+
+    chrono::microseconds interval(RT_PROBE_INTERVAL);
+    chrono::steady_clock::time_point probe = chrono::steady_clock::now() + interval;
+
+    unique_lock<mutex> lock(this->call_mutex);
+    while ((this->running) or (this->call)) {
+        if (this->call) {
+            chrono::steady_clock::time_point started = chrono::steady_clock::now();
+            uint32_t waited = elapsed_us(this->call_posted, started);
+            const function<void()> *call = this->call;
+
+            lock.unlock();
+            (*call)();
+            uint32_t took = elapsed_us(started, chrono::steady_clock::now());
+            {
+                lock_guard<mutex> stats(this->stats_mutex);
+                this->dispatch.add(waited);
+                if (took >= RT_BUS_REQUEST) this->requests.add(took);
+            }
+            lock.lock();
+
+            this->call = NULL;
+            this->call_done.notify_all();
+            probe = chrono::steady_clock::now() + interval;
+            continue;
+        }
+
+        if (this->call_ready.wait_until(lock, probe, [this] { return (this->call) or (not this->running); })) continue;
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        {
+            lock_guard<mutex> stats(this->stats_mutex);
+            this->wakeup.add(elapsed_us(probe, now));
+        }
+        probe += interval;
+        if (probe < now) probe = now + interval;
+    }
+}
+
+/* Report the measurements if RT_REPORT_INTERVAL has passed since the last report. Called from a normal thread */
+void bus_thread::report_if_due()
+{
+    {
+        lock_guard<mutex> lock(this->call_mutex);
+        if (not this->running) return;
+    }
+    if (chrono::steady_clock::now() - this->last_report >= chrono::seconds(RT_REPORT_INTERVAL)) {
+        report();
+    }
+}
+
+/* Log the measurements since the last report, and start again. The samples are copied out under the lock
+   and formatted afterwards, so the bus thread is never held up by the formatting */
+void bus_thread::report()
+{
+    latency_stats *copies = new latency_stats[3];
+    {
+        lock_guard<mutex> stats(this->stats_mutex);
+        copies[0] = this->wakeup;
+        copies[1] = this->dispatch;
+        copies[2] = this->requests;
+        this->wakeup.reset();
+        this->dispatch.reset();
+        this->requests.reset();
+    }
+    this->last_report = chrono::steady_clock::now();
+
+    string scheduling = (this->priority > 0) ? "SCHED_FIFO " + to_string(this->priority) : "normal scheduling";
+    if (not this->cpus.empty()) scheduling += ", CPUs " + this->cpus;
+    LOG_INFO("Bus thread (" << scheduling << ") wakeup latency: " << copies[0].summary());
+    LOG_INFO("Bus thread dispatch latency: " << copies[1].summary());
+    LOG_INFO("Bus thread request time: " << copies[2].summary());
+    delete [] copies;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef REALTIME_HPP_INCLUDED
+#define REALTIME_HPP_INCLUDED
+
+#include <stdint.h>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+/* Number of recent samples kept for each measurement. Percentiles are taken over these */
+#define RT_SAMPLES 4096
+/* While idle, the bus thread wakes this often (in microseconds) to measure its wakeup latency */
+#define RT_PROBE_INTERVAL 10000
+/* Library calls that take at least this long (in microseconds) went out on the bus. Quicker ones were
+   answered from the library's cache, and are left out of the request times */
+#define RT_BUS_REQUEST 1000
+/* Seconds between reports of the measurements */
+#define RT_REPORT_INTERVAL 300
+/* Bytes of stack touched when the bus thread starts, so it is faulted in before it is locked */
+#define RT_STACK_PREFAULT (64 * 1024)
+
+using namespace std;
+
+/* The most recent samples of one measurement, in microseconds. Preallocated, so adding a sample from
+   the bus thread never allocates */
+class latency_stats
+{
+    public:
+        latency_stats();
+        void add(uint32_t microseconds);
+        void reset();
+        string summary();
+
+    private:
+        uint32_t samples[RT_SAMPLES];
+        size_t next;
+        size_t count;
+        uint32_t worst;
+};
+
+/* This class is the thread that makes every call to the YASDI library (see yasdi_bus). It can run under
+   SCHED_FIFO, pinned to some CPUs, with all of the process's memory locked, so that other processes on a
+   busy gateway don't preempt it between RS485 frames. Threads that YASDI starts from it (for the serial
+   driver) inherit its scheduling and affinity. Everything else (formatting, logging, writing files) stays on
+   the normal threads: a caller hands a call over with run() and waits for it.
+
+   Three things are measured, so the benefit can be quantified (run with a priority of 0 for a baseline):
+   the wakeup latency of the thread (how late it wakes from a timed sleep while idle), the dispatch latency
+   (from a call being handed over to it starting), and the time of library calls that went out on the bus,
+   with their jitter (the 99th percentile less the median) */
+class bus_thread
+{
+    public:
+        bus_thread();
+        ~bus_thread();
+        bool start(int priority, const string &cpus);
+        void stop();
+        bool is_current();
+        bool run(const function<void()> &call);
+        void report_if_due();
+        void report();
+
+    private:
+        void body();
+        void setup();
+
+        int priority;
+        string cpus;
+        bool running;
+        thread io_thread;
+        thread::id io_thread_id;
+        mutex caller_mutex; /* one call at a time */
+        mutex call_mutex;
+        condition_variable call_ready;
+        condition_variable call_done;
+        const function<void()> *call; /* the call to make, or NULL */
+        chrono::steady_clock::time_point call_posted;
+        chrono::steady_clock::time_point last_report;
+
+        mutex stats_mutex;
+        latency_stats wakeup;
+        latency_stats dispatch;
+        latency_stats requests;
+};
+
+bool parse_cpu_list(const string &cpus, cpu_set_t *set);
+
+#endif /* REALTIME_HPP_INCLUDED */
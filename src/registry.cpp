@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include "registry.hpp"
+
+using namespace std;
+
+void device_registry::clear()
+{
+    this->devices.clear();
+    this->by_handle.clear();
+    this->by_name.clear();
+}
+
+/* Make room for this many devices, so that the registry is allocated once */
+void device_registry::reserve(size_t count)
+{
+    this->devices.reserve(count);
+    this->by_handle.reserve(count);
+    this->by_name.reserve(count);
+}
+
+/* Add a device. A handle that is already known is left as it is */
+void device_registry::add(DWORD handle, const string &name)
+{
+    if (this->by_handle.find(handle) != this->by_handle.end()) return;
+
+    device_entry device;
+    device.handle = handle;
+    device.name = name;
+    device.channels_known = false;
+    device.schema = NULL;
+    device.segment_due = false;
+    device.driver_known = false;
+    device.driver = 0;
+    this->by_handle[handle] = this->devices.size();
+    this->by_name[name] = this->devices.size();
+    this->devices.push_back(device);
+}
+
+size_t device_registry::size() const
+{
+    return this->devices.size();
+}
+
+bool device_registry::empty() const
+{
+    return this->devices.empty();
+}
+
+device_entry &device_registry::operator[](size_t index)
+{
+    return this->devices[index];
+}
+
+/* Find a device by its handle. Returns NULL if there is no such device */
+device_entry *device_registry::find(DWORD handle)
+{
+    unordered_map <DWORD, size_t>::const_iterator it = this->by_handle.find(handle);
+    return (it != this->by_handle.end()) ? &this->devices[it->second] : NULL;
+}
+
+/* Find a device by its name. Returns NULL if there is no such device */
+device_entry *device_registry::find(const string &name)
+{
+    unordered_map <string, size_t>::const_iterator it = this->by_name.find(name);
+    return (it != this->by_name.end()) ? &this->devices[it->second] : NULL;
+}
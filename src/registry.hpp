@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef REGISTRY_HPP_INCLUDED
+#define REGISTRY_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "bus.hpp"
+#include "channels.hpp"
+
+using namespace std;
+
+/* One spot channel of a device. Its name and units don't change, so they are only asked for once */
+struct channel_entry {
+    DWORD handle;
+    string name; /* the raw SMA name */
+    string units;
+};
+
+/* One device that the library found */
+struct device_entry {
+    DWORD handle;
+    string name; /* with spaces replaced, as used for its log directory */
+    bool channels_known; /* false until its channels have been asked for */
+    vector <channel_entry> channels;
+    vector <vec_data> readings; /* the last values read. Kept so that the next sweep can reuse them */
+    const struct device_schema *schema; /* NULL until it is worked out from the channels (see schema.hpp) */
+    bool segment_due; /* the schema has changed since the last row was logged */
+    bool driver_known; /* false until the route to it has been asked for, after it answered */
+    DWORD driver; /* the driver that reaches it, once 'driver_known' */
+};
+
+/* This class holds the devices that were found, in the order they are polled. They are kept in one vector,
+   with indexes by handle and by name, so a device is found in constant time however many there are. Devices
+   are only added between sweeps, so references to them stay valid for a sweep */
+class device_registry
+{
+    public:
+        void clear();
+        void reserve(size_t count);
+        void add(DWORD handle, const string &name);
+        size_t size() const;
+        bool empty() const;
+        device_entry &operator[](size_t index);
+        device_entry *find(DWORD handle);
+        device_entry *find(const string &name);
+
+    private:
+        vector <device_entry> devices;
+        unordered_map <DWORD, size_t> by_handle;
+        unordered_map <string, size_t> by_name;
+};
+
+#endif /* REGISTRY_HPP_INCLUDED */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <string.h>
+#include "reload.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Set by the SIGHUP handler */
+static volatile sig_atomic_t g_reload_requested = 0;
+
+static void sighup_handler(int signal_number)
+{
+    g_reload_requested = 1;
+}
+
+/* Constructor for the settings_watcher class. Nothing is watched until start() is called */
+settings_watcher::settings_watcher()
+{
+    this->inotify_fd = -1;
+}
+
+settings_watcher::~settings_watcher()
+{
+    if (this->inotify_fd >= 0) close(this->inotify_fd);
+}
+
+/* Catch SIGHUP, and watch the directory of the settings file. The directory is watched
+   rather than the file, since many tools replace a file rather than writing it in place */
+bool settings_watcher::start(string settings_file)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sighup_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+
+    string directory = ".";
+    this->file_name = settings_file;
+    size_t slash = settings_file.rfind('/');
+    if (slash != string::npos) {
+        directory = settings_file.substr(0, slash + 1);
+        this->file_name = settings_file.substr(slash + 1);
+    }
+
+    this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->inotify_fd < 0) {
+        LOG_ERROR("Could not watch the settings file. Use SIGHUP to reload it");
+        return false;
+    }
+    if (inotify_add_watch(this->inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        LOG_ERROR("Could not watch the settings directory: " << directory << ". Use SIGHUP to reload it");
+        close(this->inotify_fd);
+        this->inotify_fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+/* Check (without blocking) if the settings should be reloaded */
+bool settings_watcher::changed()
+{
+    bool reload = false;
+
+    if (g_reload_requested) {
+        g_reload_requested = 0;
+        LOG_DEBUG("SIGHUP received");
+        reload = true;
+    }
+
+    if (this->inotify_fd < 0) return reload;
+
+    /* Drain all pending events, looking for the settings file */
+    char buffer[INOTIFY_BUFFER_SIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(this->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *pointer = buffer; pointer < buffer + length; ) {
+            struct inotify_event *event = (struct inotify_event *) pointer;
+            if ((event->len > 0) and (this->file_name == event->name)) {
+                LOG_DEBUG("Settings file changed");
+                reload = true;
+            }
+            pointer += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return reload;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RELOAD_HPP_INCLUDED
+#define RELOAD_HPP_INCLUDED
+
+#include <string>
+#include <signal.h>
+
+#define INOTIFY_BUFFER_SIZE 4096
+
+using namespace std;
+
+/* This class tells the main loop when the settings file should be reloaded. That is when
+   a SIGHUP is received, or when the file is written or replaced (eg; by an editor or a deployment tool) */
+class settings_watcher
+{
+    public:
+        settings_watcher();
+        ~settings_watcher();
+        bool start(string settings_file);
+        bool changed();
+
+    private:
+        int inotify_fd;
+        string file_name;
+};
+
+#endif /* RELOAD_HPP_INCLUDED */
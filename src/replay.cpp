@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <dirent.h>
+#include <algorithm>
+#include <sstream>
+#include "replay.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+#include "fleet.hpp"
+#include "rollup.hpp"
+#include "anomaly.hpp"
+#include "profiler.hpp"
+#include "endpoints.hpp"
+#include "parameters.hpp"
+#include "sitelog.hpp"
+#include "schema.hpp"
+
+using namespace std;
+
+/* List the names in a directory, sorted */
+static vector <string> list_directory(const string &directory)
+{
+    vector <string> names;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) return names;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    }
+    closedir(dir);
+
+    sort(names.begin(), names.end());
+    return names;
+}
+
+/* Constructor for the replay_source class */
+replay_source::replay_source()
+{
+}
+
+replay_source::~replay_source()
+{
+    for (size_t i = 0; i < this->streams.size(); i++) delete this->streams[i];
+}
+
+/* Find the devices and their daily logs in a logging directory, and read the first row of each */
+bool replay_source::open(const string &directory)
+{
+    vector <string> names = list_directory(directory);
+    for (size_t i = 0; i < names.size(); i++) {
+        /* These hold the outputs made from the device logs, not device logs */
+        if ((names[i] == FLEET_DIRECTORY) or (names[i] == ROLLUP_DIRECTORY) or (names[i] == ANOMALY_DIRECTORY) or
+            (names[i] == PROFILE_DIRECTORY) or (names[i] == ENDPOINT_DIRECTORY) or
+            (names[i] == PARAMETER_DIRECTORY) or (names[i] == SITE_DIRECTORY) or (names[i] == SCHEMA_DIRECTORY)) continue;
+
+        string device_dir = directory + "/" + names[i];
+        if (not check_directory(device_dir)) continue;
+
+        replay_stream *stream = new replay_stream;
+        stream->device = names[i];
+        stream->directory = device_dir;
+        stream->next_file = 0;
+        stream->has_row = false;
+
+        vector <string> files = list_directory(device_dir);
+        for (size_t j = 0; j < files.size(); j++) {
+            if (is_daily_log(files[j])) stream->files.push_back(files[j]);
+        }
+
+        if ((stream->files.empty()) or (not advance(*stream))) {
+            delete stream;
+            continue;
+        }
+        LOG_DEBUG("Replaying " << stream->files.size() << " days of device: " << stream->device);
+        this->streams.push_back(stream);
+    }
+
+    return not this->streams.empty();
+}
+
+/* Number of devices being replayed */
+size_t replay_source::get_devices()
+{
+    return this->streams.size();
+}
+
+/* Read the next row of a device, moving on to its next file when needed. Returns false when there are no more */
+bool replay_source::advance(replay_stream &stream)
+{
+    string line;
+    stream.has_row = false;
+
+    while (true) {
+        if (not getline(stream.reader, line)) {
+            if (stream.next_file >= stream.files.size()) return false;
+            stream.reader.close();
+            stream.reader.clear();
+            stream.reader.open((stream.directory + "/" + stream.files[stream.next_file++]).c_str());
+            stream.columns.clear();
+            continue;
+        }
+
+        vector <string> fields;
+        stringstream splitter(line);
+        string field;
+        while (getline(splitter, field, ',')) fields.push_back(field);
+        if (fields.empty()) continue;
+
+        /* The header gives the channel name and units of each column, eg; "grid power(W)" */
+        if (line[0] == '#') {
+            stream.columns = fields;
+            continue;
+        }
+
+        time_t when;
+        if ((stream.columns.empty()) or (not parse_datetime(fields[0], &when))) {
+            LOG_ERROR("Skipping a line that can't be replayed in " << stream.directory << ": " << line);
+            continue;
+        }
+
+        stream.row.device = stream.device;
+        stream.row.when = when;
+        stream.row.data.clear();
+        for (size_t i = 1; (i < fields.size()) and (i < stream.columns.size()); i++) {
+            const string &column = stream.columns[i];
+            /* A null (see schema.hpp) is a value that wasn't read */
+            if ((column.empty()) or (fields[i].empty()) or (fields[i] == SCHEMA_NULL_NUMBER)) continue;
+            if (column == SCHEMA_VERSION_COLUMN) continue;
+
+            vec_data entry;
+            size_t bracket = column.rfind('(');
+            entry.name_units = column;
+            entry.name = (bracket == string::npos) ? column : column.substr(0, bracket);
+            if ((bracket != string::npos) and (column[column.size() - 1] == ')')) {
+                entry.units = column.substr(bracket + 1, column.size() - bracket - 2);
+            }
+            /* The raw SMA name is not in the log. replay_logs converts the name back, where it can */
+            entry.channel = entry.name;
+            entry.value = fields[i];
+            stream.row.data.push_back(entry);
+        }
+        stream.has_row = true;
+        return true;
+    }
+}
+
+/* Get the next sweep: the rows (oldest first) up to the first device that repeats, or until 'window' seconds
+   have passed since the first row. Returns false when every log has been read */
+bool replay_source::next_sweep(int window, vector <replay_row> &rows)
+{
+    rows.clear();
+
+    while (true) {
+        replay_stream *oldest = NULL;
+        for (size_t i = 0; i < this->streams.size(); i++) {
+            replay_stream *stream = this->streams[i];
+            if ((stream->has_row) and ((oldest == NULL) or (stream->row.when < oldest->row.when))) oldest = stream;
+        }
+        if (oldest == NULL) break;
+
+        if (not rows.empty()) {
+            if (oldest->row.when - rows[0].when >= window) break;
+            bool repeated = false;
+            for (size_t i = 0; i < rows.size(); i++) {
+                if (rows[i].device == oldest->device) repeated = true;
+            }
+            if (repeated) break;
+        }
+
+        rows.push_back(oldest->row);
+        advance(*oldest);
+    }
+
+    return not rows.empty();
+}
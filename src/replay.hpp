@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef REPLAY_HPP_INCLUDED
+#define REPLAY_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <ctime>
+#include "channels.hpp"
+
+using namespace std;
+
+/* One logged line of one device */
+struct replay_row {
+    string device;
+    time_t when;
+    vector <vec_data> data;
+};
+
+/* The log files of one device, read in date order */
+struct replay_stream {
+    string device;
+    string directory;
+    vector <string> files;
+    size_t next_file;
+    ifstream reader;
+    vector <string> columns; /* from the header of the current file */
+    bool has_row;
+    replay_row row; /* the next row, if 'has_row' */
+};
+
+/* This class reads the per-device log files (<device>/YYYY-MM-DD.csv, as written by 'log_line') in
+   a logging directory, and gives them back as sweeps in time order. The values are turned back into
+   the same 'vec_data' that was read from the bus, using the column names in the file headers */
+class replay_source
+{
+    public:
+        replay_source();
+        ~replay_source();
+        bool open(const string &directory);
+        bool next_sweep(int window, vector <replay_row> &rows);
+        size_t get_devices();
+
+    private:
+        bool advance(replay_stream &stream);
+
+        vector <replay_stream *> streams;
+};
+
+#endif /* REPLAY_HPP_INCLUDED */
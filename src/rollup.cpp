@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sstream>
+#include <fstream>
+#include "rollup.hpp"
+#include "journal.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+static const char *level_names[ROLLUP_LEVELS] = { "5min", "hour", "day" };
+
+/* Start (in local time) of the interval that 'now' falls in */
+time_t rollup_interval_start(int level, time_t now)
+{
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+
+    timeinfo.tm_sec = 0;
+    if (level == ROLLUP_5MIN) {
+        timeinfo.tm_min -= timeinfo.tm_min % 5;
+    }
+    else {
+        timeinfo.tm_min = 0;
+        if (level == ROLLUP_DAY) timeinfo.tm_hour = 0;
+    }
+    timeinfo.tm_isdst = -1;
+
+    return mktime(&timeinfo);
+}
+
+/* Empty a cell, ready for the next interval. The baseline is kept */
+static void reset_cell(rollup_cell &cell)
+{
+    cell.count = 0;
+    cell.sum = 0;
+    cell.min = NAN;
+    cell.max = NAN;
+    cell.first = NAN;
+    cell.last = NAN;
+}
+
+/* Change in a counter (such as E-Total) over an interval. Counted from the end of the previous interval if that is known */
+static double cell_delta(const rollup_cell &cell)
+{
+    if (cell.count == 0) return NAN;
+    double base = (cell.baseline == cell.baseline) ? cell.baseline : cell.first;
+    return cell.last - base;
+}
+
+/* Average over an interval */
+static double cell_average(const rollup_cell &cell)
+{
+    if (cell.count == 0) return NAN;
+    return cell.sum / cell.count;
+}
+
+/* Format a number for the log. Missing values are left empty */
+static string format_value(double number)
+{
+    if (number != number) return "";
+    return convert_double(number);
+}
+
+/* Constructor for the rollup class */
+rollup::rollup()
+{
+}
+
+/* Set where the rollups are written, and load the state left by the previous run */
+void rollup::initialize(string log_directory)
+{
+    this->log_directory = log_directory;
+    this->devices.clear();
+    if (load_checkpoint()) {
+        LOG_DEBUG("Loaded the rollup state of " << this->devices.size() << " devices");
+    }
+}
+
+/* Get the state of a device, creating it if it is new */
+rollup_device &rollup::find_device(const string &device)
+{
+    map <string, rollup_device>::iterator it = this->devices.find(device);
+    if (it != this->devices.end()) return it->second;
+
+    rollup_device &state = this->devices[device];
+    for (int level = 0; level < ROLLUP_LEVELS; level++) {
+        state.start[level] = 0;
+        state.samples[level] = 0;
+        state.resumed[level] = false;
+        for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+            reset_cell(state.cells[level][channel]);
+            state.cells[level][channel].baseline = NAN;
+        }
+    }
+    return state;
+}
+
+/* Add a sweep. First any intervals that have ended (for any device) are closed, and their lines are
+   added to 'files' (keyed by file path, relative to the logging directory). Then the values are added */
+void rollup::process(fleet_table &fleet, time_t now, map <string, vector <string> > &files)
+{
+    time_t starts[ROLLUP_LEVELS];
+    for (int level = 0; level < ROLLUP_LEVELS; level++) {
+        starts[level] = rollup_interval_start(level, now);
+    }
+
+    for (map <string, rollup_device>::iterator it = this->devices.begin(); it != this->devices.end(); ++it) {
+        for (int level = 0; level < ROLLUP_LEVELS; level++) {
+            if ((it->second.start[level] != 0) and (it->second.start[level] != starts[level])) {
+                close_interval(it->first, it->second, level, files);
+            }
+        }
+    }
+
+    for (size_t row = 0; row < fleet.size(); row++) {
+        rollup_device &state = find_device(fleet.device(row));
+        for (int level = 0; level < ROLLUP_LEVELS; level++) {
+            if (state.start[level] == 0) state.start[level] = starts[level];
+            state.samples[level]++;
+
+            for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+                double value = fleet.column(channel)[row];
+                if (value != value) continue;
+
+                rollup_cell &cell = state.cells[level][channel];
+                if (cell.count == 0) {
+                    cell.first = value;
+                    cell.min = value;
+                    cell.max = value;
+                }
+                cell.count++;
+                cell.sum += value;
+                if (value < cell.min) cell.min = value;
+                if (value > cell.max) cell.max = value;
+                cell.last = value;
+            }
+        }
+    }
+}
+
+/* Make the line for an interval that has ended, and start the next one */
+void rollup::close_interval(const string &device, rollup_device &state, int level, map <string, vector <string> > &files)
+{
+    rollup_cell *cells = state.cells[level];
+
+    if (state.samples[level] > 0) {
+        string line = get_datetime(state.start[level]) + "," + device + "," + to_string(state.samples[level]) + "," +
+            format_value(cell_delta(cells[CHANNEL_YIELD])) + "," + format_value(cell_delta(cells[CHANNEL_OP_HOURS])) + "," +
+            format_value(cell_average(cells[CHANNEL_PAC])) + "," + format_value(cells[CHANNEL_PAC].min) + "," + format_value(cells[CHANNEL_PAC].max) + "," +
+            format_value(cell_average(cells[CHANNEL_PDC1])) + "," + format_value(cell_average(cells[CHANNEL_PDC2])) + "," +
+            format_value(cells[CHANNEL_GRIDFREQ].min) + "," + format_value(cells[CHANNEL_GRIDFREQ].max);
+
+        string file = string(ROLLUP_DIRECTORY) + "/" + level_names[level] + "/" + get_date(state.start[level]) + ".csv";
+        if ((state.resumed[level]) and (file_tail_contains_line(this->log_directory + "/" + file, line))) {
+            LOG_INFO("The rollup of " << device << " from " << get_datetime(state.start[level]) << " was logged before the restart. Not logging it again");
+        }
+        else {
+            files[file].push_back(line);
+        }
+    }
+
+    for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+        if (cells[channel].count > 0) cells[channel].baseline = cells[channel].last;
+        reset_cell(cells[channel]);
+    }
+    state.start[level] = 0;
+    state.samples[level] = 0;
+    state.resumed[level] = false;
+}
+
+/* Write the running state to disk. It is written to a temporary file, synced and renamed, so it is never half
+   written. Call this only once the rows of the intervals that have ended are committed (see journal::committed).
+   Each line is: device level start samples channel count sum min max first last baseline */
+void rollup::checkpoint()
+{
+    string path = this->log_directory + "/" + ROLLUP_CHECKPOINT;
+    string temp_path = path + ".tmp";
+
+    FILE *writer = fopen(temp_path.c_str(), "w");
+    if (!writer) {
+        LOG_ERROR("Could not write the rollup state: " << temp_path);
+        return;
+    }
+
+    for (map <string, rollup_device>::iterator it = this->devices.begin(); it != this->devices.end(); ++it) {
+        for (int level = 0; level < ROLLUP_LEVELS; level++) {
+            for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+                rollup_cell &cell = it->second.cells[level][channel];
+                if ((cell.count == 0) and (cell.baseline != cell.baseline)) continue;
+                fprintf(writer, "%s %d %ld %ld %d %ld %.17g %.17g %.17g %.17g %.17g %.17g\n", it->first.c_str(), level,
+                        (long) it->second.start[level], it->second.samples[level], channel, cell.count,
+                        cell.sum, cell.min, cell.max, cell.first, cell.last, cell.baseline);
+            }
+        }
+    }
+
+    /* The state must be on disk before it takes the place of the last one, or a power cut could leave neither */
+    bool written = (fflush(writer) == 0) and (fdatasync(fileno(writer)) == 0);
+    if ((fclose(writer) != 0) or (not written)) {
+        LOG_ERROR("Could not write the rollup state: " << temp_path);
+        return;
+    }
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("Could not replace the rollup state: " << path);
+        return;
+    }
+
+    /* And so must the rename */
+    int directory_fd = open(this->log_directory.c_str(), O_RDONLY);
+    if (directory_fd >= 0) {
+        fsync(directory_fd);
+        close(directory_fd);
+    }
+}
+
+/* Read the state written by 'checkpoint' */
+bool rollup::load_checkpoint()
+{
+    string path = this->log_directory + "/" + ROLLUP_CHECKPOINT;
+    ifstream reader(path.c_str());
+    if (!reader) return false;
+
+    string line;
+    while (getline(reader, line)) {
+        istringstream fields(line);
+        string device;
+        int level = -1, channel = -1;
+        long start = 0, samples = 0, count = 0;
+        string numbers[6];
+
+        fields >> device >> level >> start >> samples >> channel >> count;
+        for (int i = 0; i < 6; i++) fields >> numbers[i];
+        if ((fields.fail()) or (level < 0) or (level >= ROLLUP_LEVELS) or (channel < 0) or (channel >= CHANNEL_COUNT)) {
+            LOG_ERROR("Ignoring a bad line in the rollup state: " << line);
+            continue;
+        }
+
+        rollup_device &state = find_device(device);
+        state.start[level] = start;
+        state.samples[level] = samples;
+        state.resumed[level] = (start != 0);
+        rollup_cell &cell = state.cells[level][channel];
+        cell.count = count;
+        /* strtod (unlike >>) understands "nan" */
+        cell.sum = strtod(numbers[0].c_str(), NULL);
+        cell.min = strtod(numbers[1].c_str(), NULL);
+        cell.max = strtod(numbers[2].c_str(), NULL);
+        cell.first = strtod(numbers[3].c_str(), NULL);
+        cell.last = strtod(numbers[4].c_str(), NULL);
+        cell.baseline = strtod(numbers[5].c_str(), NULL);
+    }
+
+    return true;
+}
+
+/* The header of the rollup logs */
+string rollup::header()
+{
+    return "#Interval start,device,samples,energy yield delta(kWh),operating hours delta(h),ac power avg(W),ac power min(W),ac power max(W),"
+           "string A power avg(W),string B power avg(W),grid freq min(Hz),grid freq max(Hz)";
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef ROLLUP_HPP_INCLUDED
+#define ROLLUP_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include "channels.hpp"
+#include "fleet.hpp"
+
+/* The rollup intervals */
+#define ROLLUP_5MIN 0
+#define ROLLUP_HOUR 1
+#define ROLLUP_DAY 2
+#define ROLLUP_LEVELS 3
+
+/* Name of the directory (in the logging directory) for the rollups, and of the checkpoint file */
+#define ROLLUP_DIRECTORY "rollup"
+#define ROLLUP_CHECKPOINT ".rollup"
+
+using namespace std;
+
+/* Running state of one channel over one interval */
+struct rollup_cell {
+    long count;
+    double sum;
+    double min;
+    double max;
+    double first;
+    double last;
+    double baseline; /* last value of the previous interval, for counters such as E-Total. NaN if unknown */
+};
+
+/* Running state of one device */
+struct rollup_device {
+    time_t start[ROLLUP_LEVELS];
+    long samples[ROLLUP_LEVELS];
+    rollup_cell cells[ROLLUP_LEVELS][CHANNEL_COUNT];
+    bool resumed[ROLLUP_LEVELS]; /* loaded from the checkpoint, so its line may have been logged before a crash */
+};
+
+/* This class keeps running aggregates (count, sum, min, max, first, last) of every channel of every device
+   over 5 minute, hourly and daily intervals. The state is O(1) per device and channel. When an interval
+   ends, a rollup line is made for it. The state is checkpointed to disk after each sweep, so that an interval
+   that is cut by a restart carries on from where it was. If the service stopped after an interval's line was
+   logged but before the checkpoint, the line is already at the end of the log, and isn't logged again */
+class rollup
+{
+    public:
+        rollup();
+        void initialize(string log_directory);
+        void process(fleet_table &fleet, time_t now, map <string, vector <string> > &files);
+        void checkpoint();
+        static string header();
+
+    private:
+        void close_interval(const string &device, rollup_device &state, int level, map <string, vector <string> > &files);
+        bool load_checkpoint();
+        rollup_device &find_device(const string &device);
+
+        map <string, rollup_device> devices;
+        string log_directory;
+};
+
+time_t rollup_interval_start(int level, time_t now);
+
+#endif /* ROLLUP_HPP_INCLUDED */
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "schema.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Constructor for the schema_store class */
+schema_store::schema_store()
+{
+    this->on = false;
+}
+
+void schema_store::initialize(const string &log_directory)
+{
+    this->on = true;
+    this->log_directory = log_directory;
+}
+
+bool schema_store::enabled()
+{
+    return this->on;
+}
+
+/* Get the schema of a device that has 'columns'. If they are not those of its current schema, the next version
+   starts at 'datetime'. Returns true if the device's log needs a new segment (it had a schema, and now has
+   another). The schema is returned in 'schema_out', and stays valid until the next update of the device */
+bool schema_store::update(const string &device, const string columns[CHANNEL_COUNT], const string &datetime, const device_schema **schema_out)
+{
+    map <string, device_schema>::iterator it = this->schemas.find(device);
+    if (it == this->schemas.end()) {
+        device_schema loaded;
+        if (not load(device, loaded)) loaded.version = 0;
+        it = this->schemas.insert(make_pair(device, loaded)).first;
+    }
+    device_schema &schema = it->second;
+    *schema_out = &schema;
+
+    bool same = (schema.version > 0);
+    for (int i = 0; (same) and (i < CHANNEL_COUNT); i++) {
+        if (schema.columns[i] != columns[i]) same = false;
+    }
+    if (same) return false;
+
+    bool segment = (schema.version > 0);
+    schema.version++;
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        schema.columns[i] = columns[i];
+    }
+    schema.header = make_header(columns);
+
+    string block;
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if (columns[i].empty()) continue;
+        if (not block.empty()) block += "\n";
+        block += to_string(schema.version) + "," + datetime + "," + canonical_keys[i] + "," + columns[i] + "," +
+                 (canonical_is_text(i) ? "text" : "number");
+    }
+    if (block.empty()) block = to_string(schema.version) + "," + datetime + ",,,";
+    log_line(this->log_directory + "/" + SCHEMA_DIRECTORY, device + ".csv", block, header(), false);
+    if (segment) LOG_INFO("The channels of " << device << " have changed. Its log carries on with schema version " << schema.version);
+
+    return segment;
+}
+
+/* Read the last version of a device's schema back from its file. Returns false if there is none */
+bool schema_store::load(const string &device, device_schema &schema)
+{
+    ifstream reader((this->log_directory + "/" + SCHEMA_DIRECTORY + "/" + device + ".csv").c_str());
+    string line;
+    long version = 0;
+    while (getline(reader, line)) {
+        if ((line.empty()) or (line[0] == '#')) continue;
+
+        vector <string> fields;
+        stringstream splitter(line);
+        string field;
+        while (getline(splitter, field, ',')) fields.push_back(field);
+        long line_version = 0;
+        if ((fields.size() < 2) or (not convert_long(fields[0], &line_version))) continue;
+
+        if (line_version != version) {
+            version = line_version;
+            for (int i = 0; i < CHANNEL_COUNT; i++) schema.columns[i].clear();
+        }
+        if (fields.size() < 4) continue;
+        for (int i = 0; i < CHANNEL_COUNT; i++) {
+            if (fields[2] == canonical_keys[i]) schema.columns[i] = fields[3];
+        }
+    }
+    if (version <= 0) return false;
+
+    schema.version = version;
+    schema.header = make_header(schema.columns);
+    return true;
+}
+
+/* The header of a device's log. It is the same as 'process_data' makes when every channel has been read, with
+   the version column at the end */
+string schema_store::make_header(const string columns[CHANNEL_COUNT])
+{
+    string header = "#Datetime";
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        header += "," + columns[i];
+    }
+    return header + "," + SCHEMA_VERSION_COLUMN;
+}
+
+/* The header of a device's schema file */
+string schema_store::header()
+{
+    return "#version,Datetime,key,column,type";
+}
+
+/* The null of a canonical channel's type */
+string schema_null(int channel)
+{
+    return canonical_is_text(channel) ? "" : SCHEMA_NULL_NUMBER;
+}
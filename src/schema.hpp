@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SCHEMA_HPP_INCLUDED
+#define SCHEMA_HPP_INCLUDED
+
+#include <string>
+#include <map>
+#include "channels.hpp"
+
+/* Name of the directory (in the logging directory) for the schema of each device */
+#define SCHEMA_DIRECTORY "schemas"
+/* What is logged for a number that the schema has but couldn't be read. A text that couldn't be read is empty */
+#define SCHEMA_NULL_NUMBER "NaN"
+/* The last column of a device's log, with the version of the schema that each row was logged under */
+#define SCHEMA_VERSION_COLUMN "schema version"
+
+using namespace std;
+
+/* The columns of a device's log. Every canonical channel has its place in every row, whether or not the device
+   has it; 'columns' is empty for the ones it doesn't have */
+struct device_schema {
+    int version;
+    string columns[CHANNEL_COUNT]; /* eg; "grid power(W)" */
+    string header;
+};
+
+/* This class keeps a fixed schema for each device, so that its log has the same header on every row, however
+   many of its channels were read. The schema is worked out from the device's channel list (which comes from the
+   channel catalog, with -C) rather than from the values that were read, and a value that couldn't be read is
+   logged as a null of its type (SCHEMA_NULL_NUMBER, or an empty text).
+
+   Each schema has a version. The versions of a device are kept in SCHEMA_DIRECTORY/<device>.csv (a line for
+   each column, with the version and the time that it started), and read back from there after a restart, so a
+   device that comes back with the same channels keeps its version. A device whose channels change (eg; after
+   a firmware update, or when the settings file selects other channels) gets the next version, and its log starts
+   a new segment: the new header is written before the next row. Every row ends with its version
+   (SCHEMA_VERSION_COLUMN), so each segment says which version of the schema file its columns are */
+class schema_store
+{
+    public:
+        schema_store();
+        void initialize(const string &log_directory);
+        bool enabled();
+        bool update(const string &device, const string columns[CHANNEL_COUNT], const string &datetime, const device_schema **schema_out);
+        static string header();
+
+    private:
+        bool load(const string &device, device_schema &schema);
+        static string make_header(const string columns[CHANNEL_COUNT]);
+
+        bool on;
+        string log_directory;
+        map <string, device_schema> schemas;
+};
+
+string schema_null(int channel);
+
+#endif /* SCHEMA_HPP_INCLUDED */
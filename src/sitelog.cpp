@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <fstream>
+#include "sitelog.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Constructor for the site_log class */
+site_log::site_log()
+{
+    this->on = false;
+}
+
+void site_log::initialize(bool enabled)
+{
+    this->on = enabled;
+}
+
+bool site_log::enabled()
+{
+    return this->on;
+}
+
+/* A sweep is starting, to be written to 'date'.csv. A new file needs the headers again */
+void site_log::begin_sweep(const string &date)
+{
+    if (date != this->date) {
+        this->date = date;
+        this->headers.clear();
+    }
+    this->rows.clear();
+}
+
+/* Add a device's row (and its header, as made by 'process_data') to the sweep */
+void site_log::add(const string &device, const string &header, const string &line)
+{
+    if ((not this->on) or (line.empty())) return;
+
+    string serial = site_serial(device);
+    map <string, string>::iterator written = this->headers.find(serial);
+    if ((written == this->headers.end()) or (written->second != header)) {
+        /* The header starts with '#', which goes in front of the serial instead */
+        this->rows.push_back("#" + serial + "," + device + "," + header.substr(header.empty() ? 0 : 1));
+        this->headers[serial] = header;
+    }
+
+    size_t comma = line.find(',');
+    if (comma == string::npos) this->rows.push_back(line + "," + serial);
+    else this->rows.push_back(line.substr(0, comma) + "," + serial + line.substr(comma));
+}
+
+/* The sweep has ended. Its rows go in 'lines' */
+void site_log::end_sweep(vector <string> &lines)
+{
+    lines.swap(this->rows);
+    this->rows.clear();
+}
+
+string site_log::header()
+{
+    return "#Datetime,serial,values";
+}
+
+/* The serial number of a device, from its name (eg; WR21TL06_SN:2001234567). A name without one is used as is */
+string site_serial(const string &device)
+{
+    size_t found = device.rfind("SN:");
+    if ((found == string::npos) or (found + 3 >= device.size())) return device;
+    return device.substr(found + 3);
+}
+
+/* Read a site log back into the rows of each device, keyed by serial. Where a device's header changes during the
+   day, the new header is one of its rows. Rows of a device whose header is not in the file are left out. Returns
+   false if the file can't be read */
+bool read_site_log(const string &path, map <string, site_device> &devices)
+{
+    ifstream reader(path.c_str());
+    if (!reader) return false;
+
+    string line;
+    long orphans = 0;
+    map <string, string> current; /* the header that each device's rows are under */
+    while (getline(reader, line)) {
+        if (line.empty()) continue;
+
+        if (line[0] == '#') {
+            /* The file's own header */
+            if (line.compare(0, 10, "#Datetime,") == 0) continue;
+            size_t first = line.find(',');
+            size_t second = (first == string::npos) ? string::npos : line.find(',', first + 1);
+            if (second == string::npos) continue;
+            string serial = line.substr(1, first - 1);
+            site_device &device = devices[serial];
+            string header = "#" + line.substr(second + 1);
+            /* The first header of the day heads the device's log. A later one that is different (eg; a new schema)
+               starts a segment in it, as it would in the device's own log */
+            if (device.lines.empty()) {
+                device.name = line.substr(first + 1, second - first - 1);
+                device.header = header;
+            }
+            else if (header != current[serial]) {
+                device.lines.push_back(header);
+            }
+            current[serial] = header;
+            continue;
+        }
+
+        size_t first = line.find(',');
+        if (first == string::npos) continue;
+        size_t second = line.find(',', first + 1);
+        string serial = line.substr(first + 1, (second == string::npos) ? string::npos : second - first - 1);
+        map <string, site_device>::iterator device = devices.find(serial);
+        if (device == devices.end()) {
+            orphans++;
+            continue;
+        }
+        device->second.lines.push_back(line.substr(0, first) + ((second == string::npos) ? "" : line.substr(second)));
+    }
+
+    if (orphans > 0) LOG_ERROR(orphans << " rows in " << path << " have no header for their device, and were left out");
+    return true;
+}
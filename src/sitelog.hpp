@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SITELOG_HPP_INCLUDED
+#define SITELOG_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+
+/* Name of the directory (in the logging directory) for the site log */
+#define SITE_DIRECTORY "site"
+
+using namespace std;
+
+/* The rows of one device, as split out of a site log */
+struct site_device {
+    string name;
+    string header; /* of the first rows */
+    vector <string> lines; /* with a header line before the rows that have another header */
+};
+
+/* This class gathers the rows of every device in a sweep into one block, so that the whole site is logged to
+   SITE_DIRECTORY/YYYY-MM-DD.csv (and its 'latest.csv') with a single append, however many devices there are.
+   Each row is the device's own row with its serial after the datetime:
+
+       2018-03-01T10:15:00+1000,2001234567,1500,...
+
+   Before a device's first row in a file (and again if its columns change), a row starting with '#' gives its
+   serial, its name (the directory that its own logs would go in) and its header. 'read_site_log' turns a site
+   log back into the rows of each device (see ardexa-sma-split) */
+class site_log
+{
+    public:
+        site_log();
+        void initialize(bool enabled);
+        bool enabled();
+        void begin_sweep(const string &date);
+        void add(const string &device, const string &header, const string &line);
+        void end_sweep(vector <string> &lines);
+        static string header();
+
+    private:
+        bool on;
+        string date; /* of the file that the headers below were written to */
+        map <string, string> headers; /* the header last written for each serial */
+        vector <string> rows;
+};
+
+string site_serial(const string &device);
+bool read_site_log(const string &path, map <string, site_device> &devices);
+
+#endif /* SITELOG_HPP_INCLUDED */
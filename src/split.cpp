@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/* ardexa-sma-split turns the site logs (written with -L) back into a log for each device, as they would have
+   been written without -L: <device>/YYYY-MM-DD.csv, with the time index next to it. For example, one day:
+
+       ardexa-sma-split -l /opt/ardexa/sma/logs -d 2018-03-01
+
+   Without -d, every day in the site directory is split. A device log that is already there is left alone */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "utils.hpp"
+#include "sitelog.hpp"
+
+#define DEFAULT_LOG_DIRECTORY "/opt/ardexa/sma/logs"
+
+using namespace std;
+
+/* Global variables. */
+int g_debug = 0;
+
+static void usage()
+{
+    cout << "Usage: ardexa-sma-split [-l log directory] [-o output directory] [-d date]" << endl;
+    cout << "The date is as in the log file names, eg; 2018-03-01. The default output directory is the log directory" << endl;
+}
+
+/* The daily site logs, in date order */
+static vector <string> list_days(const string &directory)
+{
+    vector <string> days;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) return days;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if (is_daily_log(name)) days.push_back(name.substr(0, name.size() - 4));
+    }
+    closedir(dir);
+    sort(days.begin(), days.end());
+    return days;
+}
+
+/* Split one day. Returns the number of device logs written */
+static int split_day(const string &log_directory, const string &output_directory, const string &day)
+{
+    string path = log_directory + "/" + SITE_DIRECTORY + "/" + day + ".csv";
+    map <string, site_device> devices;
+    if (not read_site_log(path, devices)) {
+        cout << "Cannot read the site log: " << path << endl;
+        return 0;
+    }
+
+    int written = 0;
+    for (auto iter = devices.begin(); iter != devices.end(); ++iter) {
+        const site_device &device = iter->second;
+        if (device.lines.empty()) continue;
+
+        string directory = output_directory + "/" + device.name;
+        string filename = day + ".csv";
+        struct stat st_file;
+        if (stat((directory + "/" + filename).c_str(), &st_file) == 0) {
+            cout << "Already there, left alone: " << directory << "/" << filename << endl;
+            continue;
+        }
+
+        string block = device.lines[0];
+        for (size_t i = 1; i < device.lines.size(); i++) {
+            block += "\n" + device.lines[i];
+        }
+        if (log_line(directory, filename, block, device.header, false) != 0) {
+            cout << "Cannot write: " << directory << "/" << filename << endl;
+            continue;
+        }
+        written++;
+    }
+    return written;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    string log_directory = DEFAULT_LOG_DIRECTORY;
+    string output_directory, day;
+
+    while ((opt = getopt(argc, argv, "l:o:d:")) != -1) {
+        switch (opt) {
+            case 'l':
+                log_directory = optarg;
+                break;
+            case 'o':
+                output_directory = optarg;
+                break;
+            case 'd':
+                day = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (output_directory.empty()) output_directory = log_directory;
+    if ((not day.empty()) and (not is_daily_log(day + ".csv"))) {
+        cout << "Cannot read the date: " << day << endl;
+        usage();
+        return 1;
+    }
+
+    vector <string> days;
+    if (day.empty()) days = list_days(log_directory + "/" + SITE_DIRECTORY);
+    else days.push_back(day);
+    if (days.empty()) {
+        cout << "There are no site logs in: " << log_directory << "/" << SITE_DIRECTORY << endl;
+        return 1;
+    }
+
+    int written = 0;
+    for (size_t i = 0; i < days.size(); i++) {
+        written += split_day(log_directory, output_directory, days[i]);
+    }
+    cout << "Wrote " << written << " device logs from " << days.size() << " days" << endl;
+
+    return 0;
+}
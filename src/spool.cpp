@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fstream>
+#include <chrono>
+#include <zlib.h>
+#include "spool.hpp"
+#include "journal.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* Compress with gzip framing, for 'Content-Encoding: gzip' */
+static bool gzip(const string &input, string &output)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+    output.resize(deflateBound(&stream, input.size()) + 32);
+    stream.next_in = (Bytef *) input.data();
+    stream.avail_in = input.size();
+    stream.next_out = (Bytef *) &output[0];
+    stream.avail_out = output.size();
+
+    int result = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    return (result == Z_STREAM_END);
+}
+
+/* Send all of a buffer. Returns false on error or timeout */
+static bool send_all(int socket_fd, const char *data, size_t size)
+{
+    size_t sent = 0;
+    while (sent < size) {
+        ssize_t result = send(socket_fd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (result > 0) sent += result;
+        else if ((result < 0) and (errno == EINTR)) continue;
+        else return false;
+    }
+    return true;
+}
+
+/* Connect to a host and port, giving up after SPOOL_TIMEOUT seconds. Returns the socket, or -1 */
+static int connect_to(const string &host, const string &port)
+{
+    struct addrinfo hints, *addresses = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) return -1;
+
+    int socket_fd = -1;
+    for (struct addrinfo *address = addresses; address != NULL; address = address->ai_next) {
+        socket_fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, address->ai_protocol);
+        if (socket_fd < 0) continue;
+
+        int result = connect(socket_fd, address->ai_addr, address->ai_addrlen);
+        if ((result < 0) and (errno == EINPROGRESS)) {
+            struct pollfd waiting = { socket_fd, POLLOUT, 0 };
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if ((poll(&waiting, 1, SPOOL_TIMEOUT * 1000) == 1) and
+                (getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0) and (error == 0)) {
+                result = 0;
+            }
+        }
+        if (result == 0) break;
+
+        close(socket_fd);
+        socket_fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (socket_fd < 0) return -1;
+
+    /* Back to blocking, with timeouts */
+    fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) & ~O_NONBLOCK);
+    struct timeval timeout = { SPOOL_TIMEOUT, 0 };
+    setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return socket_fd;
+}
+
+/* Constructor for the upload_spool class */
+upload_spool::upload_spool()
+{
+    this->rate = SPOOL_DEFAULT_RATE;
+    this->running = false;
+    this->write_fd = -1;
+    this->write_segment = 1;
+    this->write_size = 0;
+    this->first_segment = 1;
+    this->read_segment = 1;
+    this->read_offset = 0;
+}
+
+upload_spool::~upload_spool()
+{
+    stop();
+}
+
+/* Path of a segment file */
+string upload_spool::segment_path(unsigned long segment)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%010lu.seg", segment);
+    return this->directory + "/" + name;
+}
+
+/* Open a segment for appending */
+bool upload_spool::open_segment(unsigned long segment)
+{
+    if (this->write_fd >= 0) close(this->write_fd);
+
+    this->write_fd = open(segment_path(segment).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (this->write_fd < 0) {
+        LOG_ERROR("Cannot open spool segment: " << segment_path(segment));
+        return false;
+    }
+    this->write_segment = segment;
+    this->write_size = lseek(this->write_fd, 0, SEEK_END);
+    return true;
+}
+
+/* Open the spool in the logging directory and start delivering to 'url' (http://host[:port][/path]).
+   A backlog is sent at no more than 'rate' bytes per second */
+bool upload_spool::start(const string &log_directory, const string &url, long rate)
+{
+    if (url.compare(0, 7, "http://") != 0) {
+        LOG_ERROR("Only http:// endpoints are supported: " << url);
+        return false;
+    }
+    string address = url.substr(7);
+    size_t slash = address.find('/');
+    this->path = (slash == string::npos) ? "/" : address.substr(slash);
+    this->host = address.substr(0, slash);
+    this->port = "80";
+    size_t colon = this->host.rfind(':');
+    if ((colon != string::npos) and (this->host.find(']', colon) == string::npos)) {
+        this->port = this->host.substr(colon + 1);
+        this->host = this->host.substr(0, colon);
+    }
+    this->rate = (rate > 0) ? rate : SPOOL_DEFAULT_RATE;
+
+    this->directory = log_directory + "/" + SPOOL_DIRECTORY;
+    if (not create_directory(this->directory)) {
+        LOG_ERROR("Cannot create the spool directory: " << this->directory);
+        return false;
+    }
+
+    /* Find the segments that are left from before */
+    unsigned long lowest = 0, highest = 0;
+    DIR *dir = opendir(this->directory.c_str());
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char *end = NULL;
+            unsigned long segment = strtoul(entry->d_name, &end, 10);
+            if ((segment == 0) or (strcmp(end, ".seg") != 0)) continue;
+            if ((lowest == 0) or (segment < lowest)) lowest = segment;
+            if (segment > highest) highest = segment;
+        }
+        closedir(dir);
+    }
+    this->first_segment = (lowest > 0) ? lowest : 1;
+    if (highest > 0) repair_partial_line(segment_path(highest));
+    if (not open_segment((highest > 0) ? highest : 1)) return false;
+
+    /* Carry on from the acknowledged position */
+    this->read_segment = this->first_segment;
+    this->read_offset = 0;
+    ifstream reader((this->directory + "/" + SPOOL_ACK_FILE).c_str());
+    unsigned long segment = 0;
+    long offset = 0;
+    if ((reader >> segment >> offset) and (segment >= this->first_segment) and (segment <= this->write_segment)) {
+        this->read_segment = segment;
+        this->read_offset = offset;
+    }
+    LOG_DEBUG("Spool segments " << this->first_segment << " to " << this->write_segment << ", acknowledged up to " << this->read_segment << ":" << this->read_offset);
+
+    lock_guard<mutex> lock(this->spool_mutex);
+    this->running = true;
+    this->delivery_thread = thread(&upload_spool::deliver, this);
+    return true;
+}
+
+/* Stop delivering. Anything not yet delivered stays in the spool for next time */
+void upload_spool::stop()
+{
+    {
+        lock_guard<mutex> lock(this->spool_mutex);
+        if (not this->running) return;
+        this->running = false;
+    }
+    this->spool_ready.notify_one();
+    this->delivery_thread.join();
+
+    if (this->write_fd >= 0) {
+        fdatasync(this->write_fd);
+        close(this->write_fd);
+        this->write_fd = -1;
+    }
+}
+
+bool upload_spool::is_running()
+{
+    lock_guard<mutex> lock(this->spool_mutex);
+    return this->running;
+}
+
+/* Add the record of one device reading to the spool */
+void upload_spool::append(const string &device, time_t when, const vector <vec_data> &data_vector)
+{
+    if (this->write_fd < 0) return;
+
+    encode_record(this->encoder, device, when, data_vector);
+    if (this->encoder.overflowed()) {
+        LOG_ERROR("Spool record too big for device: " << device);
+        return;
+    }
+
+    lock_guard<mutex> lock(this->spool_mutex);
+    if (this->write_size >= SPOOL_SEGMENT_SIZE) {
+        fdatasync(this->write_fd);
+        if (not open_segment(this->write_segment + 1)) return;
+
+        /* Don't let the spool grow without limit while the endpoint is down */
+        while (this->write_segment - this->first_segment + 1 > SPOOL_MAX_SEGMENTS) {
+            unlink(segment_path(this->first_segment).c_str());
+            if (this->read_segment <= this->first_segment) {
+                LOG_ERROR("Spool is full. Dropped undelivered segment " << this->first_segment);
+                this->read_segment = this->first_segment + 1;
+                this->read_offset = 0;
+            }
+            this->first_segment++;
+        }
+    }
+
+    ssize_t written = write(this->write_fd, this->encoder.data(), this->encoder.size());
+    if (written != (ssize_t) this->encoder.size()) {
+        LOG_ERROR("Cannot write to spool segment: " << segment_path(this->write_segment));
+        /* Leave no partial record behind */
+        if (written > 0) {
+            if (ftruncate(this->write_fd, this->write_size) != 0) open_segment(this->write_segment + 1);
+        }
+        return;
+    }
+    this->write_size += written;
+}
+
+/* Called after each sweep. The records are synced to disk, then delivery is woken */
+void upload_spool::sweep_done()
+{
+    if (this->write_fd < 0) return;
+    fdatasync(this->write_fd);
+    this->spool_ready.notify_one();
+}
+
+/* Check if there are records that have not been acknowledged. Call with the mutex held */
+bool upload_spool::pending()
+{
+    return (this->read_segment < this->write_segment) or (this->read_offset < this->write_size);
+}
+
+/* Read the next batch of whole records after the acknowledged position. A batch never spans segments.
+   Call with the mutex held. Returns false if there is nothing to send */
+bool upload_spool::next_batch(string &batch, unsigned long *segment, off_t *offset, unsigned long *end_segment, off_t *end_offset)
+{
+    unsigned long current = this->read_segment;
+    off_t position = this->read_offset;
+
+    while (current <= this->write_segment) {
+        off_t size = this->write_size;
+        if (current < this->write_segment) {
+            struct stat st;
+            size = (stat(segment_path(current).c_str(), &st) == 0) ? st.st_size : 0;
+        }
+        if (position >= size) {
+            if (current == this->write_segment) return false;
+            current++;
+            position = 0;
+            continue;
+        }
+
+        size_t length = (size - position > SPOOL_BATCH_SIZE) ? SPOOL_BATCH_SIZE : size - position;
+        batch.resize(length);
+        int read_fd = open(segment_path(current).c_str(), O_RDONLY | O_CLOEXEC);
+        ssize_t got = (read_fd >= 0) ? pread(read_fd, &batch[0], length, position) : -1;
+        if (read_fd >= 0) close(read_fd);
+        if (got <= 0) {
+            LOG_ERROR("Cannot read spool segment: " << segment_path(current));
+            return false;
+        }
+        batch.resize(got);
+
+        size_t last_newline = batch.rfind('\n');
+        if (last_newline == string::npos) {
+            /* Only part of a record. In an old segment it can never be finished, so skip it */
+            if (current == this->write_segment) return false;
+            current++;
+            position = 0;
+            continue;
+        }
+        batch.resize(last_newline + 1);
+
+        *segment = current;
+        *offset = position;
+        *end_segment = current;
+        *end_offset = position + batch.size();
+        return true;
+    }
+    return false;
+}
+
+/* Save the position up to which the endpoint has accepted the records, and delete the segments before it.
+   Call with the mutex held */
+void upload_spool::acknowledge(unsigned long segment, off_t offset)
+{
+    this->read_segment = segment;
+    this->read_offset = offset;
+
+    while (this->first_segment < segment) {
+        unlink(segment_path(this->first_segment).c_str());
+        this->first_segment++;
+    }
+
+    string ack_path = this->directory + "/" + SPOOL_ACK_FILE;
+    string temp_path = ack_path + ".tmp";
+    FILE *writer = fopen(temp_path.c_str(), "w");
+    if (!writer) {
+        LOG_ERROR("Cannot write the spool ack file: " << temp_path);
+        return;
+    }
+    fprintf(writer, "%lu %ld\n", segment, (long) offset);
+    fclose(writer);
+    rename(temp_path.c_str(), ack_path.c_str());
+}
+
+/* Send one batch in an HTTP POST. Returns true if the endpoint accepted it (2xx) */
+bool upload_spool::post(const string &body, unsigned long segment, off_t offset)
+{
+    string compressed;
+    if (not gzip(body, compressed)) {
+        LOG_ERROR("Cannot compress a spool batch");
+        return false;
+    }
+
+    int socket_fd = connect_to(this->host, this->port);
+    if (socket_fd < 0) {
+        LOG_DEBUG("Cannot connect to the upload endpoint: " << this->host << ":" << this->port);
+        return false;
+    }
+
+    string request = "POST " + this->path + " HTTP/1.1\r\n" +
+        "Host: " + this->host + "\r\n" +
+        "Content-Type: application/x-ndjson\r\n" +
+        "Content-Encoding: gzip\r\n" +
+        "Content-Length: " + to_string(compressed.size()) + "\r\n" +
+        "X-Spool-Offset: " + to_string(segment) + ":" + to_string((long) offset) + "\r\n" +
+        "Connection: close\r\n\r\n";
+
+    bool accepted = false;
+    if ((send_all(socket_fd, request.data(), request.size())) and (send_all(socket_fd, compressed.data(), compressed.size()))) {
+        /* Only the status line matters: "HTTP/1.1 200 OK" */
+        char response[256];
+        size_t length = 0;
+        while (length < sizeof(response) - 1) {
+            ssize_t got = recv(socket_fd, response + length, sizeof(response) - 1 - length, 0);
+            if (got <= 0) break;
+            length += got;
+            if (memchr(response, '\n', length)) break;
+        }
+        response[length] = '\0';
+
+        int status = 0;
+        if (sscanf(response, "HTTP/%*s %d", &status) == 1) {
+            accepted = (status >= 200) and (status < 300);
+            if (not accepted) LOG_ERROR("The upload endpoint refused a batch with status " << status);
+        }
+    }
+
+    close(socket_fd);
+    return accepted;
+}
+
+/* Body of the delivery thread */
+void upload_spool::deliver()
+{
+    int backoff = 0;
+    chrono::steady_clock::time_point next_attempt = chrono::steady_clock::now();
+    string batch;
+
+    unique_lock<mutex> lock(this->spool_mutex);
+    while (this->running) {
+        if (not pending()) {
+            this->spool_ready.wait(lock, [this] { return (not this->running) or (pending()); });
+            continue;
+        }
+        if (chrono::steady_clock::now() < next_attempt) {
+            this->spool_ready.wait_until(lock, next_attempt, [this] { return not this->running; });
+            continue;
+        }
+
+        unsigned long segment, end_segment;
+        off_t offset, end_offset;
+        if (not next_batch(batch, &segment, &offset, &end_segment, &end_offset)) {
+            /* Only a partial record so far */
+            next_attempt = chrono::steady_clock::now() + chrono::seconds(1);
+            continue;
+        }
+
+        lock.unlock();
+        bool accepted = post(batch, segment, offset);
+        lock.lock();
+
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (accepted) {
+            acknowledge(end_segment, end_offset);
+            if (backoff > 0) LOG_INFO("Upload endpoint is back");
+            backoff = 0;
+            /* Send a backlog no faster than the rate */
+            next_attempt = now;
+            if (pending()) next_attempt += chrono::milliseconds((long) (1000.0 * batch.size() / this->rate));
+        }
+        else {
+            backoff = (backoff == 0) ? SPOOL_MIN_BACKOFF : min(backoff * 2, SPOOL_MAX_BACKOFF);
+            LOG_ERROR("Upload failed. Trying again in " << backoff << " seconds");
+            next_attempt = now + chrono::seconds(backoff);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SPOOL_HPP_INCLUDED
+#define SPOOL_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include "channels.hpp"
+#include "ndjson.hpp"
+
+/* Name of the spool directory, in the logging directory */
+#define SPOOL_DIRECTORY ".spool"
+/* Name of the file (in the spool directory) holding the acknowledged position */
+#define SPOOL_ACK_FILE "ack"
+/* A new segment is started when the current one reaches this size */
+#define SPOOL_SEGMENT_SIZE (4 * 1024 * 1024)
+/* Most segments kept. Beyond this the oldest rows are dropped, so the spool can't fill the disk */
+#define SPOOL_MAX_SEGMENTS 64
+/* Most (uncompressed) bytes sent in one batch */
+#define SPOOL_BATCH_SIZE (256 * 1024)
+/* Seconds to wait after the first failed delivery. This doubles on each failure, up to SPOOL_MAX_BACKOFF */
+#define SPOOL_MIN_BACKOFF 5
+#define SPOOL_MAX_BACKOFF 300
+/* Seconds to wait for the endpoint to connect, accept or answer */
+#define SPOOL_TIMEOUT 30
+/* Default rate (uncompressed bytes per second) at which a backlog is sent */
+#define SPOOL_DEFAULT_RATE 65536
+
+using namespace std;
+
+/* This class is an optional built in forwarder. Each reading is encoded as an NDJSON record and appended to
+   segment files in the spool directory (synced once per sweep). A delivery thread sends the records in batches,
+   gzip compressed, in an HTTP POST to the endpoint. When the endpoint answers with a 2xx status, the position
+   up to which the records were sent is saved in the ack file, and segments that have been sent in full are
+   deleted. After a failure, delivery is retried with a growing backoff. When the endpoint comes back, the
+   backlog is sent at no more than the configured rate, so a long outage doesn't flood the uplink.
+
+   Delivery is at least once: a batch can be sent again if the service stops between the endpoint accepting
+   it and the ack file being written. Each POST has an X-Spool-Offset header (segment:offset of its first
+   record) so the endpoint can discard a batch it has already seen */
+class upload_spool
+{
+    public:
+        upload_spool();
+        ~upload_spool();
+        bool start(const string &log_directory, const string &url, long rate);
+        void stop();
+        bool is_running();
+        void append(const string &device, time_t when, const vector <vec_data> &data_vector);
+        void sweep_done();
+
+    private:
+        void deliver();
+        bool pending();
+        bool next_batch(string &batch, unsigned long *segment, off_t *offset, unsigned long *end_segment, off_t *end_offset);
+        bool post(const string &body, unsigned long segment, off_t offset);
+        void acknowledge(unsigned long segment, off_t offset);
+        bool open_segment(unsigned long segment);
+        string segment_path(unsigned long segment);
+
+        string directory;
+        string host;
+        string port;
+        string path;
+        long rate;
+        bool running;
+        thread delivery_thread;
+        mutex spool_mutex;
+        condition_variable spool_ready;
+        json_encoder encoder;
+
+        /* The writer's position */
+        int write_fd;
+        unsigned long write_segment;
+        off_t write_size;
+        unsigned long first_segment; /* oldest segment still on disk */
+
+        /* The acknowledged position */
+        unsigned long read_segment;
+        off_t read_offset;
+};
+
+#endif /* SPOOL_HPP_INCLUDED */
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include "timeindex.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/* The last bucket in the index of the log that was last written to in a directory. Only one daily log in a
+   directory is written to at a time, so this has an entry for each directory rather than for each day */
+struct last_bucket {
+    string log_path;
+    time_t bucket;
+};
+static map <string, last_bucket> last_buckets;
+
+/* The index file of a log file */
+string index_path(const string &log_path)
+{
+    size_t dot = log_path.rfind('.');
+    return log_path.substr(0, dot) + INDEX_SUFFIX;
+}
+
+/* Start of the bucket that a time falls in */
+static time_t bucket_start(time_t when)
+{
+    return when - (when % INDEX_BUCKET);
+}
+
+/* Read the entries of an index, oldest first. Returns false if there is no index */
+bool read_index(const string &log_path, vector <index_entry> &entries)
+{
+    entries.clear();
+    ifstream reader(index_path(log_path).c_str());
+    if (!reader) return false;
+
+    string line;
+    while (getline(reader, line)) {
+        istringstream fields(line);
+        long bucket = 0, offset = 0;
+        /* A line cut short by a crash is simply skipped */
+        if (not (fields >> bucket >> offset)) continue;
+        index_entry entry = { (time_t) bucket, (off_t) offset };
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+/* Add index entries for rows that have just been appended to a log. 'block' is the rows (one or more lines)
+   and 'offset' is where they start in the log. If 'new_log' is true, the log has just been started, so any
+   old index is thrown away */
+void index_rows(const string &log_path, off_t offset, const string &block, bool new_log)
+{
+    time_t last = 0;
+    string directory = log_path.substr(0, log_path.rfind('/') + 1);
+    map <string, last_bucket>::iterator it = last_buckets.find(directory);
+    if (new_log) {
+        /* nothing to keep */
+    }
+    else if ((it != last_buckets.end()) and (it->second.log_path == log_path)) {
+        last = it->second.bucket;
+    }
+    else {
+        vector <index_entry> entries;
+        if (read_index(log_path, entries) and (not entries.empty())) last = entries.back().bucket;
+    }
+
+    string entries = "";
+    size_t start = 0;
+    while (start < block.size()) {
+        size_t end = block.find('\n', start);
+        if (end == string::npos) end = block.size();
+
+        time_t when;
+        size_t comma = block.find(',', start);
+        if ((comma != string::npos) and (comma < end) and (parse_datetime(block.substr(start, comma - start), &when))) {
+            time_t bucket = bucket_start(when);
+            if (bucket > last) {
+                entries += to_string((long) bucket) + " " + to_string((long) (offset + start)) + "\n";
+                last = bucket;
+            }
+        }
+        start = end + 1;
+    }
+    last_bucket &kept = last_buckets[directory];
+    kept.log_path = log_path;
+    kept.bucket = last;
+
+    if ((entries.empty()) and (not new_log)) return;
+    string path = index_path(log_path);
+    ofstream writer(path.c_str(), new_log ? ios::trunc : ios::app);
+    if (!writer) {
+        LOG_DEBUG("Cannot open index file: " << path);
+        return;
+    }
+    writer << entries;
+}
+
+/* Read the rows of a log from 'from' to 'to' (inclusive), using the index to skip the rows before 'from'.
+   Rows are assumed to be in time order. Returns the number of rows added to 'lines' */
+size_t read_range(const string &log_path, time_t from, time_t to, vector <string> &lines)
+{
+    ifstream reader(log_path.c_str());
+    if (!reader) return 0;
+
+    reader.seekg(0, ios::end);
+    off_t size = reader.tellg();
+    off_t offset = 0;
+
+    vector <index_entry> entries;
+    read_index(log_path, entries);
+    for (size_t i = 0; i < entries.size(); i++) {
+        if ((entries[i].bucket > from) or (entries[i].offset > size)) break;
+        offset = entries[i].offset;
+    }
+    reader.seekg(offset);
+
+    size_t count = 0;
+    string line;
+    while (getline(reader, line)) {
+        if ((line.empty()) or (line[0] == '#')) continue;
+
+        time_t when;
+        size_t comma = line.find(',');
+        if ((comma == string::npos) or (not parse_datetime(line.substr(0, comma), &when))) continue;
+        if (when < from) continue;
+        if (when > to) break;
+
+        lines.push_back(line);
+        count++;
+    }
+    return count;
+}
+
+/* Read the rows of one device from 'from' to 'to', across as many daily logs as that takes */
+size_t read_device_range(const string &log_directory, const string &device, time_t from, time_t to, vector <string> &lines)
+{
+    size_t count = 0;
+    if (to < from) return 0;
+
+    /* Step through the days at midday, so that daylight saving changes can't skip or repeat a day */
+    struct tm day;
+    localtime_r(&from, &day);
+    day.tm_hour = 12;
+    day.tm_min = 0;
+    day.tm_sec = 0;
+    day.tm_isdst = -1;
+    string last_date = get_date(to);
+
+    while (true) {
+        time_t midday = mktime(&day);
+        string date = get_date(midday);
+        if (date > last_date) break;
+
+        count += read_range(log_directory + "/" + device + "/" + date + ".csv", from, to, lines);
+        day.tm_mday++;
+        day.tm_isdst = -1;
+    }
+    return count;
+}
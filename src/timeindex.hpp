@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef TIMEINDEX_HPP_INCLUDED
+#define TIMEINDEX_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <sys/types.h>
+
+/* Seconds in each bucket of the index. A day has 288 buckets at most */
+#define INDEX_BUCKET 300
+/* The index of YYYY-MM-DD.csv is YYYY-MM-DD.idx, in the same directory */
+#define INDEX_SUFFIX ".idx"
+
+using namespace std;
+
+/* One entry of an index: the first row at or after the start of a bucket starts at 'offset' in the log */
+struct index_entry {
+    time_t bucket;
+    off_t offset;
+};
+
+/* Each daily log has a small sidecar index, with one text line "<bucket start> <byte offset>" for every bucket
+   that has rows. It is appended to by 'log_line' as rows are written, so a reader can seek straight to the rows
+   for a time range instead of reading the whole day. The index is only a hint: a missing or short index just
+   means more of the log is read, and entries past the end of the log are ignored */
+string index_path(const string &log_path);
+void index_rows(const string &log_path, off_t offset, const string &block, bool new_log);
+bool read_index(const string &log_path, vector <index_entry> &entries);
+size_t read_range(const string &log_path, time_t from, time_t to, vector <string> &lines);
+size_t read_device_range(const string &log_directory, const string &device, time_t from, time_t to, vector <string> &lines);
+
+#endif /* TIMEINDEX_HPP_INCLUDED */
@@ -13,7 +13,12 @@
  *
  */
 
+#include <string.h>
+#include <limits.h>
+#include <sys/resource.h>
 #include "utils.hpp"
+#include "logger.hpp"
+#include "timeindex.hpp"
 
 /* Open the file where the log entry will be written, and write the line to it
    When using this function, make sure 'line' and 'header' have a newline at end
@@ -36,7 +41,7 @@ int log_line(string directory, string filename, string line, string header, bool
 
     /* Check and create the directory if necessary */
     if (stat(directory.c_str(), &st_directory) == -1) {
-        if (g_debug) cout << "Directory doesn't exist. Creating it: " << directory.c_str() << endl;
+        LOG_DEBUG("Directory doesn't exist. Creating it: " << directory.c_str());
         rotate = true;
         bool result = create_directory(directory);
         if (!result) {
@@ -45,31 +50,41 @@ int log_line(string directory, string filename, string line, string header, bool
     }
 
     fullpath = directory + filename;
-    if (g_debug) cout << "Full filename: " << fullpath << endl;
+    LOG_DEBUG("Full filename: " << fullpath);
 
     /* Check the full path. If it doesn't exist, the header line will need to be written
        If the file DOES exist AND if a rotation is called, then rename it and annotate a header is required
        And the rotate will need to be set to true
        */
+    off_t offset = 0;
     if (stat(fullpath.c_str(), &st_directory) == -1) {
-        if (g_debug) cout << "Fullpath doesn't exist. Path: " << fullpath.c_str() << endl;
+        LOG_DEBUG("Fullpath doesn't exist. Path: " << fullpath.c_str());
         write_header = true;
         rotate = true;
     }
+    else {
+        offset = st_directory.st_size;
+    }
 
     /* Open it for appending data only */
     ofstream writer(fullpath.c_str(), ios::app);
     if(!writer) {
-        if (g_debug) cout << "Cannot open logging file: " << fullpath << endl;
+        LOG_DEBUG("Cannot open logging file: " << fullpath);
         return 2;
     }
     if (write_header) {
         writer << header << endl;
+        offset = header.size() + 1;
     }
 
     writer << line << endl;
     writer.close();
 
+    /* Keep the time index of daily logs up to date */
+    if (is_daily_log(filename)) {
+        index_rows(fullpath, offset, line, write_header);
+    }
+
     write_header = false;
     /* If 'log_to_latest' is set, then write the line to this file as well */
     if (log_to_latest) {
@@ -80,11 +95,15 @@ int log_line(string directory, string filename, string line, string header, bool
             rename(fullpath.c_str(), newpath.c_str());
             write_header = true;
         }
+        /* If a crash happened between the rename and the first write, there is no file yet, so it still needs a header */
+        else if (stat(fullpath.c_str(), &st_directory) == -1) {
+            write_header = true;
+        }
 
         /* Open it for appending data only */
         ofstream latest(fullpath.c_str(), ios::app);
         if(!latest) {
-            if (g_debug) cout << "Cannot open logging file: " << fullpath << endl;
+            LOG_DEBUG("Cannot open logging file: " << fullpath);
             return 3;
         }
         if (write_header) {
@@ -102,36 +121,41 @@ int log_line(string directory, string filename, string line, string header, bool
 /* Returns the current date as a string in the format "2017-01-30" */
 string get_current_date()
 {
-    time_t rawtime;
-    struct tm * timeinfo;
+    return get_date(time(nullptr));
+}
+
+/* Returns the current time as a string, in the format "2017-01-30T15:30:45" */
+string get_current_datetime()
+{
+    return get_datetime(time(nullptr));
+}
+
+/* Returns a date as a string in the format "2017-01-30" */
+string get_date(time_t rawtime)
+{
+    struct tm timeinfo;
     char buffer[DATESIZE];
 
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    localtime_r(&rawtime, &timeinfo);
 
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d", timeinfo);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeinfo);
 
     string date(buffer);
     return date;
 }
 
-/* Returns the current time as a string, in the format "2017-01-30T15:30:45" */
-string get_current_datetime()
+/* Returns a time as a string, in the format "2017-01-30T15:30:45+1000" */
+string get_datetime(time_t rawtime)
 {
-    time_t rawtime;
-    struct tm * timeinfo;
+    struct tm timeinfo;
     char buffer[DATESIZE];
 
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    localtime_r(&rawtime, &timeinfo);
 
     /* This includes the time zone at the end of the time */
-    strftime(buffer, DATESIZE, "%H:%M:%S%z", timeinfo);
-
-    string time(buffer);
-
-    string datetime = get_current_date() + "T" + time;
+    strftime(buffer, DATESIZE, "%Y-%m-%dT%H:%M:%S%z", &timeinfo);
 
+    string datetime(buffer);
     return datetime;
 }
 
@@ -163,6 +187,16 @@ bool check_file(string file)
 
 }
 
+/* Check if two paths are the same directory (eg; "/opt/logs" and "/opt/logs/"). A path that doesn't exist yet is
+   compared as it is */
+bool same_directory(const string &first, const string &second)
+{
+    char first_real[PATH_MAX], second_real[PATH_MAX];
+    string first_path = (realpath(first.c_str(), first_real)) ? first_real : first;
+    string second_path = (realpath(second.c_str(), second_real)) ? second_real : second;
+    return (first_path == second_path);
+}
+
 /* Create a directory, including all parent paths if they don't exist */
 bool create_directory(string directory)
 {
@@ -183,13 +217,13 @@ bool create_directory(string directory)
         else {
             temp = directory.substr(0, pos);
             if (check_directory(temp)) {
-                if (g_debug) cout << "The dir: " << temp << " exists." << endl;
+                LOG_DEBUG("The dir: " << temp << " exists.");
 
             }
             else {
-                if (g_debug) cout << "Creating the dir: " << temp << endl;
+                LOG_DEBUG("Creating the dir: " << temp);
                 if (mkdir(temp.c_str(), 0744) != 0) {
-                    cout << "Could not create the directory: " << temp << endl;
+                    LOG_ERROR("Could not create the directory: " << temp);
                     return false;
                 }
             }
@@ -329,3 +363,49 @@ bool convert_long(string incoming, long *outgoing)
     }
 
 }
+
+/* Convert a datetime as written by 'get_current_datetime' (eg; 2018-03-01T10:15:00+1000) */
+bool parse_datetime(const string &datetime, time_t *when)
+{
+    struct tm timeinfo;
+    memset(&timeinfo, 0, sizeof(timeinfo));
+
+    const char *end = strptime(datetime.c_str(), "%Y-%m-%dT%H:%M:%S%z", &timeinfo);
+    if ((end == NULL) or (*end != '\0')) return false;
+
+    *when = timegm(&timeinfo) - timeinfo.tm_gmtoff;
+    return true;
+}
+
+/* Check if a file name is that of a daily log (YYYY-MM-DD.csv) */
+bool is_daily_log(const string &name)
+{
+    if ((name.size() != 14) or (name.compare(10, 4, ".csv") != 0)) return false;
+    for (int i = 0; i < 10; i++) {
+        bool digit = (name[i] >= '0') and (name[i] <= '9');
+        if ((i == 4) or (i == 7)) {
+            if (name[i] != '-') return false;
+        }
+        else if (not digit) return false;
+    }
+    return true;
+}
+
+/* CPU time (user and system) used by the process so far, in seconds */
+double get_cpu_seconds()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/* Memory of the process that is resident now, in kB. Returns 0 if it can't be read */
+long get_rss_kb()
+{
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(statm);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
@@ -39,9 +39,14 @@ using namespace std;
 int log_line(string directory, string filename, string line, string header, bool log_to_latest);
 string get_current_date();
 string get_current_datetime();
+string get_date(time_t rawtime);
+string get_datetime(time_t rawtime);
+bool parse_datetime(const string &datetime, time_t *when);
+bool is_daily_log(const string &name);
 bool check_directory(string directory);
 bool check_file(string file);
 bool create_directory(string directory);
+bool same_directory(const string &first, const string &second);
 string convert_double(double number);
 string replace_spaces(string incoming);
 bool check_root();
@@ -49,5 +54,7 @@ bool check_pid_file();
 void remove_pid_file();
 string trim_whitespace(string raw_string);
 bool convert_long(string incoming, long *outgoing);
+double get_cpu_seconds();
+long get_rss_kb();
 
 #endif /* UTILS_HPP_INCLUDED */
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "watchdog.hpp"
+#include "utils.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+service_watchdog g_watchdog;
+
+/* Milliseconds on the steady clock. Never 0, which means paused */
+static long long steady_ms()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count() + 1;
+}
+
+/* Constructor for the service_watchdog class */
+service_watchdog::service_watchdog()
+{
+    this->stall_seconds = 0;
+    this->ping_interval_ms = 0;
+    this->last_progress_ms = 0;
+    this->pause_limit_ms = 0;
+    this->running = false;
+}
+
+service_watchdog::~service_watchdog()
+{
+    stop();
+}
+
+/* Start watching. A stall is no progress for 'stall_seconds' */
+void service_watchdog::start(int stall_seconds)
+{
+    if (this->running) return;
+    this->stall_seconds = stall_seconds;
+
+    /* systemd says how often it wants to hear from the service, if at all */
+    const char *usec = getenv("WATCHDOG_USEC");
+    long usec_long = 0;
+    if ((usec) and (convert_long(usec, &usec_long)) and (usec_long > 0)) {
+        this->ping_interval_ms = usec_long / 2000;
+    }
+
+    this->last_progress_ms = steady_ms();
+    this->running = true;
+    this->watch_thread = thread(&service_watchdog::run, this);
+    LOG_INFO("Watchdog started. A stall is " << stall_seconds << " seconds without progress" <<
+             ((this->ping_interval_ms > 0) ? ", and systemd is told every " + to_string(this->ping_interval_ms) + " ms" : ""));
+}
+
+void service_watchdog::stop()
+{
+    {
+        lock_guard<mutex> lock(this->watch_mutex);
+        if (not this->running) return;
+        this->running = false;
+    }
+    this->watch_stop.notify_all();
+    this->watch_thread.join();
+}
+
+bool service_watchdog::enabled()
+{
+    return (this->stall_seconds > 0);
+}
+
+/* Seconds without progress that are a stall, or 0 if the watchdog isn't started */
+int service_watchdog::stall_limit()
+{
+    return this->stall_seconds;
+}
+
+/* Send a state (eg; READY=1) to systemd by the sd_notify protocol. Nothing is sent if the service wasn't started
+   by systemd with a notify socket */
+void service_watchdog::notify(const string &state)
+{
+    const char *path = getenv("NOTIFY_SOCKET");
+    if ((!path) or (path[0] == '\0')) return;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    size_t length = strlen(path);
+    if (length >= sizeof(address.sun_path)) return;
+    memcpy(address.sun_path, path, length);
+    /* An abstract socket starts with '@', which is a NUL in the address */
+    if (address.sun_path[0] == '@') address.sun_path[0] = '\0';
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return;
+    sendto(fd, state.c_str(), state.size(), MSG_NOSIGNAL, (struct sockaddr *) &address, offsetof(struct sockaddr_un, sun_path) + length);
+    close(fd);
+}
+
+/* The service has done something (eg; a channel was read). Also ends a pause */
+void service_watchdog::progress()
+{
+    this->last_progress_ms = steady_ms();
+}
+
+/* The service is waiting on purpose (eg; between sweeps). Any call to 'progress' ends the pause. If
+   'limit_seconds' is given, a pause that goes on for longer than that is a stall */
+void service_watchdog::pause(int limit_seconds)
+{
+    this->pause_limit_ms = (limit_seconds > 0) ? steady_ms() + limit_seconds * 1000LL : 0;
+    this->last_progress_ms = 0;
+}
+
+/* A sweep has ended, in which 'answered' devices on 'driver' answered and 'failed' didn't (devices that were not
+   read at all are in neither). Returns true if the driver should be recovered now */
+bool service_watchdog::end_sweep(DWORD driver, int answered, int failed)
+{
+    if (not enabled()) return false;
+
+    map <DWORD, driver_health>::iterator it = this->drivers.find(driver);
+    if (it == this->drivers.end()) {
+        driver_health health = { 0, 0, WATCHDOG_MIN_RECOVERY };
+        it = this->drivers.insert(make_pair(driver, health)).first;
+    }
+    driver_health &health = it->second;
+
+    if ((answered > 0) or (failed == 0)) {
+        health.failed_sweeps = 0;
+        health.recovery_interval = WATCHDOG_MIN_RECOVERY;
+        health.next_recovery = 0;
+        return false;
+    }
+
+    health.failed_sweeps++;
+    return (health.failed_sweeps >= WATCHDOG_FAILED_SWEEPS) and (time(nullptr) >= health.next_recovery);
+}
+
+/* A recovery of 'driver' has been done. 'answered' is whether its devices answered after it */
+void service_watchdog::recovered(DWORD driver, bool answered)
+{
+    map <DWORD, driver_health>::iterator it = this->drivers.find(driver);
+    if (it == this->drivers.end()) return;
+    driver_health &health = it->second;
+    if (answered) {
+        health.failed_sweeps = 0;
+        health.recovery_interval = WATCHDOG_MIN_RECOVERY;
+        health.next_recovery = 0;
+        return;
+    }
+
+    health.next_recovery = time(nullptr) + health.recovery_interval;
+    LOG_INFO("The devices still don't answer. Trying again in no less than " << health.recovery_interval << " seconds");
+    health.recovery_interval = (health.recovery_interval * 2 > WATCHDOG_MAX_RECOVERY) ? WATCHDOG_MAX_RECOVERY : health.recovery_interval * 2;
+}
+
+/* Body of the watchdog thread. It wakes every second (or more often, if systemd wants to hear more often) to check
+   for a stall, and tells systemd all is well */
+void service_watchdog::run()
+{
+    long long last_ping_ms = 0;
+    long wait_ms = ((this->ping_interval_ms > 0) and (this->ping_interval_ms < 1000)) ? this->ping_interval_ms : 1000;
+    unique_lock<mutex> lock(this->watch_mutex);
+    while (this->running) {
+        this->watch_stop.wait_for(lock, chrono::milliseconds(wait_ms));
+        if (not this->running) break;
+
+        long long now_ms = steady_ms();
+        long long last_progress_ms = this->last_progress_ms;
+        long long pause_limit_ms = this->pause_limit_ms;
+        bool stalled = (last_progress_ms != 0) and (now_ms - last_progress_ms > this->stall_seconds * 1000LL);
+        bool stuck = (last_progress_ms == 0) and (pause_limit_ms != 0) and (now_ms > pause_limit_ms);
+        if ((stalled) or (stuck)) {
+            /* The call that is stuck can't be got back. Exit, so that the service is started again */
+            if (stalled) LOG_ERROR("No progress for " << (now_ms - last_progress_ms) / 1000 << " seconds. A call to the library has stalled. Exiting");
+            else LOG_ERROR("A call to the library that may take a while has taken too long. It has stalled. Exiting");
+            notify("STATUS=Stalled");
+            this_thread::sleep_for(chrono::seconds(1));
+            _exit(WATCHDOG_EXIT_CODE);
+        }
+
+        if ((this->ping_interval_ms > 0) and (now_ms - last_ping_ms >= this->ping_interval_ms)) {
+            notify("WATCHDOG=1");
+            last_ping_ms = now_ms;
+        }
+    }
+}
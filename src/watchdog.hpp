@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2013-2018 Ardexa Pty Ltd
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef WATCHDOG_HPP_INCLUDED
+#define WATCHDOG_HPP_INCLUDED
+
+#include <string>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <map>
+#include "bus.hpp"
+
+/* Sweeps in a row in which no device on a driver answered before the driver is recovered */
+#define WATCHDOG_FAILED_SWEEPS 3
+/* The driver that failed devices are counted against when the drivers that they are on aren't known */
+#define WATCHDOG_UNKNOWN_DRIVER 0xFFFFFFFF
+/* Device detection may take this many times the stall time before it is taken to have stalled */
+#define WATCHDOG_DETECTION_STALLS 6
+/* Seconds after a recovery that didn't help before another is tried. This doubles up to WATCHDOG_MAX_RECOVERY */
+#define WATCHDOG_MIN_RECOVERY 60
+#define WATCHDOG_MAX_RECOVERY 3600
+/* The exit code when the service is stalled */
+#define WATCHDOG_EXIT_CODE 5
+
+using namespace std;
+
+/* The sweeps in a row in which no device on a driver answered, and when it may be recovered again */
+struct driver_health {
+    int failed_sweeps;
+    time_t next_recovery;
+    int recovery_interval;
+};
+
+/* This class watches the service for two kinds of trouble with the bus (eg; a USB to RS485 converter that
+   has dropped off and come back).
+
+   A stall is a library call that doesn't return. Every channel read counts as progress, and if there has been
+   none for 'stall_seconds' (outside of the waits between sweeps, which are paused) the call can't be got back,
+   so the service exits and systemd starts it again. Device detection is paused too, since it can take minutes,
+   but only for up to WATCHDOG_DETECTION_STALLS times the stall time. Under systemd with WatchdogSec,
+   WATCHDOG=1 is sent (by the sd_notify protocol) at half the watchdog interval while there is progress, so
+   systemd also restarts a service that is stuck.
+
+   A failing bus is a driver (eg; a serial port) whose calls return, but on which no device answers for
+   WATCHDOG_FAILED_SWEEPS sweeps in a row, whatever the devices on the other drivers do. That driver is
+   recovered without a restart (see recover_drivers in main.cpp). If a recovery doesn't bring its devices back
+   (eg; they are asleep at night), the next is tried after WATCHDOG_MIN_RECOVERY seconds, and then at doubling
+   intervals */
+class service_watchdog
+{
+    public:
+        service_watchdog();
+        ~service_watchdog();
+        void start(int stall_seconds);
+        void stop();
+        bool enabled();
+        int stall_limit();
+        void notify(const string &state);
+        void progress();
+        void pause(int limit_seconds = 0);
+        bool end_sweep(DWORD driver, int answered, int failed);
+        void recovered(DWORD driver, bool answered);
+
+    private:
+        void run();
+
+        int stall_seconds; /* 0 if the watchdog isn't started */
+        long ping_interval_ms; /* half of WatchdogSec, or 0 if systemd isn't watching */
+        atomic <long long> last_progress_ms; /* on the steady clock, or 0 when paused */
+        atomic <long long> pause_limit_ms; /* when a pause is taken to have stalled, or 0 if it can go on */
+
+        map <DWORD, driver_health> drivers;
+
+        bool running;
+        thread watch_thread;
+        mutex watch_mutex;
+        condition_variable watch_stop;
+};
+
+extern service_watchdog g_watchdog;
+
+#endif /* WATCHDOG_HPP_INCLUDED */